@@ -0,0 +1,320 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <string>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/resource.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/**
+ * benchmark用的计时、延迟直方图和常驻内存
+ * CycleClock在x86上读TSC（一次几纳秒），其他平台用steady_clock，启动时对着steady_clock校准成纳秒；
+ * LatencyHistogram是HDR风格的对数-线性直方图：每个2的幂区间再均分成kSubBuckets份，
+ * 相对误差不超过1/kSubBuckets，记录一次只是一次数组加法，每个线程一个，结束后Merge。
+ * PerfCounters用perf_event_open读当前线程的硬件计数器，不需要root和perf命令。
+ */
+
+// 当前进程常驻内存（字节），读 /proc/self/statm 第二列
+inline size_t CurrentRSS()
+{
+    FILE *fp = fopen("/proc/self/statm", "r");
+    if (fp == nullptr)
+        return 0;
+    size_t pages = 0, resident = 0;
+    if (fscanf(fp, "%zu %zu", &pages, &resident) != 2)
+        resident = 0;
+    fclose(fp);
+    return resident * (size_t)sysconf(_SC_PAGESIZE);
+}
+
+class CycleClock
+{
+public:
+    static uint64_t Now()
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   std::chrono::steady_clock::now().time_since_epoch())
+            .count();
+#endif
+    }
+
+    // 每个tick多少纳秒，第一次调用时用10ms校准
+    static double NsPerTick()
+    {
+        static double nsPerTick = Calibrate();
+        return nsPerTick;
+    }
+
+private:
+    static double Calibrate()
+    {
+        auto begin = std::chrono::steady_clock::now();
+        uint64_t t0 = Now();
+        while (std::chrono::steady_clock::now() - begin < std::chrono::milliseconds(10))
+        {
+        }
+        uint64_t t1 = Now();
+        double ns = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count();
+        return t1 > t0 ? ns / (double)(t1 - t0) : 1.0;
+    }
+};
+
+class LatencyHistogram
+{
+public:
+    static const int kSubBits = 4;
+    static const uint64_t kSubBuckets = (uint64_t)1 << kSubBits; // 每个2的幂区间的份数
+    static const size_t kBuckets = (64 - kSubBits + 1) * kSubBuckets;
+
+    LatencyHistogram()
+    {
+        Reset();
+    }
+
+    void Reset()
+    {
+        memset(_counts, 0, sizeof(_counts));
+        _count = 0;
+        _max = 0;
+    }
+
+    void Record(uint64_t value)
+    {
+        _counts[BucketOf(value)]++;
+        _count++;
+        if (value > _max)
+            _max = value;
+    }
+
+    void Merge(const LatencyHistogram &other)
+    {
+        for (size_t i = 0; i < kBuckets; ++i)
+            _counts[i] += other._counts[i];
+        _count += other._count;
+        if (other._max > _max)
+            _max = other._max;
+    }
+
+    uint64_t Count() const { return _count; }
+    uint64_t Max() const { return _max; }
+
+    // p分位数（0 < p <= 1），返回所在桶的上沿，不超过Max()
+    uint64_t Percentile(double p) const
+    {
+        if (_count == 0)
+            return 0;
+        uint64_t target = (uint64_t)(p * _count);
+        if (target >= _count)
+            target = _count - 1;
+        uint64_t seen = 0;
+        for (size_t i = 0; i < kBuckets; ++i)
+        {
+            seen += _counts[i];
+            if (seen > target)
+            {
+                uint64_t upper = BucketUpper(i);
+                return upper < _max ? upper : _max;
+            }
+        }
+        return _max;
+    }
+
+private:
+    // [0, kSubBuckets)每个值一个桶，之后每个2的幂区间kSubBuckets个桶
+    static size_t BucketOf(uint64_t value)
+    {
+        if (value < kSubBuckets)
+            return (size_t)value;
+        int exp = 63 - __builtin_clzll(value); // >= kSubBits
+        uint64_t sub = (value >> (exp - kSubBits)) & (kSubBuckets - 1);
+        return (size_t)((exp - kSubBits + 1) * kSubBuckets + sub);
+    }
+
+    static uint64_t BucketUpper(size_t index)
+    {
+        if (index < kSubBuckets)
+            return index;
+        int exp = (int)(index / kSubBuckets) + kSubBits - 1;
+        uint64_t sub = index % kSubBuckets;
+        uint64_t lower = ((uint64_t)1 << exp) + (sub << (exp - kSubBits));
+        return lower + ((uint64_t)1 << (exp - kSubBits)) - 1;
+    }
+
+    uint64_t _counts[kBuckets];
+    uint64_t _count;
+    uint64_t _max;
+};
+
+// 每个事件在一段时间内的计数，valid为false表示这个事件打不开
+struct PerfCounts
+{
+    enum Event
+    {
+        kCycles,
+        kInstructions,
+        kL1DMisses,   // L1数据缓存读缺失
+        kLLCMisses,   // 末级缓存缺失
+        kDTLBMisses,  // 数据TLB读缺失
+        kContextSwitches,
+        kEventNum
+    };
+
+    uint64_t value[kEventNum] = {};
+    bool valid[kEventNum] = {};
+
+    // 累加[begin, end)之间的增量
+    void AddDelta(const PerfCounts &begin, const PerfCounts &end)
+    {
+        for (int i = 0; i < kEventNum; ++i)
+        {
+            valid[i] = end.valid[i];
+            value[i] += end.value[i] - begin.value[i];
+        }
+    }
+
+    void Merge(const PerfCounts &other)
+    {
+        for (int i = 0; i < kEventNum; ++i)
+        {
+            valid[i] = other.valid[i];
+            value[i] += other.value[i];
+        }
+    }
+
+    // 一行每次操作的计数，打不开的事件显示n/a；上下文切换是总数
+    std::string Format(size_t ops) const
+    {
+        static const char *names[kEventNum] = {"cycles", "instr", "L1D-miss", "LLC-miss", "dTLB-miss", "ctx-sw"};
+        std::string out;
+        char buf[64];
+        for (int i = 0; i < kEventNum; ++i)
+        {
+            if (!valid[i])
+                snprintf(buf, sizeof(buf), "%s%s n/a", i ? " | " : "", names[i]);
+            else if (i == kContextSwitches)
+                snprintf(buf, sizeof(buf), "%s%s %llu", i ? " | " : "", names[i], (unsigned long long)value[i]);
+            else
+                snprintf(buf, sizeof(buf), "%s%s/op %.3f", i ? " | " : "", names[i], ops ? (double)value[i] / ops : 0.0);
+            out += buf;
+        }
+        if (valid[kCycles] && valid[kInstructions] && value[kCycles] != 0)
+        {
+            snprintf(buf, sizeof(buf), " | IPC %.2f", (double)value[kInstructions] / value[kCycles]);
+            out += buf;
+        }
+        return out;
+    }
+};
+
+/**
+ * 当前线程的硬件计数器，在要测的线程里构造，Read只读这个线程的计数
+ * 每个事件单独打开，一个打不开（虚拟机没有PMU、perf_event_paranoid限制、seccomp）不影响其他的；
+ * 不允许统计内核态时退回只统计用户态。计数器被复用时按time_enabled/time_running放大。
+ * 上下文切换在perf不可用时用getrusage(RUSAGE_THREAD)代替，所以总是可用。
+ */
+class PerfCounters
+{
+public:
+    PerfCounters()
+    {
+        for (int i = 0; i < PerfCounts::kEventNum; ++i)
+            _fd[i] = -1;
+#ifdef __linux__
+        static const uint32_t types[PerfCounts::kEventNum] = {
+            PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE,
+            PERF_TYPE_HW_CACHE, PERF_TYPE_HW_CACHE, PERF_TYPE_SOFTWARE};
+        static const uint64_t configs[PerfCounts::kEventNum] = {
+            PERF_COUNT_HW_CPU_CYCLES,
+            PERF_COUNT_HW_INSTRUCTIONS,
+            PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+            PERF_COUNT_HW_CACHE_LL | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+            PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+            PERF_COUNT_SW_CONTEXT_SWITCHES};
+        for (int i = 0; i < PerfCounts::kEventNum; ++i)
+        {
+            _fd[i] = Open(types[i], configs[i], false);
+            if (_fd[i] < 0)
+                _fd[i] = Open(types[i], configs[i], true);
+        }
+#endif
+    }
+
+    ~PerfCounters()
+    {
+        for (int i = 0; i < PerfCounts::kEventNum; ++i)
+        {
+            if (_fd[i] >= 0)
+                close(_fd[i]);
+        }
+    }
+
+    PerfCounters(const PerfCounters &) = delete;
+    PerfCounters &operator=(const PerfCounters &) = delete;
+
+    // 硬件事件是否至少有一个能用
+    bool HardwareAvailable() const
+    {
+        for (int i = 0; i < PerfCounts::kContextSwitches; ++i)
+        {
+            if (_fd[i] >= 0)
+                return true;
+        }
+        return false;
+    }
+
+    void Read(PerfCounts &counts) const
+    {
+        for (int i = 0; i < PerfCounts::kEventNum; ++i)
+        {
+            counts.value[i] = 0;
+            counts.valid[i] = false;
+            uint64_t data[3]; // value, time_enabled, time_running
+            if (_fd[i] >= 0 && read(_fd[i], data, sizeof(data)) == (ssize_t)sizeof(data))
+            {
+                counts.valid[i] = true;
+                counts.value[i] = data[2] == 0 || data[2] == data[1] ? data[0] : (uint64_t)((double)data[0] * data[1] / data[2]);
+            }
+        }
+        if (!counts.valid[PerfCounts::kContextSwitches])
+        {
+#ifdef RUSAGE_THREAD
+            struct rusage usage;
+            if (getrusage(RUSAGE_THREAD, &usage) == 0)
+            {
+                counts.valid[PerfCounts::kContextSwitches] = true;
+                counts.value[PerfCounts::kContextSwitches] = (uint64_t)(usage.ru_nvcsw + usage.ru_nivcsw);
+            }
+#endif
+        }
+    }
+
+private:
+#ifdef __linux__
+    static int Open(uint32_t type, uint64_t config, bool userOnly)
+    {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = type;
+        attr.config = config;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        attr.exclude_kernel = userOnly;
+        attr.exclude_hv = 1;
+        // pid = 0, cpu = -1: 当前线程，在任意CPU上
+        return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+#endif
+
+    int _fd[PerfCounts::kEventNum];
+};
@@ -1,7 +1,6 @@
 #include "CentralCache.h"
 #include "PageCache.h"
-
-CentralCache CentralCache::_sInst; // 避免链接错误，在cpp中初始化
+#include "Probes.h"
 
 /**
  * @brief 从中心缓存获取一定数量的对象
@@ -11,9 +10,10 @@ CentralCache CentralCache::_sInst; // 避免链接错误，在cpp中初始化
  * @param size 单块空间大小
  * @return cc实际提供的空间大小
  */
-size_t CentralCache::FetchRangeObj(void *&start, void *&end, size_t batchNum, size_t alignSize)
+template <class Policy>
+size_t CentralCache<Policy>::FetchRangeObj(void *&start, void *&end, size_t batchNum, size_t alignSize)
 {
-    size_t index = SizeClass::Index(alignSize);
+    size_t index = SizeClass<Policy>::Index(alignSize);
     // 考虑3种情况
 
     _spanLists[index]._mtx.lock(); // 对cc中spanlist操作需要加锁，保证线程安全 // 这个锁会在GetOneSpan里提前解锁
@@ -47,7 +47,8 @@ size_t CentralCache::FetchRangeObj(void *&start, void *&end, size_t batchNum, si
     return actualNum;
 }
 
-Span *CentralCache::GetOneSpan(SpanList &spanList, size_t alignSize)
+template <class Policy>
+Span *CentralCache<Policy>::GetOneSpan(SpanList<typename Policy::Lock> &spanList, size_t alignSize)
 {
     Span *it = spanList.Begin();
     while (it != spanList.End())
@@ -59,26 +60,28 @@ Span *CentralCache::GetOneSpan(SpanList &spanList, size_t alignSize)
         it = it->_next;
     }
 
+    // 如果遍历完所有span都没有找到非空的span，则需要从PC中获取span
+    // 页数按这个class最近的需求调整，解锁前更新状态
+    size_t pages = NextSpanPages(SizeClass<Policy>::Index(alignSize), alignSize);
+
     // 【重要】将cc的桶锁解掉，为的是其他线程能把内存归还到桶里
     spanList._mtx.unlock();
 
-    // 如果遍历完所有span都没有找到非空的span，则需要从PC中获取span
-    size_t pages = SizeClass::NumMovePage(alignSize); // size 转换成匹配的页数，以提供pc一个合适的span
-
     // 解决死锁方法，在调用NewSpan的位置加锁
-    PageCache::GetInstance()->_pageMtx.lock();
-    Span *span = PageCache::GetInstance()->NewSpan(pages); // 调用NewSpan获取新span
-    span->isUse = true; // 设置span正在被使用
+    _pageCache->_pageMtx.lock();
+    Span *span = _pageCache->NewSpan(pages); // 调用NewSpan获取新span, NewSpan会设置isUse
     span->_objSize = alignSize; // 设置span管理的块大小
-    PageCache::GetInstance()->_pageMtx.unlock();
+    _pageCache->SetSpanSizeClass(span, SizeClass<Policy>::Index(alignSize)); // 释放时直接查字节表
+    _pageCache->_pageMtx.unlock();
+    MEMPOOL_PROBE3(cc_get_span, SizeClass<Policy>::Index(alignSize), alignSize, pages);
 
     // 处理拿到的新span, 新span只设置了_pageId和_n， 自由链表为空
 
     // 使用span的_pageId和_n 结合单页大小， 计算出span的起始地址和结束地址
 
     // 起始地址 = 通过页号获取。
-    char* start = (char*)(span->_pageId << PAGE_SHIFT);    // start = 页号*单页大小
-    char* end = (char*)(start + (span->_n << PAGE_SHIFT)); // end = start + 页数*单页大小
+    char* start = (char*)(span->_pageId << Policy::kPageShift);    // start = 页号*单页大小
+    char* end = (char*)(start + (span->_n << Policy::kPageShift)); // end = start + 页数*单页大小
 
     // 将span的_freelist指向start
     span->_freelist = start;
@@ -89,7 +92,7 @@ Span *CentralCache::GetOneSpan(SpanList &spanList, size_t alignSize)
     start += alignSize; // start向后移动alignSize个字节
     // start 先动
     // 链接各个块
-    while (start < end)
+    while (start + alignSize <= end) // 最后不足一块的部分不切，否则会写到下一个span里
     {
         ObjNext(tail) = start; // 将start的地址赋值给tail的next
         start += alignSize;    // start向后移动alignSize个字节
@@ -105,10 +108,11 @@ Span *CentralCache::GetOneSpan(SpanList &spanList, size_t alignSize)
     return span;
 }
 
-void CentralCache::ReleaseListToSpans(void *start, size_t alignSize)
+template <class Policy>
+void CentralCache<Policy>::ReleaseListToSpans(void *start, size_t alignSize)
 {
     // 找到spanList的位置
-    size_t index = SizeClass::Index(alignSize);
+    size_t index = SizeClass<Policy>::Index(alignSize);
 
     // 对spanlist操作要加锁
     _spanLists[index]._mtx.lock();
@@ -118,7 +122,7 @@ void CentralCache::ReleaseListToSpans(void *start, size_t alignSize)
         void *next = ObjNext(start);
 
         // 找到start对应的span
-        Span *span = PageCache::GetInstance()->MapObjectToSpan(start);
+        Span *span = _pageCache->MapObjectToSpan(start);
 
         // 将start插入到span的freelist中 头插法
         ObjNext(start) = span->_freelist;
@@ -130,6 +134,8 @@ void CentralCache::ReleaseListToSpans(void *start, size_t alignSize)
         {
             // 先从spanList中删除
             _spanLists[index].Erase(span);
+            OnSpanReleased(index, alignSize);
+            MEMPOOL_PROBE3(cc_release_span, index, alignSize, span->_n);
             span->_freelist = nullptr;
             span->_next = nullptr;
             span->_prev = nullptr;
@@ -138,10 +144,10 @@ void CentralCache::ReleaseListToSpans(void *start, size_t alignSize)
             _spanLists[index]._mtx.unlock(); 
 
             // 对pc加锁，因为要操作pc的spanList
-            PageCache::GetInstance()->_pageMtx.lock();
+            _pageCache->_pageMtx.lock();
             // 如果span的use_count为0，则将span还给PC
-            PageCache::GetInstance()->ReleaseSpanToPageCache(span);
-            PageCache::GetInstance()->_pageMtx.unlock();
+            _pageCache->ReleaseSpanToPageCache(span);
+            _pageCache->_pageMtx.unlock();
 
             _spanLists[index]._mtx.lock(); // 归还完毕，加锁
         }
@@ -151,3 +157,86 @@ void CentralCache::ReleaseListToSpans(void *start, size_t alignSize)
 
     _spanLists[index]._mtx.unlock();
 }
+
+template <class Policy>
+size_t CentralCache<Policy>::NextSpanPages(size_t index, size_t alignSize)
+{
+    ClassSpanState &state = _spanStates[index];
+    size_t basePages = SizeClass<Policy>::NumMovePage(alignSize);
+    size_t maxPages = basePages * std::max(AllocTunables::Get().spanGrowth.load(std::memory_order_relaxed), (size_t)1);
+    if (maxPages > Policy::kMaxPages)
+    {
+        maxPages = Policy::kMaxPages;
+    }
+    size_t now = _spanTick.fetch_add(1, std::memory_order_relaxed) + 1;
+
+    if (state.pages == 0 || !_adaptive.load(std::memory_order_relaxed))
+    {
+        state.pages = basePages;
+    }
+    else
+    {
+        size_t gap = now - state.lastFetchTick;
+        if (gap <= kHotTickGap)
+        {
+            state.pages = std::min(state.pages * 2, maxPages); // 热: 下次拿大一点的span
+        }
+        else if (gap >= kColdTickGap)
+        {
+            state.pages = std::max(state.pages / 2, basePages); // 冷: 缩回去
+        }
+    }
+
+    state.lastFetchTick = now;
+    state.spanFetches++;
+    return state.pages;
+}
+
+template <class Policy>
+void CentralCache<Policy>::OnSpanReleased(size_t index, size_t alignSize)
+{
+    ClassSpanState &state = _spanStates[index];
+    state.spanReleases++;
+
+    // 整个span都空了，而且很久没有再申请span，说明span开大了
+    size_t now = _spanTick.load(std::memory_order_relaxed);
+    if (now - state.lastFetchTick >= kColdTickGap)
+    {
+        state.pages = std::max(state.pages / 2, SizeClass<Policy>::NumMovePage(alignSize));
+    }
+}
+
+template <class Policy>
+void CentralCache<Policy>::GetClassStats(size_t index, CentralClassStats &stats)
+{
+    assert(index < Policy::kFreeListNum);
+    stats = CentralClassStats();
+
+    std::lock_guard<typename Policy::Lock> lock(_spanLists[index]._mtx);
+    const ClassSpanState &state = _spanStates[index];
+    stats.spanPages = state.pages;
+    stats.spanFetches = state.spanFetches;
+    stats.spanReleases = state.spanReleases;
+
+    size_t objSize = SizeClass<Policy>::ClassToSize(index);
+    for (Span *it = _spanLists[index].Begin(); it != _spanLists[index].End(); it = it->_next)
+    {
+        size_t bytes = it->_n << Policy::kPageShift;
+        size_t capacity = bytes / objSize;
+        stats.spans++;
+        stats.usedObjects += it->use_count;
+        stats.capacityObjects += capacity;
+        stats.totalPages += it->_n;
+        stats.tailWasteBytes += bytes - capacity * objSize;
+        stats.emptySpans += it->use_count == 0;
+        stats.fullSpans += it->use_count >= capacity;
+        size_t bin = it->use_count * CentralClassStats::kOccupancyBins / capacity;
+        stats.occupancy[std::min(bin, CentralClassStats::kOccupancyBins - 1)]++;
+    }
+}
+
+// 显式实例化所有策略
+template class CentralCache<PagePolicy4K>;
+template class CentralCache<PagePolicy8K>;
+template class CentralCache<PagePolicy4KNoStats>;
+template class CentralCache<PagePolicy4KLockStats>;
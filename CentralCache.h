@@ -1,26 +1,114 @@
 #pragma once
 
 #include "Common.h"
+#include "Policy.h"
+#include "PageCache.h"
 
+template <class Policy>
+class ThreadCache;
+
+// cc中一个size class的span统计，GetClassStats填写
+struct CentralClassStats{
+    static const size_t kOccupancyBins = 10; // 按use_count / 容量分成10档，第i档是[i*10%, (i+1)*10%)，满的算最后一档
+
+
+    size_t spanPages = 0;       // 下次向pc申请span的页数
+    size_t spanFetches = 0;     // 累计向pc申请span的次数
+    size_t spanReleases = 0;    // 累计还给pc的span个数
+    size_t spans = 0;           // 当前桶中span个数
+    size_t usedObjects = 0;     // 桶中span已分给tc的块数
+    size_t capacityObjects = 0; // 桶中span一共能切出的块数
+    size_t totalPages = 0;      // 桶中span一共的页数
+    size_t tailWasteBytes = 0;  // span结尾切不出一块的字节数之和
+    size_t emptySpans = 0;      // use_count为0的span个数
+    size_t fullSpans = 0;       // 全部分给tc的span个数
+    size_t occupancy[kOccupancyBins] = {}; // span占用率直方图
+};
+
+template <class Policy>
 class CentralCache{
 
 public:
+    // 进程默认的cc，使用默认的pc，永不析构
+    // 第一次调用时创建，避免和pc单例的初始化顺序问题
     static CentralCache* GetInstance(){
-        return &_sInst;
+        static CentralCache* sInst = new CentralCache(PageCache<Policy>::GetInstance());
+        return sInst;
     }
 
+    // 独立的cc（见Heap.h），span从pageCache申请
+    explicit CentralCache(PageCache<Policy>* pageCache) : _pageCache(pageCache){}
+
     size_t FetchRangeObj(void*& start, void*& end, size_t batchNum, size_t alignSize); // cc从自己的_spanListss中为tc提供所需块
 
-    Span* GetOneSpan(SpanList& spanList, size_t size); // 从spanList中获取一个非空的span
+    Span* GetOneSpan(SpanList<typename Policy::Lock>& spanList, size_t size); // 从spanList中获取一个非空的span
 
     void ReleaseListToSpans(void* start, size_t size);
 
+    // 统计index号桶的span数和使用率，会加桶锁
+    void GetClassStats(size_t index, CentralClassStats& stats);
+
+    // 记录使用这个cc的tc，tc不会注销（线程退出后tc里缓存的块仍然算在这个cc名下）
+    void RegisterThreadCache(ThreadCache<Policy>* tc){
+        std::lock_guard<std::mutex> lock(_cacheMtx);
+        _threadCaches.push_back(tc);
+    }
+
+    // 对每个tc调用f，持有_cacheMtx
+    template <class F>
+    void ForEachThreadCache(F f){
+        std::lock_guard<std::mutex> lock(_cacheMtx);
+        for(ThreadCache<Policy>* tc : _threadCaches){
+            f(tc);
+        }
+    }
+
+    // index号桶的锁，LockStats.h读它的竞争计数
+    const typename Policy::Lock& BucketLock(size_t index) const{
+        return _spanLists[index]._mtx;
+    }
+
+    PageCache<Policy>* GetPageCache(){
+        return _pageCache;
+    }
+
+    // 关闭后每个size class固定按NumMovePage申请span，用于对比
+    void SetAdaptiveSpanSizing(bool enable){
+        _adaptive.store(enable, std::memory_order_relaxed);
+    }
+
+private:
+    /**
+     * 自适应span大小：hot的size class反复经过_pageMtx取小span，冷的大块class又拿着几乎空的大span。
+     * 每次向pc申请span都记一个全局tick，同一个class两次申请之间的tick差就是它最近的需求：
+     * 差值很小说明它在频繁取span，页数翻倍；差值很大说明它很冷，页数减半。
+     * 页数限制在[NumMovePage, min(NumMovePage * AllocTunables::spanGrowth, kMaxPages)]
+     */
+    static const size_t kHotTickGap = 4;     // 两次申请之间其他class申请不超过这么多次，认为是热的
+    static const size_t kColdTickGap = 256;  // 超过这么多次，认为是冷的
+
+    struct ClassSpanState{
+        size_t pages = 0;         // 当前申请页数，0表示还没申请过
+        size_t lastFetchTick = 0; // 上一次申请span时的全局tick
+        size_t spanFetches = 0;
+        size_t spanReleases = 0;
+    };
+
+    // 根据最近的需求计算index号桶这次申请span的页数，调用者持有桶锁
+    size_t NextSpanPages(size_t index, size_t alignSize);
+
+    // span整块还给pc时，冷的class页数减半，调用者持有桶锁
+    void OnSpanReleased(size_t index, size_t alignSize);
+
 private:
-    // 单例去掉构造析构和拷贝构造
-    CentralCache(){}
     CentralCache(const CentralCache&) = delete;
     CentralCache& operator=(const CentralCache&) = delete;
 
-    SpanList _spanLists[FREE_LIST_NUM];
-    static CentralCache _sInst; // 饿汉单例模式
+    SpanList<typename Policy::Lock> _spanLists[Policy::kFreeListNum];
+    ClassSpanState _spanStates[Policy::kFreeListNum]; // 每个桶的span大小状态，受桶锁保护
+    std::atomic<size_t> _spanTick{0}; // 所有桶向pc申请span的总次数
+    std::atomic<bool> _adaptive{true};
+    PageCache<Policy>* _pageCache; // span的来源
+    std::mutex _cacheMtx; // 保护_threadCaches
+    std::vector<ThreadCache<Policy>*> _threadCaches;
 };
@@ -2,16 +2,17 @@
 #include <iostream>
 #include <vector>
 #include <cassert>
+#include <atomic>
+#include <thread>
+#include <chrono>
 #include <sys/mman.h>
 #include <mutex>
-#include <sys/mman.h>
+#include <unistd.h>
 #include <unordered_map>
 
-static const size_t FREE_LIST_NUM = 208;   // 哈希桶中自由链表个数
-static const size_t MAX_BYTES = 256 * 1024; // TC单次申请最大字节数
-static const size_t PAGE_NUM = 129; // 页数 129避免-1
-static const size_t PAGE_SHIFT = 12; // 一页4KB, 右移12位得到页号 
-// 对于云服务器 通常是4KB每页
+// 页大小、tc单次申请上限、size class表、锁类型都由分配策略（Policy.h）决定，
+// 这里只保留定长内存池等元数据向系统申请内存时用的页大小
+static const size_t META_PAGE_SHIFT = 12; // 元数据按4KB页申请
 
 using std::cout;
 using std::endl;
@@ -106,10 +107,103 @@ struct Span{
     bool isUse = false; // true: 在cc中， false: 在pc中， 辅助回收
 };
 
+// 自旋锁，临界区很短时比std::mutex少一次系统调用，自旋一段时间后让出CPU
+class SpinLock{
+public:
+    void lock(){
+        int spins = 0;
+        while(_flag.test_and_set(std::memory_order_acquire)){
+            if(++spins >= 64){
+                std::this_thread::yield();
+                spins = 0;
+            }
+        }
+    }
+
+    bool try_lock(){
+        return !_flag.test_and_set(std::memory_order_acquire);
+    }
+
+    void unlock(){
+        _flag.clear(std::memory_order_release);
+    }
+
+private:
+    std::atomic_flag _flag = ATOMIC_FLAG_INIT;
+};
+
+// InstrumentedLock的计数，只在持有锁时写，读取方用relaxed读到近似值
+struct LockCounters
+{
+    static const size_t kWaitBuckets = 32; // 第i个桶是等待[2^i, 2^(i+1))纳秒，最后一个桶包含更长的
+
+    std::atomic<size_t> acquisitions{0}; // 加锁次数
+    std::atomic<size_t> contended{0};    // 其中try_lock失败、需要等待的次数
+    std::atomic<size_t> waitNs{0};       // 等待的总纳秒数
+    std::atomic<size_t> maxWaitNs{0};    // 最长的一次等待
+    std::atomic<size_t> waitHistogram[kWaitBuckets] = {};
+};
+
+/**
+ * 统计竞争的锁，包装std::mutex/SpinLock，在策略里替换Lock使用（见PagePolicy4KLockStats）
+ * 先try_lock，成功就只多一次计数；失败时计时等待，记入按2的幂分桶的等待时间直方图。
+ * 计数在拿到锁之后更新，受这把锁自己保护，用普通的load + store
+ */
+template <class Lock = std::mutex>
+class InstrumentedLock{
+public:
+    void lock(){
+        if(_lock.try_lock()){
+            Bump(_counters.acquisitions, 1);
+            return;
+        }
+        auto begin = std::chrono::steady_clock::now();
+        _lock.lock();
+        size_t ns = (size_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count();
+
+        Bump(_counters.acquisitions, 1);
+        Bump(_counters.contended, 1);
+        Bump(_counters.waitNs, ns);
+        if(ns > _counters.maxWaitNs.load(std::memory_order_relaxed)){
+            _counters.maxWaitNs.store(ns, std::memory_order_relaxed);
+        }
+        size_t bucket = 0;
+        while(bucket + 1 < LockCounters::kWaitBuckets && (ns >> (bucket + 1)) != 0){
+            ++bucket;
+        }
+        Bump(_counters.waitHistogram[bucket], 1);
+    }
+
+    bool try_lock(){
+        if(!_lock.try_lock()){
+            return false;
+        }
+        Bump(_counters.acquisitions, 1);
+        return true;
+    }
+
+    void unlock(){
+        _lock.unlock();
+    }
+
+    const LockCounters &Counters() const{
+        return _counters;
+    }
+
+private:
+    static void Bump(std::atomic<size_t> &counter, size_t n){
+        counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    Lock _lock;
+    LockCounters _counters;
+};
+
+template <class Lock = std::mutex>
 class SpanList{
 
 public:
-    std::mutex _mtx; // 每个桶有自己的锁
+    Lock _mtx; // 每个桶有自己的锁
 
 public:
     SpanList(){
@@ -117,6 +211,11 @@ public:
         _head->_next = _head;
         _head->_prev = _head;
     }
+    ~SpanList(){
+        delete _head; // 链表中的span不归SpanList所有
+    }
+    SpanList(const SpanList&) = delete;
+    SpanList& operator=(const SpanList&) = delete;
     void PushFront(Span* span){
         Insert(Begin(), span);
     }
@@ -183,50 +282,79 @@ private:
 
 
 
+// 运行时可调的参数，所有策略共用，只在慢路径上读；trace_replay用来离线扫参数
+struct AllocTunables
+{
+    std::atomic<size_t> maxBatch{512};       // NumMoveSize的上限：tc一次从cc取的最多块数，也决定span的基础页数
+    std::atomic<size_t> spanGrowth{8};       // 自适应span最多放大到基础页数的倍数，1表示不放大
+    std::atomic<size_t> maxFreeListSize{0};  // tc每个自由链表慢启动的上限（块数），0表示只受maxBatch限制
+
+    static AllocTunables &Get()
+    {
+        static AllocTunables *inst = new AllocTunables; // 不析构
+        return *inst;
+    }
+};
+
+// size class分组: 不超过maxSize的请求按(1 << alignShift)字节对齐
+struct SizeClassGroup{
+    size_t maxSize;
+    size_t alignShift;
+};
+
+// 由Policy::SizeClassTable描述的对齐规则计算块大小、桶下标和批量数
+template <class Policy>
 class SizeClass{
+    typedef typename Policy::SizeClassTable Table;
+    static_assert(Policy::kMaxBytes <= Table::kMaxSize, "kMaxBytes exceeds the size class table");
+    static_assert(Policy::kFreeListNum == Table::kClassNum, "kFreeListNum must match the size class table");
 
 public:
     static size_t RoundUp(size_t size){
-        if(size <= 128){
-            // [1, 128] 8B
-            return _RoundUp(size, 8);
-        }else if(size <= 1024){
-            // [128, 1024] 16B
-            return _RoundUp(size, 16);
-        }else if(size <= 8*1024){
-            // [1024, 8*1024] 64B
-            return _RoundUp(size, 64);
-        }else if(size <= 64*1024){
-            // [8*1024, 64*1024] 1024B
-            return _RoundUp(size, 1024);
-        }else if(size <= 256*1024){
-            // [64*1024, 256*1024] 8KB
-            return _RoundUp(size, 8*1024);
-        }else{
-            assert(false); // 不可能发生
-            return -1;
+        const SizeClassGroup* groups = Table::Groups();
+        for(size_t i = 0; i < Table::kGroupNum; ++i){
+            if(size <= groups[i].maxSize){
+                return _RoundUp(size, (size_t)1 << groups[i].alignShift);
+            }
         }
+        assert(false); // 不可能发生
+        return -1;
     }
 
     // 计算映射的哪一个桶下标
     static size_t Index(size_t size){
-        assert(size <= MAX_BYTES);
-
-        // 每个区间有多少桶
-        static int group_array[4] = {16, 56, 56, 56};
-        if(size <= 128){
-            return _Index(size, 3);
-        }else if(size <= 1024){
-            return group_array[0] + _Index(size - 128, 4);
-        }else if(size <= 8*1024){
-            return group_array[0] + group_array[1] + _Index(size - 1024, 7);
-        }else if(size <= 64*1024){
-            return group_array[0] + group_array[1] + group_array[2] + _Index(size - 8*1024, 10);
-        }else if(size <= 256*1024){
-            return group_array[0] + group_array[1] + group_array[2] + group_array[3] + _Index(size - 64*1024, 13);
-        }else{
-            assert(false); // 不可能发生
+        assert(size <= Policy::kMaxBytes);
+
+        const SizeClassGroup* groups = Table::Groups();
+        size_t base = 0;  // 前面的分组一共有多少桶
+        size_t lower = 0; // 上一个分组的上界
+        for(size_t i = 0; i < Table::kGroupNum; ++i){
+            if(size <= groups[i].maxSize){
+                return base + _Index(size - lower, groups[i].alignShift);
+            }
+            base += (groups[i].maxSize - lower) >> groups[i].alignShift;
+            lower = groups[i].maxSize;
         }
+        assert(false); // 不可能发生
+        return -1;
+    }
+
+    // Index的逆运算: 桶下标 -> 该桶的块大小
+    static size_t ClassToSize(size_t index){
+        assert(index < Policy::kFreeListNum);
+
+        const SizeClassGroup* groups = Table::Groups();
+        size_t base = 0;
+        size_t lower = 0;
+        for(size_t i = 0; i < Table::kGroupNum; ++i){
+            size_t count = (groups[i].maxSize - lower) >> groups[i].alignShift;
+            if(index < base + count){
+                return lower + ((index - base + 1) << groups[i].alignShift);
+            }
+            base += count;
+            lower = groups[i].maxSize;
+        }
+        assert(false); // 不可能发生
         return -1;
     }
 
@@ -234,10 +362,11 @@ public:
     static size_t NumMoveSize(size_t size){
         assert(size > 0);
 
-        int num = MAX_BYTES / size; // 单次申请块空间申请上限块数
+        size_t num = Policy::kMaxBytes / size; // 单次申请块空间申请上限块数
+        size_t maxBatch = AllocTunables::Get().maxBatch.load(std::memory_order_relaxed);
 
-        if(num > 512){
-            num = 512;
+        if(num > maxBatch){
+            num = maxBatch;
         }
 
         if(num < 2){
@@ -254,7 +383,7 @@ public:
 
         size_t npage = num*size; // 通过最多申请块计算单次最大申请空间（不是size， size是实际请求的）
 
-        npage >>= PAGE_SHIFT; // 右移13位得到页数， 向下取整应该没有问题？
+        npage >>= Policy::kPageShift; // 右移得到页数， 向下取整应该没有问题？
 
         if(npage == 0){ // 最少分配1页
             npage = 1;
@@ -274,15 +403,49 @@ private:
 };
 
 
-inline static void* SystemAlloc(size_t kpage){
+// 系统页大小，运行时获取
+inline static size_t SystemPageSize(){
+    static const size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+    return pageSize;
+}
 
-    void* ptr = nullptr;
+/**
+ * 向系统申请kpage个(1 << pageShift)字节的页，起始地址按(1 << pageShift)对齐
+ * 内存池的页可以比系统页大（比如8KB页跑在4KB页的系统上），这时mmap只保证按系统页对齐，
+ * 页号计算会出错（README bug1），所以多申请一页再把首尾多余部分还给系统
+ */
+inline static void* SystemAlloc(size_t kpage, size_t pageShift = META_PAGE_SHIFT){
+
+    size_t size = kpage << pageShift;
+    size_t align = (size_t)1 << pageShift;
+    size_t sysPage = SystemPageSize();
+
+    if(align <= sysPage){
+        void* ptr = mmap(0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if(ptr == MAP_FAILED){
+            throw std::bad_alloc();
+        }
+        return ptr;
+    }
 
-    auto size = kpage << PAGE_SHIFT;
-    ptr = mmap(0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-    if(ptr == MAP_FAILED){
+    size_t mapSize = size + align - sysPage;
+    char* raw = (char*)mmap(0, mapSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(raw == MAP_FAILED){
         throw std::bad_alloc();
     }
+
+    char* ptr = (char*)(((uintptr_t)raw + align - 1) & ~(uintptr_t)(align - 1));
+    if(ptr > raw){
+        munmap(raw, ptr - raw);
+    }
+    char* tail = ptr + size;
+    if(tail < raw + mapSize){
+        munmap(tail, raw + mapSize - tail);
+    }
     return ptr;
+}
 
-}
\ No newline at end of file
+// 把SystemAlloc申请的kpage个(1 << pageShift)字节的页还给系统
+inline static void SystemFree(void* ptr, size_t kpage, size_t pageShift = META_PAGE_SHIFT){
+    munmap(ptr, kpage << pageShift);
+}
@@ -2,24 +2,59 @@
 #include <thread>
 #include "ThreadCache.h"
 #include "PageCache.h"
+#include "HeapProfiler.h"
+#include "TraceRecorder.h"
 
-// 仿tcmalloc的接口
-void *ConcurrentAlloc(size_t size){
+// 当前线程的tc，第一次调用时创建
+template <class Policy = DefaultPolicy>
+inline ThreadCache<Policy> *GetThreadCache(){
+    ThreadCache<Policy> *&pTLSThreadCache = ThreadCache<Policy>::pTLSThreadCache;
+    if(pTLSThreadCache == nullptr){ // 不存在线程安全问题，每个线程相互独立
+        // pTLSThreadCache = new ThreadCache; // 每个线程独立， 所以需要new
+        // 每线程magazine, 避免争抢同一条cache line；池不析构，进程退出时其他线程可能还在用tc
+        static lockfree::ObjectPool<ThreadCache<Policy> > *threadCachePool = new lockfree::ObjectPool<ThreadCache<Policy> >(true);
+        pTLSThreadCache = threadCachePool->New();
+    }
+    return pTLSThreadCache;
+}
+
+// 仿tcmalloc的接口, Policy决定页大小、size class和锁类型，默认4KB页
+template <class Policy = DefaultPolicy>
+inline void *ConcurrentAlloc(size_t size){
     // 获取线程id
     // cout << std::this_thread::get_id() << " " << pTLSThreadCache << endl;
 
-    if(pTLSThreadCache == nullptr){ // 不存在线程安全问题，每个线程相互独立
-        // pTLSThreadCache = new ThreadCache; // 每个线程独立， 所以需要new
-        static lockfree::ObjectPool<ThreadCache> threadCachePool;
-        pTLSThreadCache = threadCachePool.New();
+    ThreadCache<Policy> *pTLSThreadCache = GetThreadCache<Policy>();
+    void *ptr = nullptr;
+    // 采样关闭时只多一次减法和比较
+    if(pTLSThreadCache->SampleCountdown(size)){
+        ptr = HeapProfiler<Policy>::GetInstance()->SampleAllocation(pTLSThreadCache, size);
+    }
+    if(ptr == nullptr){
+        ptr = pTLSThreadCache->Allocate(size);
     }
-    return pTLSThreadCache->Allocate(size);
+#ifdef MEMPOOL_TRACE
+    AllocTrace::Get().Record(kTraceAlloc, ptr, size);
+#endif
+    return ptr;
 }
 
-void ConcurrentFree(void *ptr){ // 第二个参数以后会去掉
+template <class Policy = DefaultPolicy>
+inline void ConcurrentFree(void *ptr){ // 第二个参数以后会去掉
     assert(ptr);
-    size_t size = PageCache::GetInstance()->MapObjectToSpan(ptr)->_objSize;
-    assert(size <= MAX_BYTES);
+#ifdef MEMPOOL_TRACE
+    AllocTrace::Get().Record(kTraceFree, ptr, 0);
+#endif
+    // 从每页一字节的size class表中取桶下标，不访问span，少一次cache miss
+    size_t cl = PageCache<Policy>::GetInstance()->MapObjectToSizeClass(ptr);
+    assert(cl != 0);
+    if(cl == kSampledSizeClass){ // 堆采样单独分配的span
+        HeapProfiler<Policy>::GetInstance()->Free(ptr);
+        return;
+    }
+    size_t size = SizeClass<Policy>::ClassToSize(cl - 1);
+    assert(size <= Policy::kMaxBytes);
 
-    pTLSThreadCache->Deallocate(ptr, size);
-}
\ No newline at end of file
+    // 释放的线程可能从来没有申请过（生产者/消费者），也要有自己的tc
+    GetThreadCache<Policy>()->Deallocate(ptr, size);
+}
@@ -0,0 +1,212 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstdio>
+#include "MallocStats.h"
+
+/**
+ * 碎片和span占用率报告
+ * 按层统计浪费的字节：
+ *   内部碎片    RoundUp对齐多出来的字节，用tc累计的申请字节数估计平均每块浪费多少，乘以在用块数
+ *   span尾部    GetOneSpan切分后span结尾不够一块的字节
+ *   cc空闲块    cc中部分使用的span里还没分给tc的块
+ *   tc缓存      tc自由链表里的块
+ *   pc空闲      pc中空闲span，附空闲span页数分布和没有合并的span个数
+ * 每个桶只在自己的桶锁下遍历一次span链表，pc在_pageMtx下遍历一次空闲span，可以定期调用。
+ */
+
+// 一个size class的碎片统计
+struct ClassFragmentation
+{
+    size_t index = 0;              // 桶下标
+    size_t size = 0;               // 块大小
+    size_t inUse = 0;              // 分给用户的块数
+    size_t internalWasteBytes = 0; // 在用块的对齐浪费（估计）
+    size_t tailWasteBytes = 0;     // span尾部切不出一块的字节
+    size_t centralFreeBytes = 0;   // cc span中空闲块的字节
+    size_t threadCacheBytes = 0;   // tc中缓存块的字节
+    size_t spans = 0;
+    size_t emptySpans = 0;
+    size_t fullSpans = 0;
+    size_t occupancy[CentralClassStats::kOccupancyBins] = {}; // span占用率直方图
+};
+
+struct FragmentationData
+{
+    size_t pageSize = 0;
+    size_t inUseBytes = 0;           // 分给用户的字节（按块大小）
+    size_t internalWasteBytes = 0;
+    size_t tailWasteBytes = 0;
+    size_t centralFreeBytes = 0;
+    size_t threadCacheBytes = 0;
+    size_t pageHeapFreeBytes = 0;
+    size_t uncoalescedSpans = 0;     // pc中和空闲邻居没有合并的空闲span，正常应为0
+    size_t mmappedBytes = 0;
+    std::vector<std::pair<size_t, size_t> > freeSpanLengths; // (页数, 个数)，页数为0表示超过kMaxPages
+    std::vector<ClassFragmentation> classes; // 用到过的size class
+
+    // 除了分给用户的有效字节外都算浪费
+    size_t WasteBytes() const
+    {
+        return internalWasteBytes + tailWasteBytes + centralFreeBytes + threadCacheBytes + pageHeapFreeBytes;
+    }
+};
+
+template <class Policy = DefaultPolicy>
+void CollectFragmentation(FragmentationData &data, CentralCache<Policy> *centralCache = CentralCache<Policy>::GetInstance())
+{
+    data = FragmentationData();
+    MallocStatsData stats;
+    std::vector<CentralClassStats> central;
+    CollectMallocStats<Policy>(stats, centralCache, &central);
+    data.pageSize = stats.pageSize;
+    data.inUseBytes = stats.inUseBytes;
+    data.mmappedBytes = stats.mmappedBytes;
+    data.pageHeapFreeBytes = stats.pageCacheFreeBytes;
+
+    for (const MallocClassStats &c : stats.classes)
+    {
+        ClassFragmentation cls;
+        cls.index = c.index;
+        cls.size = c.size;
+        cls.inUse = c.inUse;
+        cls.threadCacheBytes = c.threadCached * c.size;
+        if (c.allocs != 0 && c.requested < c.allocs * c.size)
+        {
+            double wastePerObject = c.size - (double)c.requested / c.allocs;
+            cls.internalWasteBytes = (size_t)(wastePerObject * c.inUse);
+        }
+
+        const CentralClassStats &cc = central[c.index];
+        cls.tailWasteBytes = cc.tailWasteBytes;
+        cls.centralFreeBytes = (cc.capacityObjects - cc.usedObjects) * c.size;
+        cls.spans = cc.spans;
+        cls.emptySpans = cc.emptySpans;
+        cls.fullSpans = cc.fullSpans;
+        for (size_t i = 0; i < CentralClassStats::kOccupancyBins; ++i)
+            cls.occupancy[i] = cc.occupancy[i];
+
+        data.internalWasteBytes += cls.internalWasteBytes;
+        data.tailWasteBytes += cls.tailWasteBytes;
+        data.centralFreeBytes += cls.centralFreeBytes;
+        data.threadCacheBytes += cls.threadCacheBytes;
+        data.classes.push_back(cls);
+    }
+
+    PageCache<Policy> *pc = centralCache->GetPageCache();
+    std::vector<size_t> lengths;
+    {
+        std::lock_guard<typename Policy::Lock> lock(pc->_pageMtx);
+        pc->GetFreeSpanLengths(lengths, data.uncoalescedSpans);
+    }
+    for (size_t k = 1; k < lengths.size(); ++k)
+    {
+        if (lengths[k] != 0)
+            data.freeSpanLengths.push_back(std::make_pair(k < PageCache<Policy>::PAGE_NUM ? k : 0, lengths[k]));
+    }
+}
+
+inline std::string FormatFragmentation(const FragmentationData &data)
+{
+    std::string out;
+    char line[512];
+    auto percent = [&](size_t bytes)
+    { return data.mmappedBytes ? 100.0 * bytes / data.mmappedBytes : 0.0; };
+    snprintf(line, sizeof(line),
+             "------------------------------------------------\n"
+             "FRAG: %12zu bytes in use by application\n"
+             "FRAG: %12zu bytes internal fragmentation (%.2f%%)\n"
+             "FRAG: %12zu bytes span tail waste (%.2f%%)\n"
+             "FRAG: %12zu bytes free in partially used central spans (%.2f%%)\n"
+             "FRAG: %12zu bytes cached in thread caches (%.2f%%)\n"
+             "FRAG: %12zu bytes free in page heap (%.2f%%, %zu uncoalesced spans)\n"
+             "FRAG: %12zu bytes mmapped\n"
+             "------------------------------------------------\n",
+             data.inUseBytes,
+             data.internalWasteBytes, percent(data.internalWasteBytes),
+             data.tailWasteBytes, percent(data.tailWasteBytes),
+             data.centralFreeBytes, percent(data.centralFreeBytes),
+             data.threadCacheBytes, percent(data.threadCacheBytes),
+             data.pageHeapFreeBytes, percent(data.pageHeapFreeBytes), data.uncoalescedSpans,
+             data.mmappedBytes);
+    out += line;
+
+    out += "class     size  in use  internal    tail  central  spans empty  full  occupancy 0-10%..90-100%\n";
+    for (const ClassFragmentation &c : data.classes)
+    {
+        if (c.spans == 0 && c.inUse == 0)
+            continue;
+        snprintf(line, sizeof(line), "%5zu %8zu %7zu %9zu %7zu %8zu %6zu %5zu %5zu ",
+                 c.index, c.size, c.inUse, c.internalWasteBytes, c.tailWasteBytes, c.centralFreeBytes,
+                 c.spans, c.emptySpans, c.fullSpans);
+        out += line;
+        for (size_t i = 0; i < CentralClassStats::kOccupancyBins; ++i)
+        {
+            snprintf(line, sizeof(line), " %zu", c.occupancy[i]);
+            out += line;
+        }
+        out += "\n";
+    }
+
+    out += "page heap free spans (pages:count):";
+    for (const std::pair<size_t, size_t> &len : data.freeSpanLengths)
+    {
+        if (len.first == 0)
+            snprintf(line, sizeof(line), " large:%zu", len.second);
+        else
+            snprintf(line, sizeof(line), " %zu:%zu", len.first, len.second);
+        out += line;
+    }
+    out += "\n";
+    return out;
+}
+
+inline std::string FormatFragmentationJson(const FragmentationData &data)
+{
+    std::string out;
+    char buf[512];
+    snprintf(buf, sizeof(buf),
+             "{\"page_size\":%zu,\"in_use_bytes\":%zu,\"internal_waste_bytes\":%zu,\"tail_waste_bytes\":%zu,"
+             "\"central_free_bytes\":%zu,\"thread_cache_bytes\":%zu,\"page_heap_free_bytes\":%zu,"
+             "\"uncoalesced_spans\":%zu,\"mmapped_bytes\":%zu,\"free_span_lengths\":[",
+             data.pageSize, data.inUseBytes, data.internalWasteBytes, data.tailWasteBytes,
+             data.centralFreeBytes, data.threadCacheBytes, data.pageHeapFreeBytes,
+             data.uncoalescedSpans, data.mmappedBytes);
+    out += buf;
+    for (size_t i = 0; i < data.freeSpanLengths.size(); ++i)
+    {
+        // pages为0表示超过kMaxPages的大span
+        snprintf(buf, sizeof(buf), "%s{\"pages\":%zu,\"count\":%zu}", i ? "," : "",
+                 data.freeSpanLengths[i].first, data.freeSpanLengths[i].second);
+        out += buf;
+    }
+    out += "],\"classes\":[";
+    for (size_t i = 0; i < data.classes.size(); ++i)
+    {
+        const ClassFragmentation &c = data.classes[i];
+        snprintf(buf, sizeof(buf),
+                 "%s{\"class\":%zu,\"size\":%zu,\"in_use\":%zu,\"internal_waste_bytes\":%zu,\"tail_waste_bytes\":%zu,"
+                 "\"central_free_bytes\":%zu,\"thread_cache_bytes\":%zu,\"spans\":%zu,\"empty_spans\":%zu,"
+                 "\"full_spans\":%zu,\"occupancy\":[",
+                 i ? "," : "", c.index, c.size, c.inUse, c.internalWasteBytes, c.tailWasteBytes,
+                 c.centralFreeBytes, c.threadCacheBytes, c.spans, c.emptySpans, c.fullSpans);
+        out += buf;
+        for (size_t j = 0; j < CentralClassStats::kOccupancyBins; ++j)
+        {
+            snprintf(buf, sizeof(buf), "%s%zu", j ? "," : "", c.occupancy[j]);
+            out += buf;
+        }
+        out += "]}";
+    }
+    out += "]}";
+    return out;
+}
+
+// ConcurrentAlloc的碎片报告，json为true时输出JSON
+template <class Policy = DefaultPolicy>
+std::string FragmentationReport(bool json = false)
+{
+    FragmentationData data;
+    CollectFragmentation<Policy>(data);
+    return json ? FormatFragmentationJson(data) : FormatFragmentation(data);
+}
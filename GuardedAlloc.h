@@ -0,0 +1,387 @@
+#pragma once
+#include <execinfo.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include "PageCache.h"
+
+/**
+ * 带保护页的采样分配（仿GWP-ASan）
+ * 自由链表的next指针放在用户内存里（ObjNext），越界写或者释放后写会悄悄破坏别的块，出问题的地方离写坏的地方很远。
+ * 打开后，堆采样（HeapProfiler）每采中guardEvery个对象，就有一个从保护页池分配：
+ *
+ *   [保护页][槽0][保护页][槽1][保护页] ... [槽N-1][保护页]
+ *
+ * 每个槽一页，对象随机贴着右边或左边的保护页放，越界读写马上触发SIGSEGV；
+ * 释放后整页改成PROT_NONE，并且优先分配从没用过的槽、其次是最早释放的槽，尽量推迟复用，释放后访问也会触发SIGSEGV。
+ * SIGSEGV处理函数认出是保护页池里的地址后，把越界/释放后使用的报告和申请、释放时的调用栈写到stderr，再交给原来的处理函数。
+ * 重复释放、释放的不是申请出来的地址直接报告后abort。
+ *
+ * 槽池是从pc要的一个span，每一页标成kSampledSizeClass，ConcurrentFree走堆采样的慢路径，快路径不变；
+ * 申请的快路径也还是堆采样那一次倒计时的比较。只保护不超过一页的申请，更大的照常走堆采样。
+ * 池只在第一次保护分配时创建，之后不还给pc。
+ */
+
+template <class Policy = DefaultPolicy>
+class GuardedAllocator
+{
+public:
+    static const size_t kPageSize = (size_t)1 << Policy::kPageShift;
+    static const size_t kMaxSlots = 32;
+    static const size_t kSlots = (PageCache<Policy>::PAGE_NUM - 2) / 2 < kMaxSlots ? (PageCache<Policy>::PAGE_NUM - 2) / 2 : kMaxSlots;
+    static const size_t kPoolPages = 2 * kSlots + 1;
+    static const int kMaxStackDepth = 32;
+    static const size_t kAlignment = 16; // 贴右边放时按这个对齐，最多有kAlignment-1字节的越界检测不到
+
+    static GuardedAllocator *GetInstance()
+    {
+        static GuardedAllocator *inst = new GuardedAllocator; // 不析构
+        return inst;
+    }
+
+    // 每采中every个对象保护一个，0表示关闭；需要SetHeapSampleInterval打开堆采样才会生效
+    void SetGuardEvery(size_t every)
+    {
+        if (every != 0)
+            InstallSignalHandler();
+        _guardEvery.store(every, std::memory_order_relaxed);
+    }
+
+    size_t GuardEvery() const
+    {
+        return _guardEvery.load(std::memory_order_relaxed);
+    }
+
+    // 堆采样采中一个对象时调用，这次应该保护时返回true
+    bool ShouldGuard(size_t size)
+    {
+        size_t every = _guardEvery.load(std::memory_order_relaxed);
+        if (every == 0 || size > kPageSize)
+            return false;
+        if (_tlsCountdown == 0 || _tlsCountdown > every)
+            _tlsCountdown = every;
+        return --_tlsCountdown == 0;
+    }
+
+    // 从槽池分配，没有空闲槽时返回nullptr；stack是申请时的调用栈，叶子在前
+    void *Allocate(size_t size, void *const *stack, int depth)
+    {
+        std::lock_guard<std::mutex> lock(_mtx);
+        if (_pool.load(std::memory_order_relaxed) == nullptr && (_poolFailed || !CreatePool()))
+            return nullptr;
+        if (_freeSlots.empty())
+        {
+            _exhausted.fetch_add(1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        size_t index = _freeSlots.front();
+        _freeSlots.pop_front();
+        Slot &slot = _slots[index];
+
+        char *page = SlotPage(index);
+        if (mprotect(page, kPageSize, PROT_READ | PROT_WRITE) != 0)
+        {
+            _freeSlots.push_front(index);
+            return nullptr;
+        }
+        size_t alignedSize = (size + kAlignment - 1) & ~(kAlignment - 1);
+        if (alignedSize > kPageSize)
+            alignedSize = kPageSize;
+        // 随机贴右边（查上溢）或左边（查下溢），贴右边时多出的对齐字节在对象前面
+        bool right = (NextRandom() & 1) != 0;
+        char *ptr = right ? page + kPageSize - alignedSize : page;
+
+        slot.ptr = ptr;
+        slot.size = size;
+        slot.allocDepth = depth < kMaxStackDepth ? depth : kMaxStackDepth;
+        memcpy(slot.allocStack, stack, slot.allocDepth * sizeof(void *));
+        slot.freeDepth = 0;
+        slot.state.store(kAllocated, std::memory_order_release);
+        _allocations.fetch_add(1, std::memory_order_relaxed);
+        return ptr;
+    }
+
+    // ptr是否在槽池里（包括保护页），无锁
+    bool Owns(const void *ptr) const
+    {
+        const char *pool = _pool.load(std::memory_order_acquire);
+        return pool != nullptr && (const char *)ptr >= pool && (const char *)ptr < pool + kPoolPages * kPageSize;
+    }
+
+    // 释放槽池里的对象；重复释放或者地址不对时报告并abort
+    void Deallocate(void *ptr)
+    {
+        void *stack[kMaxStackDepth];
+        int depth = backtrace(stack, kMaxStackDepth);
+
+        std::lock_guard<std::mutex> lock(_mtx);
+        size_t page = ((char *)ptr - _pool.load(std::memory_order_relaxed)) / kPageSize;
+        if (page % 2 == 0) // 保护页
+            ReportAndAbort("invalid-free", ptr, nullptr);
+        size_t index = page / 2;
+        Slot &slot = _slots[index];
+        if (slot.state.load(std::memory_order_relaxed) != kAllocated)
+            ReportAndAbort("double-free", ptr, &slot);
+        if (slot.ptr != ptr)
+            ReportAndAbort("invalid-free", ptr, &slot);
+
+        slot.freeDepth = depth;
+        memcpy(slot.freeStack, stack, depth * sizeof(void *));
+        slot.state.store(kFreed, std::memory_order_release);
+        mprotect(SlotPage(index), kPageSize, PROT_NONE);
+        madvise(SlotPage(index), kPageSize, MADV_DONTNEED);
+        _freeSlots.push_back(index); // 放到队尾，最晚复用
+    }
+
+    // ptr是否是槽池里已经分配出去的对象的起始地址
+    bool IsAllocated(const void *ptr)
+    {
+        std::lock_guard<std::mutex> lock(_mtx);
+        if (!Owns(ptr))
+            return false;
+        size_t page = ((const char *)ptr - _pool.load(std::memory_order_relaxed)) / kPageSize;
+        const Slot &slot = _slots[page / 2];
+        return page % 2 == 1 && slot.state.load(std::memory_order_relaxed) == kAllocated && slot.ptr == ptr;
+    }
+
+    size_t Allocations() const { return _allocations.load(std::memory_order_relaxed); }
+    size_t Exhausted() const { return _exhausted.load(std::memory_order_relaxed); }
+
+private:
+    enum SlotState
+    {
+        kNeverUsed,
+        kAllocated,
+        kFreed,
+    };
+
+    struct Slot
+    {
+        std::atomic<int> state{kNeverUsed}; // SIGSEGV处理函数不加锁读
+        char *ptr = nullptr;
+        size_t size = 0;
+        int allocDepth = 0;
+        int freeDepth = 0;
+        void *allocStack[kMaxStackDepth];
+        void *freeStack[kMaxStackDepth];
+    };
+
+    GuardedAllocator() {}
+    GuardedAllocator(const GuardedAllocator &) = delete;
+    GuardedAllocator &operator=(const GuardedAllocator &) = delete;
+
+    char *SlotPage(size_t index) const
+    {
+        return _pool.load(std::memory_order_relaxed) + (2 * index + 1) * kPageSize;
+    }
+
+    // 调用者持有_mtx
+    bool CreatePool()
+    {
+        PageCache<Policy> *pc = PageCache<Policy>::GetInstance();
+        Span *span;
+        {
+            std::lock_guard<typename Policy::Lock> lock(pc->_pageMtx);
+            span = pc->NewSpan(kPoolPages);
+            pc->MarkSpanSampled(span); // 释放时ConcurrentFree走堆采样的慢路径
+        }
+        char *pool = (char *)(span->_pageId << Policy::kPageShift);
+        if (mprotect(pool, kPoolPages * kPageSize, PROT_NONE) != 0)
+        {
+            _poolFailed = true; // span留在pc的已使用状态，不再尝试
+            return false;
+        }
+        for (size_t i = 0; i < kSlots; ++i)
+            _freeSlots.push_back(i);
+        _pool.store(pool, std::memory_order_release);
+        return true;
+    }
+
+    static uint64_t NextRandom()
+    {
+        if (_tlsRng == 0)
+            _tlsRng = (uint64_t)(uintptr_t)&_tlsRng * 0x9E3779B97F4A7C15ULL | 1;
+        _tlsRng ^= _tlsRng << 13;
+        _tlsRng ^= _tlsRng >> 7;
+        _tlsRng ^= _tlsRng << 17;
+        return _tlsRng;
+    }
+
+    static void Write(const char *s)
+    {
+        ssize_t n = write(STDERR_FILENO, s, strlen(s));
+        (void)n;
+    }
+
+    // snprintf不是异步信号安全的，数字手工转成字符串
+    static void WriteNumber(uintptr_t value, unsigned base)
+    {
+        char buf[24];
+        char *p = buf + sizeof(buf);
+        *--p = '\0';
+        do
+        {
+            *--p = "0123456789abcdef"[value % base];
+            value /= base;
+        } while (value != 0);
+        Write(p);
+    }
+
+    static void WriteDecimal(size_t value) { WriteNumber(value, 10); }
+
+    static void WritePointer(const void *ptr)
+    {
+        Write("0x");
+        WriteNumber((uintptr_t)ptr, 16);
+    }
+
+    // 在信号处理函数里也会调用：只用write、栈上的缓冲区和backtrace_symbols_fd，不用stdio
+    void Report(const char *kind, const void *addr, const Slot *slot) const
+    {
+        Write("==");
+        WriteDecimal((size_t)getpid());
+        Write("== ERROR: GuardedAllocator: ");
+        Write(kind);
+        Write(" on address ");
+        WritePointer(addr);
+        Write("\n");
+        if (slot == nullptr)
+            return;
+        const char *obj = slot->ptr;
+        const char *a = (const char *)addr;
+        WritePointer(addr);
+        Write(" is ");
+        if (a < obj)
+        {
+            WriteDecimal((size_t)(obj - a));
+            Write(" bytes to the left of ");
+        }
+        else if (a >= obj + slot->size)
+        {
+            WriteDecimal((size_t)(a - obj - slot->size));
+            Write(" bytes to the right of ");
+        }
+        else
+        {
+            WriteDecimal((size_t)(a - obj));
+            Write(" bytes inside of ");
+        }
+        WriteDecimal(slot->size);
+        Write("-byte region [");
+        WritePointer(obj);
+        Write(", ");
+        WritePointer(obj + slot->size);
+        Write(")\n");
+        if (slot->state.load(std::memory_order_acquire) == kFreed)
+        {
+            Write("freed by:\n");
+            backtrace_symbols_fd(slot->freeStack, slot->freeDepth, STDERR_FILENO);
+        }
+        Write("allocated by:\n");
+        backtrace_symbols_fd(slot->allocStack, slot->allocDepth, STDERR_FILENO);
+    }
+
+    void ReportAndAbort(const char *kind, const void *addr, const Slot *slot) const
+    {
+        Report(kind, addr, slot);
+        abort();
+    }
+
+    // 访问保护页：找左右相邻的槽里离得近的那个对象
+    const Slot *NearestSlot(size_t page, const char *addr) const
+    {
+        const Slot *best = nullptr;
+        size_t bestDistance = (size_t)-1;
+        // 保护页2k的左边是槽k-1，右边是槽k；第一个保护页左边没有槽，k-1回绕成很大的数
+        for (size_t index : {page / 2 - 1, page / 2})
+        {
+            if (index >= kSlots || _slots[index].state.load(std::memory_order_acquire) == kNeverUsed)
+                continue;
+            const Slot &s = _slots[index];
+            size_t distance = addr < s.ptr ? s.ptr - addr : addr - (s.ptr + s.size);
+            if (distance < bestDistance)
+            {
+                best = &s;
+                bestDistance = distance;
+            }
+        }
+        return best;
+    }
+
+    // SIGSEGV落在槽池里时报告；返回false表示不是这里的地址
+    bool HandleFault(const void *addr) const
+    {
+        if (!Owns(addr))
+            return false;
+        size_t page = ((const char *)addr - _pool.load(std::memory_order_acquire)) / kPageSize;
+        if (page % 2 == 1)
+        {
+            const Slot &slot = _slots[page / 2];
+            Report(slot.state.load(std::memory_order_acquire) == kFreed ? "use-after-free" : "invalid access", addr, &slot);
+            return true;
+        }
+        const Slot *slot = NearestSlot(page, (const char *)addr);
+        if (slot != nullptr && slot->state.load(std::memory_order_acquire) == kFreed)
+            Report("use-after-free", addr, slot);
+        else
+            Report(slot != nullptr && (const char *)addr < slot->ptr ? "heap-buffer-underflow" : "heap-buffer-overflow", addr, slot);
+        return true;
+    }
+
+    static void SignalHandler(int sig, siginfo_t *info, void *context)
+    {
+        GetInstance()->HandleFault(info->si_addr);
+        // 恢复原来的处理函数后返回，出错的指令重新执行，由原来的处理函数（默认是core dump）处理
+        sigaction(SIGSEGV, &_previous, nullptr);
+        (void)sig;
+        (void)context;
+    }
+
+    static void InstallSignalHandler()
+    {
+        static std::once_flag once;
+        std::call_once(once, []
+                       {
+            struct sigaction action;
+            memset(&action, 0, sizeof(action));
+            action.sa_sigaction = SignalHandler;
+            action.sa_flags = SA_SIGINFO;
+            sigemptyset(&action.sa_mask);
+            sigaction(SIGSEGV, &action, &_previous); });
+    }
+
+    std::atomic<size_t> _guardEvery{0};
+    std::atomic<size_t> _allocations{0}; // 保护分配的次数
+    std::atomic<size_t> _exhausted{0};   // 没有空闲槽、退回堆采样分配的次数
+    std::mutex _mtx;                     // 保护_freeSlots和槽的分配、释放
+    std::atomic<char *> _pool{nullptr}; // Owns和SIGSEGV处理函数不加锁读
+    bool _poolFailed = false;
+    Slot _slots[kSlots];
+    std::deque<size_t> _freeSlots; // 从没用过的在前，释放的放到队尾
+
+    static struct sigaction _previous;
+    static __thread size_t _tlsCountdown; // 当前线程再采中几个对象保护一个
+    static __thread uint64_t _tlsRng;
+};
+
+template <class Policy>
+struct sigaction GuardedAllocator<Policy>::_previous;
+
+template <class Policy>
+__thread size_t GuardedAllocator<Policy>::_tlsCountdown = 0;
+
+template <class Policy>
+__thread uint64_t GuardedAllocator<Policy>::_tlsRng = 0;
+
+// 打开ConcurrentAlloc的保护分配：堆采样每采中every个对象保护一个，0表示关闭（默认）
+// 需要先用SetHeapSampleInterval打开堆采样，保护分配的平均间隔是 采样间隔*every 字节
+template <class Policy = DefaultPolicy>
+inline void SetGuardedSampling(size_t every)
+{
+    GuardedAllocator<Policy>::GetInstance()->SetGuardEvery(every);
+}
@@ -0,0 +1,153 @@
+#pragma once
+#include <mutex>
+#include "ThreadCache.h"
+#include "CentralCache.h"
+#include "PageCache.h"
+#include "ObjectPool.h"
+
+/**
+ * 独立的堆
+ * 每个堆有自己的pc和cc，每个线程在每个堆上有自己的tc，互不共享内存；
+ * 销毁堆时把它向系统申请的内存一次性还回去，不用逐个释放对象，适合按租户/子系统隔离和统计。
+ *
+ * 线程在堆上的tc记在TLS数组里，下标是堆的槽位。槽位在堆销毁后会复用，
+ * 所以每个堆还有一个全局递增的代号，TLS中代号对不上说明是旧堆留下的tc，直接丢弃（内存已经随旧堆归还）。
+ *
+ * 接口：heap_create / heap_alloc / heap_free / heap_destroy
+ */
+template <class Policy = DefaultPolicy>
+class Heap
+{
+public:
+    static const int kMaxHeaps = 64; // 同时存在的堆个数上限
+
+    // 槽位用完时返回nullptr
+    static Heap *Create()
+    {
+        std::lock_guard<std::mutex> lock(SlotMutex());
+        for (int i = 0; i < kMaxHeaps; ++i)
+        {
+            if (_slots[i] == nullptr)
+            {
+                _slots[i] = new Heap(i, ++_nextGeneration);
+                return _slots[i];
+            }
+        }
+        return nullptr;
+    }
+
+    // 调用者保证没有线程还在使用这个堆
+    static void Destroy(Heap *heap)
+    {
+        {
+            std::lock_guard<std::mutex> lock(SlotMutex());
+            _slots[heap->_slot] = nullptr;
+        }
+        delete heap;
+    }
+
+    void *Allocate(size_t size)
+    {
+        return LocalCache()->Allocate(size);
+    }
+
+    void Free(void *ptr)
+    {
+        assert(ptr);
+        size_t cl = _pageCache.MapObjectToSizeClass(ptr);
+        assert(cl != 0); // 不是这个堆分配的
+        LocalCache()->Deallocate(ptr, SizeClass<Policy>::ClassToSize(cl - 1));
+    }
+
+    // 这个堆向系统申请的字节数
+    size_t SystemBytes()
+    {
+        PageCacheStats stats;
+        std::lock_guard<typename Policy::Lock> lock(_pageCache._pageMtx);
+        _pageCache.GetStats(stats);
+        return stats.systemPages << Policy::kPageShift;
+    }
+
+    PageCache<Policy> *GetPageCache() { return &_pageCache; }
+    CentralCache<Policy> *GetCentralCache() { return &_centralCache; }
+
+private:
+    Heap(int slot, size_t generation)
+        : _slot(slot), _generation(generation), _centralCache(&_pageCache)
+    {
+    }
+    Heap(const Heap &) = delete;
+    Heap &operator=(const Heap &) = delete;
+
+    // 成员按声明的逆序析构：先tc，再cc，最后pc把内存还给系统
+    ~Heap() {}
+
+    ThreadCache<Policy> *LocalCache()
+    {
+        TLSEntry &entry = _tls[_slot];
+        if (entry.generation != _generation)
+        {
+            entry.cache = _cachePool.New(&_centralCache);
+            entry.generation = _generation;
+        }
+        return entry.cache;
+    }
+
+    static std::mutex &SlotMutex()
+    {
+        static std::mutex *mtx = new std::mutex;
+        return *mtx;
+    }
+
+    struct TLSEntry
+    {
+        ThreadCache<Policy> *cache;
+        size_t generation; // 0表示没有
+    };
+
+    int _slot;          // TLS数组下标
+    size_t _generation; // 全局唯一的代号
+    PageCache<Policy> _pageCache;
+    CentralCache<Policy> _centralCache;
+    lockfree::ObjectPool<ThreadCache<Policy> > _cachePool; // 各线程的tc，随堆一起释放
+
+    static Heap *_slots[kMaxHeaps];       // 受SlotMutex保护
+    static size_t _nextGeneration;        // 受SlotMutex保护
+    static __thread TLSEntry _tls[kMaxHeaps];
+};
+
+template <class Policy>
+Heap<Policy> *Heap<Policy>::_slots[Heap<Policy>::kMaxHeaps];
+
+template <class Policy>
+size_t Heap<Policy>::_nextGeneration = 0;
+
+template <class Policy>
+__thread typename Heap<Policy>::TLSEntry Heap<Policy>::_tls[Heap<Policy>::kMaxHeaps];
+
+// 创建一个独立的堆，同时存在的堆超过Heap::kMaxHeaps个时返回nullptr
+template <class Policy = DefaultPolicy>
+inline Heap<Policy> *heap_create()
+{
+    return Heap<Policy>::Create();
+}
+
+template <class Policy>
+inline void *heap_alloc(Heap<Policy> *heap, size_t size)
+{
+    return heap->Allocate(size);
+}
+
+// ptr必须是heap分配的
+template <class Policy>
+inline void heap_free(Heap<Policy> *heap, void *ptr)
+{
+    heap->Free(ptr);
+}
+
+// 一次性释放堆的全部内存，之前分配的指针全部失效；调用者保证没有线程还在使用这个堆
+template <class Policy>
+inline void heap_destroy(Heap<Policy> *heap)
+{
+    Heap<Policy>::Destroy(heap);
+}
@@ -0,0 +1,371 @@
+#pragma once
+#include <execinfo.h>
+#include <cxxabi.h>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include "ThreadCache.h"
+#include "PageCache.h"
+#include "GuardedAlloc.h"
+
+/**
+ * 采样堆分析
+ * 仿tcmalloc：每个tc维护一个字节倒计时，ConcurrentAlloc每次减去申请的字节数，减到负数时走慢路径；
+ * 两次采样之间的字节数服从均值为采样间隔的指数分布，平均每分配interval字节采样一次，
+ * 大块被采中的概率是1 - exp(-size / interval)，输出时按这个概率还原成估计的字节数。
+ *
+ * 被采中的对象不从tc分配，而是单独向pc要一个span，span每一页的size class标成kSampledSizeClass，
+ * ConcurrentFree查字节表时就能认出来，不需要在每次释放时查哈希表。
+ * 采样关闭时快路径只多一次倒计时的减法和比较；倒计时用完后每kDisabledRecheckBytes字节检查一次是否打开。
+ *
+ * 输出：
+ *   HeapProfile()        pprof可读的legacy heap profile（heap_v2格式，附/proc/self/maps）
+ *   FoldedHeapProfile()  FlameGraph的折叠栈格式，每行"根;...;叶 估计字节数"，见heapflame.sh
+ * 打开SetGuardedSampling后，一部分被采中的对象改从GuardedAllocator的保护页池分配。
+ */
+
+// 一个被采中且还没释放的对象
+struct HeapSample
+{
+    static const int kMaxStackDepth = 32;
+
+    size_t size;  // 用户申请的字节数
+    int depth;    // 调用栈深度
+    void *stack[kMaxStackDepth]; // 叶子在前
+};
+
+template <class Policy = DefaultPolicy>
+class HeapProfiler
+{
+public:
+    static const size_t kDisabledRecheckBytes = 16 * 1024 * 1024; // 关闭时每分配这么多字节看一次是否打开
+
+    static HeapProfiler *GetInstance()
+    {
+        static HeapProfiler *inst = new HeapProfiler; // 不析构，进程退出时其他线程可能还在释放
+        return inst;
+    }
+
+    // 平均每分配bytes字节采样一次，0表示关闭；其他线程在下一次倒计时用完时生效
+    void SetSampleInterval(size_t bytes)
+    {
+        _interval.store(bytes, std::memory_order_relaxed);
+        if (ThreadCache<Policy>::pTLSThreadCache != nullptr)
+            ThreadCache<Policy>::pTLSThreadCache->SetBytesUntilSample(0); // 当前线程立即生效
+    }
+
+    size_t SampleInterval() const
+    {
+        return _interval.load(std::memory_order_relaxed);
+    }
+
+    // tc的倒计时用完时由ConcurrentAlloc调用，重新设置倒计时
+    // 这次分配被采中时返回分配好的内存，否则返回nullptr，由tc正常分配
+    // 不内联，RecordSample按固定层数跳过分配器自己的栈帧
+    __attribute__((noinline)) void *SampleAllocation(ThreadCache<Policy> *tc, size_t size)
+    {
+        size_t interval = _interval.load(std::memory_order_relaxed);
+        if (interval == 0)
+        {
+            _tlsArmed = false;
+            tc->SetBytesUntilSample(kDisabledRecheckBytes);
+            return nullptr;
+        }
+        tc->SetBytesUntilSample(NextSampleDistance(interval));
+        if (!_tlsArmed)
+        {
+            // 刚打开或者新线程，先抽一个采样点，避免每个线程的第一次分配都被采中
+            _tlsArmed = true;
+            return nullptr;
+        }
+        return RecordSample(size);
+    }
+
+    // 释放一个被采中的对象，ConcurrentFree查到kSampledSizeClass时调用
+    void Free(void *ptr)
+    {
+        GuardedAllocator<Policy> *guarded = GuardedAllocator<Policy>::GetInstance();
+        if (guarded->Owns(ptr))
+        {
+            guarded->Deallocate(ptr); // 重复释放时在这里报告
+            std::lock_guard<std::mutex> lock(_mtx);
+            _samples.erase(ptr);
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(_mtx);
+            auto it = _samples.find(ptr);
+            assert(it != _samples.end());
+            _samples.erase(it);
+        }
+
+        PageCache<Policy> *pc = PageCache<Policy>::GetInstance();
+        std::lock_guard<typename Policy::Lock> lock(pc->_pageMtx);
+        Span *span = pc->MapObjectToSpan(ptr);
+        pc->ClearSpanSizeClass(span);
+        pc->ReleaseSpanToPageCache(span);
+    }
+
+    // 当前被采中且没有释放的对象个数
+    size_t SampledObjects()
+    {
+        std::lock_guard<std::mutex> lock(_mtx);
+        return _samples.size();
+    }
+
+    // 按采样概率还原的存活字节数估计
+    size_t EstimatedLiveBytes()
+    {
+        std::lock_guard<std::mutex> lock(_mtx);
+        double total = 0;
+        for (auto &kv : _samples)
+            total += kv.second.size * Unsample(kv.second.size);
+        return (size_t)total;
+    }
+
+    // pprof legacy heap profile：相同调用栈合并，值是采样原值，pprof按heap_v2/<interval>自己还原
+    std::string HeapProfile()
+    {
+        std::vector<StackBucket> buckets;
+        size_t interval = SnapshotBuckets(buckets);
+
+        size_t objs = 0, bytes = 0;
+        for (const StackBucket &b : buckets)
+        {
+            objs += b.count;
+            bytes += b.bytes;
+        }
+
+        std::string out;
+        char line[128];
+        snprintf(line, sizeof(line), "heap profile: %zu: %zu [%zu: %zu] @ heap_v2/%zu\n",
+                 objs, bytes, objs, bytes, interval);
+        out += line;
+        for (const StackBucket &b : buckets)
+        {
+            snprintf(line, sizeof(line), "%zu: %zu [%zu: %zu] @", b.count, b.bytes, b.count, b.bytes);
+            out += line;
+            for (size_t i = 0; i < b.stack.size(); ++i)
+            {
+                snprintf(line, sizeof(line), " %p", b.stack[i]);
+                out += line;
+            }
+            out += "\n";
+        }
+
+        // pprof用映射表把地址对应到二进制
+        out += "\nMAPPED_LIBRARIES:\n";
+        FILE *fp = fopen("/proc/self/maps", "r");
+        if (fp != nullptr)
+        {
+            char buf[4096];
+            size_t n;
+            while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+                out.append(buf, n);
+            fclose(fp);
+        }
+        return out;
+    }
+
+    // FlameGraph折叠栈，值是还原后的估计字节数，flamegraph.pl --countname=bytes 直接画
+    std::string FoldedHeapProfile()
+    {
+        std::vector<StackBucket> buckets;
+        SnapshotBuckets(buckets);
+
+        std::unordered_map<void *, std::string> symbols;
+        std::string out;
+        for (const StackBucket &b : buckets)
+        {
+            for (size_t i = b.stack.size(); i-- > 0;) // 根在前
+            {
+                auto it = symbols.find(b.stack[i]);
+                if (it == symbols.end())
+                    it = symbols.emplace(b.stack[i], Symbolize(b.stack[i])).first;
+                out += it->second;
+                out += i ? ";" : "";
+            }
+            char line[32];
+            snprintf(line, sizeof(line), " %zu\n", (size_t)b.estimatedBytes);
+            out += line;
+        }
+        return out;
+    }
+
+    // 把pprof格式写到文件，失败返回false
+    bool WriteHeapProfile(const char *path)
+    {
+        std::string profile = HeapProfile();
+        FILE *fp = fopen(path, "w");
+        if (fp == nullptr)
+            return false;
+        bool ok = fwrite(profile.data(), 1, profile.size(), fp) == profile.size();
+        return fclose(fp) == 0 && ok;
+    }
+
+private:
+    HeapProfiler() {}
+    HeapProfiler(const HeapProfiler &) = delete;
+    HeapProfiler &operator=(const HeapProfiler &) = delete;
+
+    // 调用栈相同的采样合并在一起
+    struct StackBucket
+    {
+        size_t count;
+        size_t bytes;
+        double estimatedBytes;
+        std::vector<void *> stack; // 叶子在前
+    };
+
+    __attribute__((noinline)) void *RecordSample(size_t size)
+    {
+        HeapSample sample;
+        sample.size = size;
+        // 跳过RecordSample和SampleAllocation两层
+        void *frames[HeapSample::kMaxStackDepth + 2];
+        int depth = backtrace(frames, HeapSample::kMaxStackDepth + 2);
+        sample.depth = depth > 2 ? depth - 2 : 0;
+        memcpy(sample.stack, frames + (depth - sample.depth), sample.depth * sizeof(void *));
+
+        GuardedAllocator<Policy> *guarded = GuardedAllocator<Policy>::GetInstance();
+        void *ptr = guarded->ShouldGuard(size) ? guarded->Allocate(size, sample.stack, sample.depth) : nullptr;
+        if (ptr != nullptr)
+        {
+            std::lock_guard<std::mutex> lock(_mtx);
+            _samples.emplace(ptr, sample);
+            return ptr;
+        }
+
+        // 单独一个span，和tc里的小块不在同一页上
+        size_t k = (size + ((size_t)1 << Policy::kPageShift) - 1) >> Policy::kPageShift;
+        PageCache<Policy> *pc = PageCache<Policy>::GetInstance();
+        Span *span;
+        {
+            std::lock_guard<typename Policy::Lock> lock(pc->_pageMtx);
+            span = pc->NewSpan(k);
+            pc->MarkSpanSampled(span);
+        }
+        ptr = (void *)(span->_pageId << Policy::kPageShift);
+
+        std::lock_guard<std::mutex> lock(_mtx);
+        _samples.emplace(ptr, sample);
+        return ptr;
+    }
+
+    // 指数分布的下一个采样点，xorshift随机数每线程一份
+    static ptrdiff_t NextSampleDistance(size_t interval)
+    {
+        if (_tlsRng == 0)
+            _tlsRng = (uint64_t)(uintptr_t)&_tlsRng * 0x9E3779B97F4A7C15ULL | 1;
+        _tlsRng ^= _tlsRng << 13;
+        _tlsRng ^= _tlsRng >> 7;
+        _tlsRng ^= _tlsRng << 17;
+        double u = ((_tlsRng >> 11) + 1) * (1.0 / 9007199254740993.0); // (0, 1]
+        double distance = -std::log(u) * interval;
+        return distance > (double)(PTRDIFF_MAX / 2) ? PTRDIFF_MAX / 2 : (ptrdiff_t)distance + 1;
+    }
+
+    // 大小为size的对象被采中的概率的倒数
+    double Unsample(size_t size) const
+    {
+        double interval = (double)_interval.load(std::memory_order_relaxed);
+        if (interval <= 0 || size == 0)
+            return 1;
+        return 1 / (1 - std::exp(-(double)size / interval));
+    }
+
+    // 在锁内按调用栈合并，返回当前的采样间隔
+    size_t SnapshotBuckets(std::vector<StackBucket> &buckets)
+    {
+        std::lock_guard<std::mutex> lock(_mtx);
+        size_t interval = _interval.load(std::memory_order_relaxed);
+        std::unordered_map<std::string, size_t> index; // 调用栈 -> buckets下标
+        for (auto &kv : _samples)
+        {
+            const HeapSample &s = kv.second;
+            std::string key((const char *)s.stack, s.depth * sizeof(void *));
+            auto it = index.find(key);
+            if (it == index.end())
+            {
+                it = index.emplace(key, buckets.size()).first;
+                StackBucket b = {0, 0, 0, std::vector<void *>(s.stack, s.stack + s.depth)};
+                buckets.push_back(b);
+            }
+            StackBucket &b = buckets[it->second];
+            b.count++;
+            b.bytes += s.size;
+            b.estimatedBytes += s.size * Unsample(s.size);
+        }
+        return interval;
+    }
+
+    // "binary(mangled+0x10) [0x...]" -> 反修饰后的函数名，没有符号时用地址
+    static std::string Symbolize(void *addr)
+    {
+        std::string result;
+        char **names = backtrace_symbols(&addr, 1);
+        if (names != nullptr)
+        {
+            const char *begin = strchr(names[0], '(');
+            const char *end = begin ? strpbrk(begin, "+)") : nullptr;
+            if (begin != nullptr && end != nullptr && end > begin + 1)
+            {
+                std::string mangled(begin + 1, end);
+                int status = 0;
+                char *demangled = abi::__cxa_demangle(mangled.c_str(), nullptr, nullptr, &status);
+                result = status == 0 ? demangled : mangled;
+                free(demangled);
+            }
+            free(names);
+        }
+        if (result.empty())
+        {
+            char buf[32];
+            snprintf(buf, sizeof(buf), "%p", addr);
+            result = buf;
+        }
+        // 折叠栈格式里分号是分隔符
+        std::replace(result.begin(), result.end(), ';', ':');
+        return result;
+    }
+
+    std::atomic<size_t> _interval{0};
+    std::mutex _mtx;                                 // 保护_samples
+    std::unordered_map<void *, HeapSample> _samples; // 被采中且没有释放的对象
+
+    static __thread bool _tlsArmed;     // 当前线程是否已经抽过采样点
+    static __thread uint64_t _tlsRng;   // 当前线程的随机数状态
+};
+
+template <class Policy>
+__thread bool HeapProfiler<Policy>::_tlsArmed = false;
+
+template <class Policy>
+__thread uint64_t HeapProfiler<Policy>::_tlsRng = 0;
+
+// ConcurrentAlloc的堆采样，平均每分配bytes字节采样一次，0表示关闭（默认）
+template <class Policy = DefaultPolicy>
+inline void SetHeapSampleInterval(size_t bytes)
+{
+    HeapProfiler<Policy>::GetInstance()->SetSampleInterval(bytes);
+}
+
+// 存活对象的pprof heap profile
+template <class Policy = DefaultPolicy>
+inline std::string HeapProfile()
+{
+    return HeapProfiler<Policy>::GetInstance()->HeapProfile();
+}
+
+// 存活对象的FlameGraph折叠栈
+template <class Policy = DefaultPolicy>
+inline std::string FoldedHeapProfile()
+{
+    return HeapProfiler<Policy>::GetInstance()->FoldedHeapProfile();
+}
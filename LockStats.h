@@ -0,0 +1,123 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <algorithm>
+#include "CentralCache.h"
+#include "PageCache.h"
+
+/**
+ * cc桶锁和pc锁的竞争统计
+ * 只对Lock是InstrumentedLock的策略可用（如PagePolicy4KLockStats），
+ * 计数由持有锁的线程写，这里不加锁读，是近似的快照。
+ * 竞争多、等待长的桶可以考虑加大NumMoveSize的批量或者拆锁。
+ */
+
+// 一把锁的统计
+struct LockContentionStats
+{
+    size_t acquisitions = 0; // 加锁次数
+    size_t contended = 0;    // 需要等待的次数
+    size_t waitNs = 0;       // 等待的总纳秒数
+    size_t maxWaitNs = 0;    // 最长的一次等待
+    size_t waitHistogram[LockCounters::kWaitBuckets] = {}; // 第i个桶是等待[2^i, 2^(i+1))纳秒
+
+    void Read(const LockCounters &c)
+    {
+        acquisitions = c.acquisitions.load(std::memory_order_relaxed);
+        contended = c.contended.load(std::memory_order_relaxed);
+        waitNs = c.waitNs.load(std::memory_order_relaxed);
+        maxWaitNs = c.maxWaitNs.load(std::memory_order_relaxed);
+        for (size_t i = 0; i < LockCounters::kWaitBuckets; ++i)
+            waitHistogram[i] = c.waitHistogram[i].load(std::memory_order_relaxed);
+    }
+
+    // 竞争的加锁中，等待时间的p分位数的上界（直方图桶的上沿，不超过最长的一次等待），没有竞争返回0
+    size_t WaitPercentileNs(double p) const
+    {
+        size_t total = 0;
+        for (size_t i = 0; i < LockCounters::kWaitBuckets; ++i)
+            total += waitHistogram[i];
+        if (total == 0)
+            return 0;
+        size_t target = (size_t)(p * total);
+        size_t seen = 0;
+        for (size_t i = 0; i < LockCounters::kWaitBuckets; ++i)
+        {
+            seen += waitHistogram[i];
+            if (seen > target)
+                return std::min((size_t)1 << (i + 1), maxWaitNs);
+        }
+        return maxWaitNs;
+    }
+};
+
+// 一个cc桶的锁
+struct BucketLockStats
+{
+    size_t index = 0; // 桶下标
+    size_t size = 0;  // 块大小
+    LockContentionStats lock;
+};
+
+struct LockStatsData
+{
+    LockContentionStats pageHeap;        // pc的_pageMtx
+    std::vector<BucketLockStats> buckets; // 加过锁的cc桶
+};
+
+// 收集centralCache的桶锁和它的pc锁，默认是ConcurrentAlloc使用的那一套
+template <class Policy>
+void CollectLockStats(LockStatsData &data, CentralCache<Policy> *centralCache = CentralCache<Policy>::GetInstance())
+{
+    data = LockStatsData();
+    data.pageHeap.Read(centralCache->GetPageCache()->_pageMtx.Counters());
+    for (size_t i = 0; i < Policy::kFreeListNum; ++i)
+    {
+        BucketLockStats bucket;
+        bucket.index = i;
+        bucket.size = SizeClass<Policy>::ClassToSize(i);
+        bucket.lock.Read(centralCache->BucketLock(i).Counters());
+        if (bucket.lock.acquisitions != 0)
+            data.buckets.push_back(bucket);
+    }
+}
+
+// 文本格式，桶按总等待时间从大到小，只列前top个
+inline std::string FormatLockStats(const LockStatsData &data, size_t top = 10)
+{
+    std::vector<BucketLockStats> buckets = data.buckets;
+    std::sort(buckets.begin(), buckets.end(), [](const BucketLockStats &a, const BucketLockStats &b)
+              { return a.lock.waitNs > b.lock.waitNs; });
+    if (buckets.size() > top)
+        buckets.resize(top);
+
+    std::string out;
+    char line[256];
+    out += "lock            size  acquisitions   contended  contended%     wait ms  p50 ns  p99 ns      max ns\n";
+    auto append = [&](const char *name, size_t size, const LockContentionStats &s)
+    {
+        snprintf(line, sizeof(line), "%-12s %7zu %13zu %11zu %10.2f%% %11.3f %7zu %7zu %11zu\n",
+                 name, size, s.acquisitions, s.contended,
+                 s.acquisitions ? 100.0 * s.contended / s.acquisitions : 0.0,
+                 s.waitNs / 1e6, s.WaitPercentileNs(0.5), s.WaitPercentileNs(0.99), s.maxWaitNs);
+        out += line;
+    };
+    append("page heap", 0, data.pageHeap);
+    for (const BucketLockStats &b : buckets)
+    {
+        char name[32];
+        snprintf(name, sizeof(name), "class %zu", b.index);
+        append(name, b.size, b.lock);
+    }
+    return out;
+}
+
+// ConcurrentAlloc<Policy>的锁竞争统计
+template <class Policy>
+std::string LockStats(size_t top = 10)
+{
+    LockStatsData data;
+    CollectLockStats<Policy>(data);
+    return FormatLockStats(data, top);
+}
@@ -0,0 +1,179 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstdio>
+#include "ThreadCache.h"
+#include "CentralCache.h"
+#include "PageCache.h"
+
+/**
+ * 三层的内存统计
+ * tc的计数只由所属线程写（relaxed load + store），这里在调用线程汇总，结果是近似的快照；
+ * cc和pc的数据在各自的锁下读取。
+ */
+
+// 一个size class的统计
+struct MallocClassStats
+{
+    size_t index = 0;          // 桶下标
+    size_t size = 0;           // 块大小
+    size_t allocs = 0;         // 所有tc的Allocate次数
+    size_t requested = 0;      // 所有tc的Allocate申请的字节数之和（对齐前）
+    size_t frees = 0;          // 所有tc的Deallocate次数
+    size_t inUse = 0;          // 分给用户还没释放的块数
+    size_t threadCached = 0;   // 缓存在tc中的块数
+    size_t centralFree = 0;    // cc的span中还没分给tc的块数
+    size_t spans = 0;          // cc中的span个数
+    size_t spanPages = 0;      // 这些span的页数
+};
+
+struct MallocStatsData
+{
+    size_t pageSize = 0;
+    size_t threadCaches = 0;       // tc个数
+    size_t inUseBytes = 0;         // 分给用户的字节数（按块大小）
+    size_t threadCacheBytes = 0;   // 缓存在tc中的字节数
+    size_t centralCacheBytes = 0;  // cc span中空闲的字节数
+    size_t centralSpans = 0;       // cc中的span个数
+    size_t centralSpanBytes = 0;   // cc中span的总字节数
+    size_t pageCacheFreeBytes = 0; // pc中空闲span的字节数
+    size_t pageCacheFreeSpans = 0; // pc中空闲span个数
+    size_t mmappedBytes = 0;       // pc向系统申请的字节数
+    size_t pageMapBytes = 0;       // 基数树和size class字节表的元数据字节数
+    std::vector<MallocClassStats> classes; // 只包含用到过的size class
+};
+
+// 收集centralCache（以及它的pc和tc）的统计，默认是ConcurrentAlloc使用的那一套
+// central非空时顺便把每个桶的CentralClassStats按桶下标存进去，和data是同一次遍历得到的
+template <class Policy = DefaultPolicy>
+void CollectMallocStats(MallocStatsData &data, CentralCache<Policy> *centralCache = CentralCache<Policy>::GetInstance(),
+                        std::vector<CentralClassStats> *central = nullptr)
+{
+    const size_t kClassNum = Policy::kFreeListNum;
+    data = MallocStatsData();
+    data.pageSize = (size_t)1 << Policy::kPageShift;
+
+    std::vector<MallocClassStats> classes(kClassNum);
+    if (central != nullptr)
+        central->assign(kClassNum, CentralClassStats());
+    centralCache->ForEachThreadCache([&](ThreadCache<Policy> *tc)
+                                     {
+        data.threadCaches++;
+        if (!Policy::kCollectStats)
+            return;
+        for (size_t i = 0; i < kClassNum; ++i) {
+            const ThreadClassCounters &c = tc->Counters(i);
+            size_t allocs = c.allocs.load(std::memory_order_relaxed);
+            size_t frees = c.frees.load(std::memory_order_relaxed);
+            size_t fetched = c.fetched.load(std::memory_order_relaxed);
+            size_t returned = c.returned.load(std::memory_order_relaxed);
+            classes[i].allocs += allocs;
+            classes[i].requested += c.requested.load(std::memory_order_relaxed);
+            classes[i].frees += frees;
+            // 单独读的几个计数不是同一时刻的，防止出现负数
+            if (fetched + frees >= allocs + returned)
+                classes[i].threadCached += fetched + frees - allocs - returned;
+        } });
+
+    for (size_t i = 0; i < kClassNum; ++i)
+    {
+        MallocClassStats &cls = classes[i];
+        cls.index = i;
+        cls.size = SizeClass<Policy>::ClassToSize(i);
+        cls.inUse = cls.allocs >= cls.frees ? cls.allocs - cls.frees : 0;
+
+        CentralClassStats cc;
+        centralCache->GetClassStats(i, cc);
+        cls.spans = cc.spans;
+        cls.spanPages = cc.totalPages;
+        cls.centralFree = cc.capacityObjects - cc.usedObjects;
+        if (central != nullptr)
+            (*central)[i] = cc;
+
+        data.inUseBytes += cls.inUse * cls.size;
+        data.threadCacheBytes += cls.threadCached * cls.size;
+        data.centralCacheBytes += cls.centralFree * cls.size;
+        data.centralSpans += cls.spans;
+        data.centralSpanBytes += cls.spanPages << Policy::kPageShift;
+
+        if (cls.allocs != 0 || cls.spans != 0)
+            data.classes.push_back(cls);
+    }
+
+    PageCache<Policy> *pc = centralCache->GetPageCache();
+    PageCacheStats ps;
+    {
+        std::lock_guard<typename Policy::Lock> lock(pc->_pageMtx);
+        pc->GetStats(ps);
+    }
+    data.pageCacheFreeBytes = ps.freePages << Policy::kPageShift;
+    data.pageCacheFreeSpans = ps.freeSpans;
+    data.mmappedBytes = ps.systemPages << Policy::kPageShift;
+    data.pageMapBytes = pc->PageMapBytes();
+}
+
+// 文本格式，适合直接打印
+inline std::string FormatMallocStats(const MallocStatsData &data)
+{
+    std::string out;
+    char line[1024];
+    snprintf(line, sizeof(line),
+             "------------------------------------------------\n"
+             "MALLOC: %12zu bytes in use by application\n"
+             "MALLOC: %12zu bytes in thread caches (%zu caches)\n"
+             "MALLOC: %12zu bytes free in central cache spans (%zu spans, %zu bytes)\n"
+             "MALLOC: %12zu bytes free in page cache (%zu spans)\n"
+             "MALLOC: %12zu bytes mmapped (page size %zu)\n"
+             "MALLOC: %12zu bytes page map metadata\n"
+             "------------------------------------------------\n",
+             data.inUseBytes, data.threadCacheBytes, data.threadCaches,
+             data.centralCacheBytes, data.centralSpans, data.centralSpanBytes,
+             data.pageCacheFreeBytes, data.pageCacheFreeSpans,
+             data.mmappedBytes, data.pageSize, data.pageMapBytes);
+    out += line;
+    out += "class     size       allocs        frees      in use  thread cached  central free  spans  pages\n";
+    for (size_t i = 0; i < data.classes.size(); ++i)
+    {
+        const MallocClassStats &c = data.classes[i];
+        snprintf(line, sizeof(line), "%5zu %8zu %12zu %12zu %11zu %14zu %13zu %6zu %6zu\n",
+                 c.index, c.size, c.allocs, c.frees, c.inUse, c.threadCached, c.centralFree, c.spans, c.spanPages);
+        out += line;
+    }
+    return out;
+}
+
+// JSON格式，适合给监控采集
+inline std::string FormatMallocStatsJson(const MallocStatsData &data)
+{
+    std::string out;
+    char buf[512];
+    snprintf(buf, sizeof(buf),
+             "{\"page_size\":%zu,\"thread_caches\":%zu,\"in_use_bytes\":%zu,\"thread_cache_bytes\":%zu,"
+             "\"central_cache_bytes\":%zu,\"central_spans\":%zu,\"central_span_bytes\":%zu,"
+             "\"page_cache_free_bytes\":%zu,\"page_cache_free_spans\":%zu,\"mmapped_bytes\":%zu,"
+             "\"page_map_bytes\":%zu,\"classes\":[",
+             data.pageSize, data.threadCaches, data.inUseBytes, data.threadCacheBytes,
+             data.centralCacheBytes, data.centralSpans, data.centralSpanBytes,
+             data.pageCacheFreeBytes, data.pageCacheFreeSpans, data.mmappedBytes, data.pageMapBytes);
+    out += buf;
+    for (size_t i = 0; i < data.classes.size(); ++i)
+    {
+        const MallocClassStats &c = data.classes[i];
+        snprintf(buf, sizeof(buf),
+                 "%s{\"class\":%zu,\"size\":%zu,\"allocs\":%zu,\"frees\":%zu,\"in_use\":%zu,\"thread_cached\":%zu,"
+                 "\"central_free\":%zu,\"spans\":%zu,\"span_pages\":%zu}",
+                 i ? "," : "", c.index, c.size, c.allocs, c.frees, c.inUse, c.threadCached, c.centralFree, c.spans, c.spanPages);
+        out += buf;
+    }
+    out += "]}";
+    return out;
+}
+
+// ConcurrentAlloc的统计，json为true时输出JSON
+template <class Policy = DefaultPolicy>
+std::string MallocStats(bool json = false)
+{
+    MallocStatsData data;
+    CollectMallocStats<Policy>(data);
+    return json ? FormatMallocStatsJson(data) : FormatMallocStats(data);
+}
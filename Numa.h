@@ -0,0 +1,141 @@
+#pragma once
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include "Common.h"
+
+/**
+ * NUMA相关的系统调用封装，直接走syscall，不依赖libnuma
+ * 单节点机器或者内核不支持时全部退化成节点0，mbind失败也不影响分配
+ */
+
+#ifndef MPOL_PREFERRED
+#define MPOL_PREFERRED 1 // 优先从指定节点分配，节点内存不够时内核回退到其他节点
+#endif
+
+static const int kMaxNumaNodes = 64; // 节点掩码用一个unsigned long
+
+class NumaTopology
+{
+public:
+    static const NumaTopology &Get()
+    {
+        static NumaTopology *topo = new NumaTopology;
+        return *topo;
+    }
+
+    // 节点个数（最大节点号+1），至少为1
+    int NodeCount() const { return _nodeCount; }
+
+    // cpu所在节点，未知时返回0
+    int NodeOfCpu(int cpu) const
+    {
+        if (cpu < 0 || (size_t)cpu >= _cpuToNode.size())
+            return 0;
+        return _cpuToNode[cpu];
+    }
+
+    // 节点上的cpu
+    const std::vector<int> &CpusOfNode(int node) const
+    {
+        return _nodeCpus[node];
+    }
+
+private:
+    NumaTopology()
+    {
+        _nodeCount = 1;
+        for (int node = 0; node < kMaxNumaNodes; ++node)
+        {
+            char path[128];
+            snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+            std::vector<int> cpus;
+            if (!ReadCpuList(path, cpus))
+                continue;
+            _nodeCount = node + 1;
+            _nodeCpus.resize(_nodeCount);
+            _nodeCpus[node] = cpus;
+            for (int cpu : cpus)
+            {
+                if ((size_t)cpu >= _cpuToNode.size())
+                    _cpuToNode.resize(cpu + 1, 0);
+                _cpuToNode[cpu] = node;
+            }
+        }
+        _nodeCpus.resize(_nodeCount);
+        if (_nodeCpus[0].empty()) // 没有sysfs信息，所有cpu都算节点0
+        {
+            long n = sysconf(_SC_NPROCESSORS_CONF);
+            for (long cpu = 0; cpu < n; ++cpu)
+                _nodeCpus[0].push_back((int)cpu);
+        }
+    }
+
+    // 解析"0-3,8-11"格式的cpu列表
+    static bool ReadCpuList(const char *path, std::vector<int> &cpus)
+    {
+        FILE *fp = fopen(path, "r");
+        if (fp == nullptr)
+            return false;
+        char buf[4096];
+        size_t len = fread(buf, 1, sizeof(buf) - 1, fp);
+        fclose(fp);
+        buf[len] = '\0';
+
+        char *p = buf;
+        while (*p != '\0' && *p != '\n')
+        {
+            char *next = nullptr;
+            long first = strtol(p, &next, 10);
+            if (next == p)
+                break;
+            long last = first;
+            p = next;
+            if (*p == '-')
+            {
+                last = strtol(p + 1, &next, 10);
+                p = next;
+            }
+            for (long cpu = first; cpu <= last; ++cpu)
+                cpus.push_back((int)cpu);
+            if (*p == ',')
+                ++p;
+        }
+        return true;
+    }
+
+    int _nodeCount;
+    std::vector<int> _cpuToNode;
+    std::vector<std::vector<int> > _nodeCpus;
+};
+
+// 当前线程所在的节点，用getcpu系统调用
+inline int CurrentNumaNode()
+{
+    unsigned cpu = 0, node = 0;
+    if (syscall(SYS_getcpu, &cpu, &node, nullptr) != 0)
+        return 0;
+    return (int)node;
+}
+
+// 把[ptr, ptr + bytes)的物理页优先放在node上，必须在第一次写之前调用
+inline bool NumaBindPreferred(void *ptr, size_t bytes, int node)
+{
+    if (node < 0 || node >= kMaxNumaNodes)
+        return false;
+    unsigned long mask = 1UL << node;
+    return syscall(SYS_mbind, ptr, bytes, MPOL_PREFERRED, &mask, sizeof(mask) * 8, 0) == 0;
+}
+
+// ptr所在物理页的节点，页还没分配或者查询失败返回-1
+inline int NumaNodeOfAddress(void *ptr)
+{
+    void *page = (void *)((uintptr_t)ptr & ~(uintptr_t)(SystemPageSize() - 1));
+    int status = -1;
+    if (syscall(SYS_move_pages, 0, 1UL, &page, nullptr, &status, 0) != 0)
+        return -1;
+    return status;
+}
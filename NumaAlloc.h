@@ -0,0 +1,99 @@
+#pragma once
+#include "Heap.h"
+#include "Numa.h"
+
+/**
+ * NUMA感知的分配
+ * 每个NUMA节点一个独立的堆（pc + cc），堆向系统申请的内存用mbind优先放在本节点上；
+ * 线程从当前所在节点的堆分配，tc里缓存的都是本节点的块，不会再从共享的cc拿到远端节点切出来的span。
+ * 本节点内存不够时由内核按MPOL_PREFERRED回退到其他节点。
+ * 释放时按地址找到所属节点的堆，块回到那个堆里，不会混进本节点的cc。
+ * 单节点机器上只有一个堆，行为和普通的独立堆一样。
+ */
+template <class Policy = DefaultPolicy>
+class NumaHeaps
+{
+public:
+    static const size_t kNodeRefresh = 64; // 每分配这么多次重新查一次所在节点，跟上线程迁移
+
+    static NumaHeaps *GetInstance()
+    {
+        static NumaHeaps *inst = new NumaHeaps; // 不析构
+        return inst;
+    }
+
+    void *Allocate(size_t size)
+    {
+        return _heaps[LocalNode()]->Allocate(size);
+    }
+
+    void Free(void *ptr)
+    {
+        for (int node = 0; node < _nodeCount; ++node)
+        {
+            if (_heaps[node]->GetPageCache()->MapObjectToSizeClass(ptr) != 0)
+            {
+                _heaps[node]->Free(ptr);
+                return;
+            }
+        }
+        assert(false); // 不是NumaAlloc分配的
+    }
+
+    int NodeCount() const { return _nodeCount; }
+
+    Heap<Policy> *NodeHeap(int node) { return _heaps[node]; }
+
+    // 当前线程所在的节点，缓存在TLS里，每kNodeRefresh次刷新
+    int LocalNode()
+    {
+        if (_tlsCountdown == 0)
+        {
+            int node = _nodeCount > 1 ? CurrentNumaNode() : 0;
+            _tlsNode = node < _nodeCount ? node : 0;
+            _tlsCountdown = kNodeRefresh;
+        }
+        --_tlsCountdown;
+        return _tlsNode;
+    }
+
+private:
+    NumaHeaps()
+    {
+        _nodeCount = NumaTopology::Get().NodeCount();
+        if (_nodeCount > kMaxNumaNodes)
+            _nodeCount = kMaxNumaNodes;
+        for (int node = 0; node < _nodeCount; ++node)
+        {
+            _heaps[node] = heap_create<Policy>();
+            assert(_heaps[node] != nullptr);
+            if (_nodeCount > 1)
+                _heaps[node]->GetPageCache()->SetNumaNode(node);
+        }
+    }
+
+    int _nodeCount;
+    Heap<Policy> *_heaps[kMaxNumaNodes];
+
+    static __thread int _tlsNode;
+    static __thread size_t _tlsCountdown;
+};
+
+template <class Policy>
+__thread int NumaHeaps<Policy>::_tlsNode = 0;
+
+template <class Policy>
+__thread size_t NumaHeaps<Policy>::_tlsCountdown = 0;
+
+// 从当前节点的堆分配
+template <class Policy = DefaultPolicy>
+inline void *NumaAlloc(size_t size)
+{
+    return NumaHeaps<Policy>::GetInstance()->Allocate(size);
+}
+
+template <class Policy = DefaultPolicy>
+inline void NumaFree(void *ptr)
+{
+    NumaHeaps<Policy>::GetInstance()->Free(ptr);
+}
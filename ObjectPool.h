@@ -1,15 +1,86 @@
+#pragma once
 /*定长内存池*/
 #include <iostream>
 #include <atomic>
+#include <utility>
 #include "Common.h"
 using std::cout;
 using std::endl;
 
+/**
+ * 记录定长内存池向系统申请的大块内存
+ * 每个大块开头放一个头部，串成单链表，Reset/析构时按大块个数O(chunks)一次性还给系统，
+ * 不用对每个对象调用Delete
+ */
+class ChunkList
+{
+public:
+	ChunkList() {}
+	ChunkList(const ChunkList &) = delete;
+	ChunkList &operator=(const ChunkList &) = delete;
+
+	~ChunkList()
+	{
+		ReleaseAll();
+	}
+
+	// 申请一个至少bytes可用字节的大块，返回头部之后的可用区域，usable为可用字节数
+	char *Allocate(size_t bytes, size_t &usable)
+	{
+		// 右移META_PAGE_SHIFT位，就是除以页大小 向上取整
+		size_t npage = (bytes + kHeaderSize + (1 << META_PAGE_SHIFT) - 1) >> META_PAGE_SHIFT;
+		Header *chunk = (Header *)SystemAlloc(npage);
+		chunk->next = _head;
+		chunk->npage = npage;
+		_head = chunk;
+		_count++;
+		_bytes += npage << META_PAGE_SHIFT;
+
+		usable = (npage << META_PAGE_SHIFT) - kHeaderSize;
+		return (char *)chunk + kHeaderSize;
+	}
+
+	// 把所有大块还给系统
+	void ReleaseAll()
+	{
+		while (_head)
+		{
+			Header *next = _head->next;
+			SystemFree(_head, _head->npage);
+			_head = next;
+		}
+		_count = 0;
+		_bytes = 0;
+	}
+
+	size_t Count() const { return _count; }
+	size_t Bytes() const { return _bytes; }
+
+private:
+	struct Header
+	{
+		Header *next;
+		size_t npage;
+	};
+	static const size_t kHeaderSize = 16; // 头部占16字节，保证对象16字节对齐
+
+	Header *_head = nullptr;
+	size_t _count = 0; // 大块个数
+	size_t _bytes = 0; // 向系统申请的总字节数
+};
+
 template <class T>
 class ObjectPool
 {
 public:
 	std::mutex _poolMtx;
+
+	ObjectPool() {}
+	ObjectPool(const ObjectPool &) = delete;
+	ObjectPool &operator=(const ObjectPool &) = delete;
+
+	// 析构时所有大块还给系统（_chunks析构），池里的对象不会再调用析构函数
+
 	T *New() // 申请一个T类型大小的空间
 	{
 		T *obj = nullptr; // 最终返回的空间
@@ -27,24 +98,19 @@ public:
 			if (_remanentBytes < sizeof(T)) // 这样也会包含剩余空间为0的情况
 			{
 
+				size_t bytes;
 				if (sizeof(T) > 128 * 1024)
 				{
-					_remanentBytes = sizeof(T); // 应对大空间申请情况
+					bytes = sizeof(T); // 应对大空间申请情况
 				}
 				else
 				{
-					_remanentBytes = 128 * 1024; // 开128K的空间 假设不会超过128KB
+					bytes = 128 * 1024; // 开128K的空间 假设不会超过128KB
 				}
 				//_memory = (char*)malloc(_remanentBytes);
 
-				// 右移PAGE_SHIFT位，就是除以页大小 向上取整
-				size_t npage = (_remanentBytes + (1 << PAGE_SHIFT) - 1) >> PAGE_SHIFT;
-				_memory = (char *)SystemAlloc(npage);
-
-				if (_memory == nullptr) // 开失败了抛异常
-				{
-					throw std::bad_alloc();
-				}
+				// 大块记在_chunks里，Reset/析构时统一还给系统
+				_memory = _chunks.Allocate(bytes, _remanentBytes);
 			}
 
 			obj = (T *)_memory; // 给定一个T类型的大小  并发执行下_memory可能是空指针，需要加锁保护
@@ -69,7 +135,21 @@ public:
 		_freelist = obj;		   // 头指针指向新块
 	}
 
+	// 丢弃池中所有对象（不调用析构函数），大块全部还给系统，O(chunks)
+	// 之前New出来的指针全部失效
+	void Reset()
+	{
+		_chunks.ReleaseAll();
+		_memory = nullptr;
+		_remanentBytes = 0;
+		_freelist = nullptr;
+	}
+
+	size_t ChunkCount() const { return _chunks.Count(); }
+	size_t ChunkBytes() const { return _chunks.Bytes(); }
+
 private:
+	ChunkList _chunks;		   // 向系统申请的大块
 	char *_memory = nullptr;   // 指向内存块的指针
 	size_t _remanentBytes = 0; // 大块内存在切分过程中的剩余字节数
 	void *_freelist = nullptr; // 自由链表，用来连接归还的空闲空间
@@ -77,84 +157,300 @@ private:
 
 namespace lockfree
 {
-	template <class T>
-	class ObjectPool
+	/**
+	 * 共享自由链表的表头：指针 + ABA计数，每次CAS成功计数加一
+	 * Load()读出当前值，Ptr()取出指针，Same(a, b)判断两次读到的是不是同一个表头，
+	 * CompareExchange(expected, ptr)把表头换成ptr，失败时expected更新为最新值
+	 */
+
+	// 指针和计数挤在一个64位整数里：低48位指针，高16位计数
+	// 假设用户态地址不超过48位（5级页表下不成立），计数65536次回绕
+	class PackedHead
 	{
 	public:
-		static const int objsize = sizeof(T) < sizeof(intptr_t) ? sizeof(intptr_t) : sizeof(T);
+		typedef int64_t Value;
+
 		static const int64_t aba_inc = 0x0001000000000000LL;  // ABA 计数每次需要增加的值
 		static const int64_t aba_mark = 0xFFFF000000000000LL; // ABA Mark
 		static const int64_t ptr_mark = 0x0000FFFFFFFFFFFFLL; // 指针 Mark
 
+		PackedHead() : _head(0) {}
+
+		Value Load() const
+		{
+			return _head.load(std::memory_order_acquire);
+		}
+
+		static void *Ptr(Value v)
+		{
+			return (void *)(v & ptr_mark);
+		}
+
+		static bool Same(Value a, Value b)
+		{
+			return a == b;
+		}
+
+		bool CompareExchange(Value &expected, void *ptr)
+		{
+			Value desired = ((int64_t)ptr & ptr_mark) | (((expected & aba_mark) + aba_inc) & aba_mark);
+			return _head.compare_exchange_weak(expected, desired,
+											   std::memory_order_acq_rel,
+											   std::memory_order_acquire);
+		}
+
+		void Clear()
+		{
+			_head.store(0, std::memory_order_relaxed);
+		}
+
+	private:
+		std::atomic<int64_t> _head;
+	};
+
+#ifdef __GCC_HAVE_SYNC_COMPARE_AND_SWAP_16
+	// 128位表头 {指针, 64位计数}，用cmpxchg16b整体CAS（x86-64需要-mcx16）
+	// 不依赖地址位数，计数实际上不会回绕
+	class WideHead
+	{
 	public:
-		ObjectPool() : _free_head(0), _memory(nullptr), _remanentBytes(0) {}
+		union Value
+		{
+			unsigned __int128 raw;
+			struct
+			{
+				void *ptr;
+				uint64_t tag;
+			} s;
+		};
 
-		~ObjectPool()
+		WideHead()
 		{
-			// 清理所有分配的内存块
-			// 注意：这里简化处理，实际应该追踪所有分配的块
+			_head.raw = 0;
 		}
 
-		// 申请一个T类型大小的空间（无锁版本）
-		T *New()
+		// 两个64位分别读，不需要一次cmpxchg16b：
+		// 读到的指针和计数不配套时，后面的CompareExchange一定失败
+		Value Load() const
 		{
-			T *obj = nullptr;
+			Value v;
+			v.s.tag = __atomic_load_n(&_head.s.tag, __ATOMIC_ACQUIRE);
+			v.s.ptr = __atomic_load_n(&_head.s.ptr, __ATOMIC_ACQUIRE);
+			return v;
+		}
 
-			// 尝试从 freelist 中获取（无锁操作）
-			while (true)
+		static void *Ptr(const Value &v)
+		{
+			return v.s.ptr;
+		}
+
+		// 只比较计数：每次修改计数都加一，计数没变表头就没变过
+		static bool Same(const Value &a, const Value &b)
+		{
+			return a.s.tag == b.s.tag;
+		}
+
+		bool CompareExchange(Value &expected, void *ptr)
+		{
+			Value desired;
+			desired.s.ptr = ptr;
+			desired.s.tag = expected.s.tag + 1;
+			Value prev;
+			prev.raw = __sync_val_compare_and_swap(&_head.raw, expected.raw, desired.raw);
+			if (prev.raw == expected.raw)
 			{
-				int64_t old_head = _free_head.load(std::memory_order_acquire);
-				
-				if (old_head == 0)
+				return true;
+			}
+			expected = prev;
+			return false;
+		}
+
+		void Clear()
+		{
+			__atomic_store_n(&_head.s.ptr, (void *)nullptr, __ATOMIC_RELAXED);
+		}
+
+	private:
+		alignas(16) Value _head;
+	};
+#endif
+
+	// 编译时加 -DLOCKFREE_POOL_DWCAS（cmake -DLOCKFREE_POOL_DWCAS=ON）默认使用128位表头
+#ifdef LOCKFREE_POOL_DWCAS
+#ifndef __GCC_HAVE_SYNC_COMPARE_AND_SWAP_16
+#error "LOCKFREE_POOL_DWCAS requires a 16-byte compare-and-swap (-mcx16 on x86-64)"
+#endif
+	typedef WideHead DefaultHead;
+#else
+	typedef PackedHead DefaultHead;
+#endif
+
+	/**
+	 * 无锁定长内存池
+	 * 共享自由链表是带ABA计数的Treiber栈；可选每线程magazine（本地小栈）：
+	 * New/Delete先走本地栈，空了从共享链表一次CAS摘一批或者从大块一次切一批，满了把一半一次CAS还回去，
+	 * 多核下不再每次都争抢_free_head所在的cache line。
+	 */
+	template <class T, class Head = DefaultHead>
+	class ObjectPool
+	{
+	public:
+		static const int objsize = sizeof(T) < sizeof(intptr_t) ? sizeof(intptr_t) : sizeof(T);
+
+		static const int kMaxMagazinePools = 16;		// 每种T同时最多这么多个池开启magazine
+		static const size_t kMagazineBytes = 16 * 1024; // 每个线程每个池本地缓存的目标字节数
+		static const size_t kMaxMagazineSize = 32;		// 一批最多搬运的对象数
+
+	public:
+		// useMagazine: 是否开启每线程magazine
+		explicit ObjectPool(bool useMagazine = false)
+			: _slot(-1), _id(_nextId.fetch_add(1, std::memory_order_relaxed)), _epoch(0), _memory(nullptr), _remanentBytes(0)
+		{
+			if (useMagazine)
+			{
+				// 找一个空槽位，池析构时还回来；同时存在的池超过kMaxMagazinePools个时，多出的退化成只用共享链表
+				for (int i = 0; i < kMaxMagazinePools; ++i)
 				{
-					// freelist 为空，需要分配新内存
-					break;
+					ObjectPool *expected = nullptr;
+					if (_slotOwner[i].compare_exchange_strong(expected, this, std::memory_order_acq_rel))
+					{
+						_slot = i;
+						break;
+					}
 				}
+			}
+		}
 
-				// 解析指针和ABA计数
-				void *ptr = (void *)(old_head & ptr_mark);
-				
-				// 安全检查：确保指针有效
-				if (ptr == nullptr)
+		ObjectPool(const ObjectPool &) = delete;
+		ObjectPool &operator=(const ObjectPool &) = delete;
+
+		// 所有大块还给系统（_chunks析构），池里的对象不会再调用析构函数
+		// 调用者保证析构时没有其他线程在使用这个池
+		~ObjectPool()
+		{
+			if (_slot >= 0)
+			{
+				_slotOwner[_slot].store(nullptr, std::memory_order_release);
+			}
+		}
+
+		// 丢弃池中所有对象（不调用析构函数），大块全部还给系统，O(chunks)
+		// 不是线程安全的：调用者保证此时没有其他线程在New/Delete，之前New出来的指针全部失效。
+		// 各线程magazine里的对象指向已经释放的大块，递增_epoch让它们下次访问时直接丢弃
+		void Reset()
+		{
+			std::lock_guard<std::mutex> lock(_chunk_mtx);
+			_chunks.ReleaseAll();
+			_memory = nullptr;
+			_remanentBytes = 0;
+			_free_head.Clear();
+			_epoch.fetch_add(1, std::memory_order_release);
+		}
+
+		size_t ChunkCount()
+		{
+			std::lock_guard<std::mutex> lock(_chunk_mtx);
+			return _chunks.Count();
+		}
+
+		size_t ChunkBytes()
+		{
+			std::lock_guard<std::mutex> lock(_chunk_mtx);
+			return _chunks.Bytes();
+		}
+
+		// 每批搬运的对象数，大对象少搬一些，避免每个线程囤太多内存
+		static size_t MagazineSize()
+		{
+			size_t n = kMagazineBytes / objsize;
+			return n < 1 ? 1 : (n > kMaxMagazineSize ? kMaxMagazineSize : n);
+		}
+
+		bool UseMagazine() const
+		{
+			return _slot >= 0;
+		}
+
+		// 申请一个T类型大小的空间（无锁版本），不调用构造函数
+		void *Allocate()
+		{
+			void *obj = nullptr;
+
+			if (_slot >= 0)
+			{
+				Magazine &mag = LocalMagazine();
+				if (mag.count == 0)
 				{
-					break;
+					RefillMagazine(mag);
 				}
-				
-				int64_t aba = old_head & aba_mark;
-
-				// 获取next指针（这里存在竞态窗口，但ABA计数器会保护）
-				void *next = *(void **)ptr;
-				int64_t new_head = ((int64_t)next & ptr_mark) | ((aba + aba_inc) & aba_mark);
+				obj = mag.head;
+				mag.head = *(void **)obj;
+				mag.count--;
+			}
+			else
+			{
+				// 尝试从 freelist 中获取（无锁操作）
+				obj = PopOne();
 
-				// CAS 操作：如果 _free_head 还是 old_head，则更新为 new_head
-				if (_free_head.compare_exchange_weak(old_head, new_head,
-													  std::memory_order_release,
-													  std::memory_order_acquire))
+				// freelist 为空，从大块内存中分配
+				if (obj == nullptr)
 				{
-					obj = (T *)ptr;
-					break;
+					obj = allocate_from_chunk();
 				}
-				// CAS 失败，继续循环重试
 			}
 
-			// freelist 为空，从大块内存中分配
 			if (obj == nullptr)
 			{
-				obj = (T *)allocate_from_chunk();
+				throw std::bad_alloc();
 			}
+			return obj;
+		}
 
+		// 回收Allocate得到的空间（无锁版本），不调用析构函数
+		void Deallocate(void *obj)
+		{
 			if (obj == nullptr)
+				return;
+
+			if (_slot >= 0)
 			{
-				throw std::bad_alloc();
+				Magazine &mag = LocalMagazine();
+				*(void **)obj = mag.head;
+				mag.head = obj;
+				mag.count++;
+				if (mag.count >= 2 * MagazineSize())
+				{
+					FlushMagazine(mag, MagazineSize());
+				}
+				return;
 			}
 
-			// 调用构造函数
-			new (obj) T;
+			PushChain(obj, obj);
+		}
 
-			return obj;
+		// 申请并默认构造一个T
+		T *New()
+		{
+			return new (Allocate()) T;
 		}
 
-		// 回收空间（无锁版本）
+		// 申请并用参数构造一个T，构造函数抛异常时空间还回池里
+		template <class Arg, class... Args>
+		T *New(Arg &&arg, Args &&...args)
+		{
+			void *obj = Allocate();
+			try
+			{
+				return new (obj) T(std::forward<Arg>(arg), std::forward<Args>(args)...);
+			}
+			catch (...)
+			{
+				Deallocate(obj);
+				throw;
+			}
+		}
+
+		// 析构并回收
 		void Delete(T *obj)
 		{
 			if (obj == nullptr)
@@ -162,37 +458,337 @@ namespace lockfree
 
 			// 显示调用析构函数
 			obj->~T();
+			Deallocate(obj);
+		}
+
+		// 一次申请n个对象放进out[0, n)
+		// 先从本线程magazine拿，不够再从共享链表一次CAS摘一串，共享链表空了再从大块里一次切一串
+		void NewBatch(size_t n, T **out)
+		{
+			size_t got = 0;
 
-			// 无锁头插到 freelist
+			if (_slot >= 0)
+			{
+				Magazine &mag = LocalMagazine();
+				while (got < n && mag.count > 0)
+				{
+					out[got++] = (T *)mag.head;
+					mag.head = *(void **)mag.head;
+					mag.count--;
+				}
+			}
+
+			while (got < n)
+			{
+				void *first = nullptr;
+				void *last = nullptr;
+				size_t k = PopChain(n - got, first, last);
+				if (k == 0)
+				{
+					k = allocate_chain_from_chunk(n - got, first, last);
+				}
+				if (k == 0)
+				{
+					throw std::bad_alloc();
+				}
+				// 摘下来的链只属于当前线程，最后一个节点的next是nullptr
+				for (void *obj = first; obj != nullptr; obj = *(void **)obj)
+				{
+					out[got++] = (T *)obj;
+				}
+			}
+
+			// 调用构造函数
+			for (size_t i = 0; i < n; ++i)
+			{
+				out[i] = new (out[i]) T;
+			}
+		}
+
+		// 一次回收objs[0, n)，nullptr跳过
+		// 在本地把对象链起来，一次CAS挂到共享链表上，不经过magazine（一大批对象塞进magazine还是要flush）
+		void DeleteBatch(T *const *objs, size_t n)
+		{
+			void *first = nullptr;
+			void *last = nullptr;
+			for (size_t i = 0; i < n; ++i)
+			{
+				T *obj = objs[i];
+				if (obj == nullptr)
+					continue;
+
+				// 显示调用析构函数
+				obj->~T();
+
+				if (last == nullptr)
+				{
+					first = obj;
+				}
+				else
+				{
+					*(void **)last = obj;
+				}
+				last = obj;
+			}
+
+			if (first != nullptr)
+			{
+				PushChain(first, last);
+			}
+		}
+
+		// 回收一条已经链好的链[first, last]，共n个对象，不调用析构函数（Deallocate的批量版本）
+		// 链用对象开头的指针相连（*(void **)obj指向下一个，见SetNext），last的next不用管。
+		// 开了magazine并且放得下时直接接到本线程的本地栈上，否则一次CAS挂到共享链表
+		void DeleteBatch(void *first, void *last, size_t n)
+		{
+			if (first == nullptr)
+				return;
+
+			if (_slot >= 0)
+			{
+				Magazine &mag = LocalMagazine();
+				if (mag.count + n < 2 * MagazineSize())
+				{
+					*(void **)last = mag.head;
+					mag.head = first;
+					mag.count += n;
+					return;
+				}
+			}
+
+			PushChain(first, last);
+		}
+
+		// 把析构后的obj接到next前面，给上面的DeleteBatch(first, last, n)链对象用
+		static void SetNext(void *obj, void *next)
+		{
+			*(void **)obj = next;
+		}
+
+	private:
+		// 每个线程在每个池上的本地栈
+		struct Magazine
+		{
+			void *head;
+			size_t count;
+			size_t epoch; // 和池的_epoch不一致说明池被Reset过，里面的对象已经失效
+			size_t pool;  // 池的_id，和当前占用槽位的池不一致说明是上一个池留下的
+		};
+
+		Magazine &LocalMagazine()
+		{
+			// 线程第一次用到magazine时注册退出时的回收，只Delete不New的线程（消费者）也要注册
+			if (!_tlsFlusherRegistered)
+			{
+				RegisterFlusher();
+			}
+			Magazine &mag = _tlsMagazines[_slot];
+			size_t epoch = _epoch.load(std::memory_order_relaxed);
+			if (mag.pool != _id || mag.epoch != epoch)
+			{
+				// 槽位上次属于一个已经析构的池，或者池被Reset过，里面的对象已经失效
+				mag.head = nullptr;
+				mag.count = 0;
+				mag.epoch = epoch;
+				mag.pool = _id;
+			}
+			return mag;
+		}
+
+		static __attribute__((noinline)) void RegisterFlusher()
+		{
+			static thread_local MagazineFlusher flusher;
+			(void)flusher;
+			_tlsFlusherRegistered = true;
+		}
+
+		// 线程退出时把本地栈还给共享链表，否则这部分对象就丢了
+		struct MagazineFlusher
+		{
+			~MagazineFlusher()
+			{
+				for (int i = 0; i < kMaxMagazinePools; ++i)
+				{
+					Magazine &mag = _tlsMagazines[i];
+					ObjectPool *owner = _slotOwner[i].load(std::memory_order_acquire);
+					if (mag.count > 0 && owner != nullptr && mag.pool == owner->_id &&
+						mag.epoch == owner->_epoch.load(std::memory_order_acquire))
+					{
+						owner->FlushMagazine(mag, mag.count);
+					}
+				}
+			}
+		};
+
+		// 从共享链表头删一个对象
+		void *PopOne()
+		{
+			typename Head::Value old_head = _free_head.Load();
 			while (true)
 			{
-				int64_t old_head = _free_head.load(std::memory_order_acquire);
-				void *old_ptr = (void *)(old_head & ptr_mark);
-				int64_t aba = old_head & aba_mark;
+				void *ptr = Head::Ptr(old_head);
 
-				// 将 obj 的前sizeof(void*)字节设置为指向旧的头节点
-				*(void **)obj = old_ptr;
+				if (ptr == nullptr)
+				{
+					// freelist 为空，需要分配新内存
+					return nullptr;
+				}
 
-				// 构造新的 head（包含新指针和递增的ABA计数）
-				int64_t new_head = ((int64_t)obj & ptr_mark) | ((aba + aba_inc) & aba_mark);
+				// 获取next指针（这里存在竞态窗口，但ABA计数器会保护）
+				void *next = *(void **)ptr;
 
-				// CAS 操作
-				if (_free_head.compare_exchange_weak(old_head, new_head,
-													  std::memory_order_release,
-													  std::memory_order_acquire))
+				// CAS 操作：如果表头还是 old_head，则换成 next 并递增ABA计数
+				if (_free_head.CompareExchange(old_head, next))
 				{
-					break;
+					return ptr;
+				}
+				// CAS 失败，old_head 已更新为最新值，继续循环重试
+			}
+		}
+
+		// 把已经链好的[first, last]一次CAS头插到共享链表
+		void PushChain(void *first, void *last)
+		{
+			typename Head::Value old_head = _free_head.Load();
+			while (true)
+			{
+				// 将 last 的前sizeof(void*)字节设置为指向旧的头节点
+				*(void **)last = Head::Ptr(old_head);
+
+				if (_free_head.CompareExchange(old_head, first))
+				{
+					return;
 				}
 				// CAS 失败，继续循环重试
 			}
 		}
 
-	private:
+		// 从共享链表最多取n个对象链成[first, last]，返回实际个数
+		// 从表头往后走n个节点，一次CAS把表头换成第n个节点的next，代价是O(n)次读加一次CAS，和链表多长无关，
+		// 其他线程也不会看到链表被暂时摘空。
+		// 走的时候节点可能已经被别的线程取走并写入了用户数据（内存在池析构前不会还给系统，读是安全的），
+		// 所以每读一个next都要确认表头（含ABA计数）没变过，才能去读它指向的节点；变了就重新走，
+		// 并把这次要取的个数减半，竞争很激烈时退化成一次一个，保证能取到
+		size_t PopChain(size_t n, void *&first, void *&last)
+		{
+			first = last = nullptr;
+			typename Head::Value old_head = _free_head.Load();
+			while (true)
+			{
+				void *head = Head::Ptr(old_head);
+				if (head == nullptr || n == 0)
+				{
+					return 0;
+				}
+
+				void *tail = head;
+				size_t count = 1;
+				bool changed = false;
+				while (count < n)
+				{
+					void *next = *(void **)tail;
+					// 先读next再读表头：表头没变说明读next的时候tail还在链表上，next是有效节点
+					std::atomic_thread_fence(std::memory_order_acquire);
+					if (!Head::Same(_free_head.Load(), old_head))
+					{
+						changed = true;
+						break;
+					}
+					if (next == nullptr)
+					{
+						break;
+					}
+					tail = next;
+					++count;
+				}
+
+				if (!changed)
+				{
+					void *next = *(void **)tail;
+					if (_free_head.CompareExchange(old_head, next))
+					{
+						*(void **)tail = nullptr;
+						first = head;
+						last = tail;
+						return count;
+					}
+				}
+				else
+				{
+					old_head = _free_head.Load();
+				}
+				n = n > 1 ? n / 2 : 1;
+			}
+		}
+
+		void RefillMagazine(Magazine &mag)
+		{
+			void *first = nullptr;
+			void *last = nullptr;
+			size_t n = PopChain(MagazineSize(), first, last);
+			if (n == 0)
+			{
+				n = allocate_chain_from_chunk(MagazineSize(), first, last);
+			}
+			if (n == 0)
+			{
+				throw std::bad_alloc();
+			}
+			*(void **)last = mag.head;
+			mag.head = first;
+			mag.count += n;
+		}
+
+		// 把本地栈头部的n个对象一次CAS还给共享链表
+		void FlushMagazine(Magazine &mag, size_t n)
+		{
+			void *first = mag.head;
+			void *last = first;
+			for (size_t i = 1; i < n; ++i)
+			{
+				last = *(void **)last;
+			}
+			mag.head = *(void **)last;
+			mag.count -= n;
+			PushChain(first, last);
+		}
+
 		// 从大块内存中分配（这里仍需要一些同步，使用轻量级自旋锁）
 		void *allocate_from_chunk()
 		{
 			std::lock_guard<std::mutex> lock(_chunk_mtx);
+			return carve_locked();
+		}
 
+		// 持有一次_chunk_mtx切出n个对象，链成[first, last]
+		size_t allocate_chain_from_chunk(size_t n, void *&first, void *&last)
+		{
+			std::lock_guard<std::mutex> lock(_chunk_mtx);
+			first = last = carve_locked();
+			if (first == nullptr)
+			{
+				return 0;
+			}
+			size_t count = 1;
+			while (count < n)
+			{
+				void *obj = carve_locked();
+				if (obj == nullptr)
+				{
+					break;
+				}
+				*(void **)last = obj;
+				last = obj;
+				++count;
+			}
+			*(void **)last = nullptr;
+			return count;
+		}
+
+		// 调用者持有_chunk_mtx
+		void *carve_locked()
+		{
 			if (_remanentBytes < objsize)
 			{
 				size_t alloc_size;
@@ -205,15 +801,8 @@ namespace lockfree
 					alloc_size = 128 * 1024;
 				}
 
-				size_t npage = (alloc_size + (1 << PAGE_SHIFT) - 1) >> PAGE_SHIFT;
-				_memory = (char *)SystemAlloc(npage);
-
-				if (_memory == nullptr)
-				{
-					return nullptr;
-				}
-
-				_remanentBytes = npage << PAGE_SHIFT;
+				// 大块记在_chunks里，Reset/析构时统一还给系统
+				_memory = _chunks.Allocate(alloc_size, _remanentBytes);
 			}
 
 			void *obj = _memory;
@@ -224,12 +813,72 @@ namespace lockfree
 		}
 
 	private:
-		std::atomic<int64_t> _free_head; // 自由链表头（包含指针和ABA计数）
-		
+		Head _free_head;				 // 自由链表头（包含指针和ABA计数）
+		int _slot;						 // magazine槽位，-1表示不用magazine
+		const size_t _id;				 // 池的编号，从1开始不重复，区分先后占用同一个槽位的池
+		std::atomic<size_t> _epoch;		 // 每次Reset加一
+
 		// 用于chunk分配的成员（这部分仍需要轻量级锁）
 		std::mutex _chunk_mtx;
+		ChunkList _chunks;
 		char *_memory;
 		size_t _remanentBytes;
+
+		static std::atomic<size_t> _nextId;									// 下一个池编号
+		static std::atomic<ObjectPool *> _slotOwner[kMaxMagazinePools];		// 槽位对应的池，池析构后置空，可以给新的池用
+		static __thread Magazine _tlsMagazines[kMaxMagazinePools];			// 每线程每槽位一个本地栈
+		static __thread bool _tlsFlusherRegistered;							// 当前线程是否注册了MagazineFlusher
 	};
 
-} // namespace lockfree
\ No newline at end of file
+	template <class T, class Head>
+	__thread bool ObjectPool<T, Head>::_tlsFlusherRegistered = false;
+
+	template <class T, class Head>
+	std::atomic<size_t> ObjectPool<T, Head>::_nextId(1);
+
+	template <class T, class Head>
+	std::atomic<ObjectPool<T, Head> *> ObjectPool<T, Head>::_slotOwner[ObjectPool<T, Head>::kMaxMagazinePools];
+
+	template <class T, class Head>
+	__thread typename ObjectPool<T, Head>::Magazine ObjectPool<T, Head>::_tlsMagazines[ObjectPool<T, Head>::kMaxMagazinePools];
+
+} // namespace lockfree
+
+/**
+ * 每线程缓存的定长对象池
+ * New把参数原样转发给T的构造函数；每个线程有一个本地空闲栈（lockfree::ObjectPool的magazine），
+ * 空了从共享的lockfree::ObjectPool批量取，多了批量还回去，热路径上不碰共享链表。
+ * 同一个T同时最多lockfree::ObjectPool::kMaxMagazinePools个池有本地栈，超出的池退化成只用共享链表
+ */
+template <class T, class Head = lockfree::DefaultHead>
+class ThreadLocalObjectPool
+{
+public:
+	ThreadLocalObjectPool() : _pool(true) {}
+
+	template <class... Args>
+	T *New(Args &&...args)
+	{
+		return _pool.New(std::forward<Args>(args)...);
+	}
+
+	void Delete(T *obj)
+	{
+		_pool.Delete(obj);
+	}
+
+	// 是否拿到了每线程本地栈
+	bool ThreadCached() const
+	{
+		return _pool.UseMagazine();
+	}
+
+	// 不是线程安全的，见lockfree::ObjectPool::Reset
+	void Reset()
+	{
+		_pool.Reset();
+	}
+
+private:
+	lockfree::ObjectPool<T, Head> _pool; // 共享池，本地栈的对象来自这里
+};
@@ -4,6 +4,9 @@
 #include <chrono>
 #include <atomic>
 #include <iostream>
+#include <stdexcept>
+#include <set>
+#include <string>
 
 using namespace std;
 
@@ -221,6 +224,89 @@ void TestHighConcurrency() {
     }
 }
 
+// 测试5b: 高并发吞吐，对比共享链表和每线程magazine
+template <class Pool>
+void ThroughputWorker(Pool& pool, int operations) {
+    TestObject* burst[16];
+    for (int i = 0; i < operations; i += 16) {
+        // 每次申请一小批再全部释放，模拟span/节点的短暂使用
+        for (int j = 0; j < 16; ++j) {
+            burst[j] = pool.New();
+            burst[j]->data[0] = j;
+        }
+        for (int j = 0; j < 16; ++j) {
+            if (burst[j]->data[0] != j) {
+                cerr << "Data corruption detected in throughput worker" << endl;
+            }
+            pool.Delete(burst[j]);
+        }
+    }
+}
+
+template <class Head = lockfree::DefaultHead>
+double RunThroughput(bool useMagazine, int num_threads, int operations, const char* label = nullptr) {
+    typedef lockfree::ObjectPool<TestObject, Head> Pool;
+    Pool pool(useMagazine);
+    vector<thread> threads;
+
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < num_threads; ++i) {
+        threads.emplace_back(ThroughputWorker<Pool>, ref(pool), operations);
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    auto end = chrono::steady_clock::now();
+
+    double seconds = chrono::duration<double>(end - start).count();
+    double mops = 2.0 * num_threads * operations / seconds / 1e6; // New + Delete
+    if (label == nullptr) {
+        label = useMagazine ? "magazine   " : "shared list";
+    }
+    cout << "  " << label << " " << num_threads << " threads: "
+         << mops << " Mops/s" << endl;
+    return mops;
+}
+
+void TestHighConcurrencyThroughput() {
+    cout << "=== Test 5b: High Concurrency Throughput (shared list vs magazine) ===" << endl;
+
+    const int operations = 200000;
+    for (int num_threads : {1, 4, 16}) {
+        double shared = RunThroughput(false, num_threads, operations);
+        double magazine = RunThroughput(true, num_threads, operations);
+        cout << "  speedup: " << magazine / shared << "x" << endl;
+    }
+    cout << "✓ High concurrency throughput test passed!" << endl << endl;
+}
+
+// 测试5c: 64位压缩表头 vs 128位表头（cmpxchg16b），都不开magazine，每次New/Delete一次CAS
+void TestHeadWidthThroughput() {
+#ifdef __GCC_HAVE_SYNC_COMPARE_AND_SWAP_16
+    cout << "=== Test 5c: Free List Head Throughput (packed 64-bit vs 128-bit DWCAS) ===" << endl;
+
+    const int operations = 200000;
+    for (int num_threads : {1, 4, 16}) {
+        double packed = RunThroughput<lockfree::PackedHead>(false, num_threads, operations, "packed");
+        double wide = RunThroughput<lockfree::WideHead>(false, num_threads, operations, "wide  ");
+        cout << "  wide/packed: " << wide / packed << "x" << endl;
+    }
+
+    // 128位表头上的批量接口
+    lockfree::ObjectPool<TestObject, lockfree::WideHead> pool;
+    vector<TestObject*> objs(1000);
+    for (int r = 0; r < 10; ++r) {
+        pool.NewBatch(objs.size(), objs.data());
+        set<TestObject*> unique(objs.begin(), objs.end());
+        if (unique.size() != objs.size()) {
+            throw runtime_error("WideHead pool returned duplicate objects");
+        }
+        pool.DeleteBatch(objs.data(), objs.size());
+    }
+    cout << "✓ Free list head throughput test passed!" << endl << endl;
+#endif
+}
+
 // 测试6: 大对象测试
 void TestLargeObject() {
     cout << "=== Test 6: Large Object Test ===" << endl;
@@ -316,6 +402,515 @@ void TestMixedReadWrite() {
     cout << "✓ Mixed read/write test passed!" << endl << endl;
 }
 
+// 测试8: Reset和批量释放
+// 请求作用域的池：整批对象用完后Reset/析构，O(chunks)还给系统，不用逐个Delete
+void TestResetAndBulkRelease() {
+    cout << "=== Test 8: Reset and Bulk Release ===" << endl;
+
+    const int N = 100000;
+
+    // 有锁的池
+    {
+        ObjectPool<TestObject> pool;
+        for (int i = 0; i < N; ++i) {
+            pool.New()->data[0] = i;
+        }
+        size_t chunks = pool.ChunkCount();
+        cout << "Locked pool: " << N << " objects in " << chunks << " chunks ("
+             << pool.ChunkBytes() / 1024 << " KB)" << endl;
+        if (chunks == 0) {
+            throw runtime_error("locked pool did not track its chunks");
+        }
+        pool.Reset();
+        if (pool.ChunkCount() != 0 || pool.ChunkBytes() != 0) {
+            throw runtime_error("locked pool still holds chunks after Reset");
+        }
+        // Reset之后可以继续使用
+        TestObject* obj = pool.New();
+        obj->data[0] = 1;
+        pool.Delete(obj);
+    }
+
+    // 无锁池，带magazine：Reset后各线程magazine里的旧对象必须被丢弃
+    {
+        lockfree::ObjectPool<TestObject> pool(true);
+        vector<thread> threads;
+        for (int t = 0; t < 4; ++t) {
+            threads.emplace_back([&pool]() {
+                vector<TestObject*> objs;
+                for (int i = 0; i < N / 4; ++i) {
+                    objs.push_back(pool.New());
+                }
+                for (auto obj : objs) {
+                    pool.Delete(obj);
+                }
+            });
+        }
+        for (auto& t : threads) {
+            t.join();
+        }
+
+        // 本线程的magazine里也放一些对象
+        for (int i = 0; i < 8; ++i) {
+            pool.Delete(pool.New());
+        }
+
+        pool.Reset();
+        if (pool.ChunkCount() != 0) {
+            throw runtime_error("lock-free pool still holds chunks after Reset");
+        }
+
+        // 新分配的对象必须落在新的大块里，写满整个对象检查不会踩到已经unmap的内存
+        for (int round = 0; round < 3; ++round) {
+            vector<TestObject*> objs;
+            for (int i = 0; i < 1000; ++i) {
+                TestObject* obj = pool.New();
+                for (int j = 0; j < 10; ++j) {
+                    obj->data[j] = i;
+                }
+                objs.push_back(obj);
+            }
+            for (auto obj : objs) {
+                pool.Delete(obj);
+            }
+            pool.Reset();
+        }
+    }
+
+    // 逐个Delete vs 整池丢弃
+    {
+        vector<TestObject*> objs(N);
+        lockfree::ObjectPool<TestObject> pool;
+        for (int i = 0; i < N; ++i) {
+            objs[i] = pool.New();
+        }
+        auto start = chrono::high_resolution_clock::now();
+        for (int i = 0; i < N; ++i) {
+            pool.Delete(objs[i]);
+        }
+        auto mid = chrono::high_resolution_clock::now();
+        for (int i = 0; i < N; ++i) {
+            objs[i] = pool.New();
+        }
+        auto mid2 = chrono::high_resolution_clock::now();
+        pool.Reset();
+        auto end = chrono::high_resolution_clock::now();
+
+        cout << "Release " << N << " objects: per-object Delete "
+             << chrono::duration_cast<chrono::microseconds>(mid - start).count() << "us, Reset "
+             << chrono::duration_cast<chrono::microseconds>(end - mid2).count() << "us" << endl;
+    }
+
+    cout << "✓ Reset and bulk release test passed!" << endl << endl;
+}
+
+// 测试9: 批量申请/回收
+void BatchWorker(lockfree::ObjectPool<TestObject>& pool, int rounds, int batch, atomic<int>& errors) {
+    vector<TestObject*> objs(batch);
+    for (int r = 0; r < rounds; ++r) {
+        pool.NewBatch(batch, objs.data());
+        for (int i = 0; i < batch; ++i) {
+            if (objs[i]->data[0] != 0) {
+                errors++; // 没有构造
+            }
+            objs[i]->data[0] = r + 1;
+        }
+        for (int i = 0; i < batch; ++i) {
+            if (objs[i]->data[0] != r + 1) {
+                errors++; // 同一个对象被分给了两个线程
+            }
+        }
+        pool.DeleteBatch(objs.data(), batch);
+    }
+}
+
+void SingleWorker(lockfree::ObjectPool<TestObject>& pool, int rounds, int batch) {
+    vector<TestObject*> objs(batch);
+    for (int r = 0; r < rounds; ++r) {
+        for (int i = 0; i < batch; ++i) {
+            objs[i] = pool.New();
+        }
+        for (int i = 0; i < batch; ++i) {
+            pool.Delete(objs[i]);
+        }
+    }
+}
+
+void TestBatchOperations() {
+    cout << "=== Test 9: Batch New/Delete ===" << endl;
+
+    // 单线程：批量申请的对象互不相同，部分来自共享链表、部分来自大块
+    {
+        lockfree::ObjectPool<TestObject> pool;
+        vector<TestObject*> objs(1000);
+        pool.NewBatch(300, objs.data());
+        pool.DeleteBatch(objs.data(), 300);
+        pool.NewBatch(1000, objs.data());
+        set<TestObject*> unique(objs.begin(), objs.end());
+        if (unique.size() != 1000) {
+            throw runtime_error("NewBatch returned duplicate objects");
+        }
+        objs[10] = nullptr; // nullptr跳过
+        pool.DeleteBatch(objs.data(), 1000);
+        pool.NewBatch(0, objs.data());
+        pool.DeleteBatch(objs.data(), 0);
+    }
+
+    // 多线程，和magazine混用
+    for (int useMagazine = 0; useMagazine < 2; ++useMagazine) {
+        lockfree::ObjectPool<TestObject> pool(useMagazine != 0);
+        atomic<int> errors(0);
+        vector<thread> threads;
+        for (int t = 0; t < 8; ++t) {
+            threads.emplace_back(BatchWorker, ref(pool), 500, 64 + t * 16, ref(errors));
+        }
+        for (int t = 0; t < 4; ++t) {
+            threads.emplace_back(MultiThreadSimpleWorker, ref(pool), t, 10000);
+        }
+        for (auto& t : threads) {
+            t.join();
+        }
+        if (errors.load() != 0) {
+            throw runtime_error("batch operations handed out an object twice");
+        }
+    }
+
+    // 批量 vs 逐个：释放1000个节点的图
+    const int num_threads = 4;
+    const int rounds = 2000;
+    const int batch = 1000;
+    for (int mode = 0; mode < 2; ++mode) {
+        lockfree::ObjectPool<TestObject> pool;
+        atomic<int> errors(0);
+        auto start = chrono::high_resolution_clock::now();
+        vector<thread> threads;
+        for (int t = 0; t < num_threads; ++t) {
+            if (mode == 0) {
+                threads.emplace_back(SingleWorker, ref(pool), rounds, batch);
+            } else {
+                threads.emplace_back(BatchWorker, ref(pool), rounds, batch, ref(errors));
+            }
+        }
+        for (auto& t : threads) {
+            t.join();
+        }
+        auto end = chrono::high_resolution_clock::now();
+        double ms = chrono::duration<double, milli>(end - start).count();
+        double ops = 2.0 * num_threads * rounds * batch; // New + Delete
+        cout << (mode == 0 ? "New/Delete          " : "NewBatch/DeleteBatch")
+             << " " << num_threads << " threads x " << rounds << " rounds x " << batch
+             << " objects: " << ms << "ms (" << ops / ms / 1000.0 << " Mops/s)" << endl;
+    }
+
+    // DeleteBatch(first, last, n)：析构后自己链好，一次挂回去；有没有magazine都要能再取回来
+    for (int useMagazine = 0; useMagazine < 2; ++useMagazine) {
+        lockfree::ObjectPool<TestObject> pool(useMagazine != 0);
+        for (size_t n : {size_t(5), size_t(1000)}) {
+            vector<TestObject*> objs(n);
+            pool.NewBatch(n, objs.data());
+            size_t chunks = pool.ChunkCount();
+            for (size_t i = 0; i < n; ++i) {
+                objs[i]->~TestObject();
+                if (i > 0) {
+                    lockfree::ObjectPool<TestObject>::SetNext(objs[i - 1], objs[i]);
+                }
+            }
+            pool.DeleteBatch(objs.front(), objs.back(), n);
+            set<TestObject*> freed(objs.begin(), objs.end());
+            pool.NewBatch(n, objs.data());
+            for (TestObject* obj : objs) {
+                if (freed.count(obj) == 0) {
+                    throw runtime_error("DeleteBatch chain lost objects");
+                }
+            }
+            if (pool.ChunkCount() != chunks) {
+                throw runtime_error("DeleteBatch chain carved new chunks");
+            }
+            pool.DeleteBatch(objs.data(), n);
+        }
+    }
+
+    // 从很长的共享链表取：New一次一个CAS，NewBatch一批一个CAS
+    {
+        const int takers = 4;
+        const size_t chainLen = 64;
+        const size_t N = takers * chainLen * 1600;
+        for (int mode = 0; mode < 2; ++mode) {
+            lockfree::ObjectPool<TestObject> pool;
+            vector<TestObject*> objs(N);
+            pool.NewBatch(N, objs.data());
+            pool.DeleteBatch(objs.data(), N);
+
+            auto start = chrono::high_resolution_clock::now();
+            vector<thread> threads;
+            for (int t = 0; t < takers; ++t) {
+                threads.emplace_back([&, t]() {
+                    TestObject** out = objs.data() + t * (N / takers);
+                    if (mode == 0) {
+                        for (size_t i = 0; i < N / takers; ++i) {
+                            out[i] = pool.New();
+                        }
+                    } else {
+                        for (size_t i = 0; i < N / takers; i += chainLen) {
+                            pool.NewBatch(chainLen, out + i);
+                        }
+                    }
+                });
+            }
+            for (auto& t : threads) {
+                t.join();
+            }
+            auto end = chrono::high_resolution_clock::now();
+            set<TestObject*> distinct(objs.begin(), objs.end());
+            if (distinct.size() != N) {
+                throw runtime_error("taking from the shared list returned duplicate objects");
+            }
+            double ms = chrono::duration<double, milli>(end - start).count();
+            cout << (mode == 0 ? "New x1     " : "NewBatch x64") << " " << takers << " threads take " << N
+                 << " objects from the shared list: " << ms << "ms (" << N / ms / 1000.0 << " Mops/s)" << endl;
+        }
+    }
+
+    // 共享链表很长时NewBatch只取自己要的那几个，不会把整条链表摘下来，别的线程也不会因此去切新的大块
+    {
+        const size_t N = 200000;
+        const int drainers = 4;
+        lockfree::ObjectPool<TestObject> pool;
+        vector<TestObject*> objs(N);
+        for (size_t i = 0; i < N; ++i) {
+            objs[i] = pool.New();
+        }
+        pool.DeleteBatch(objs.data(), N);
+        size_t chunks = pool.ChunkCount();
+
+        auto start = chrono::high_resolution_clock::now();
+        vector<thread> threads;
+        for (int t = 0; t < drainers; ++t) {
+            threads.emplace_back([&]() {
+                TestObject* out[batch];
+                for (size_t i = 0; i < N / drainers; i += batch) {
+                    pool.NewBatch(batch, out);
+                }
+            });
+        }
+        for (auto& t : threads) {
+            t.join();
+        }
+        auto end = chrono::high_resolution_clock::now();
+        if (pool.ChunkCount() != chunks) {
+            throw runtime_error("NewBatch on a long free list carved new chunks");
+        }
+        cout << drainers << " threads NewBatch " << N << " objects from the free list: "
+             << chrono::duration_cast<chrono::milliseconds>(end - start).count() << "ms" << endl;
+    }
+
+    cout << "✓ Batch operations test passed!" << endl << endl;
+}
+
+// 测试10: 每线程缓存、带构造参数的对象池
+struct Connection {
+    static atomic<int> alive;
+    int fd;
+    string peer;
+    vector<char> buffer;
+    Connection(int fd_, const string& peer_, size_t bufSize)
+        : fd(fd_), peer(peer_), buffer(bufSize) {
+        if (fd_ < 0) {
+            throw runtime_error("bad fd");
+        }
+        alive++;
+    }
+    ~Connection() {
+        alive--;
+    }
+};
+atomic<int> Connection::alive(0);
+
+void ConnectionWorker(ThreadLocalObjectPool<Connection>& pool, int thread_id, int rounds, atomic<int>& errors) {
+    vector<Connection*> conns;
+    for (int r = 0; r < rounds; ++r) {
+        for (int i = 0; i < 8; ++i) {
+            conns.push_back(pool.New(thread_id * 1000 + i, "peer", 64));
+        }
+        for (int i = 0; i < 8; ++i) {
+            if (conns[i]->fd != thread_id * 1000 + i || conns[i]->buffer.size() != 64) {
+                errors++;
+            }
+        }
+        for (auto c : conns) {
+            pool.Delete(c);
+        }
+        conns.clear();
+    }
+}
+
+void TestThreadLocalObjectPool() {
+    cout << "=== Test 10: ThreadLocalObjectPool with constructor arguments ===" << endl;
+
+    ThreadLocalObjectPool<Connection> pool;
+    if (!pool.ThreadCached()) {
+        cout << "(magazine slots exhausted, running on the shared list)" << endl;
+    }
+
+    Connection* c = pool.New(3, string("10.0.0.1:80"), 128);
+    if (c->fd != 3 || c->peer != "10.0.0.1:80" || c->buffer.size() != 128 || Connection::alive != 1) {
+        throw runtime_error("constructor arguments were not forwarded");
+    }
+    pool.Delete(c);
+
+    // 构造函数抛异常：空间还回池里，对象不算存活
+    bool thrown = false;
+    try {
+        pool.New(-1, "bad", 16);
+    } catch (const runtime_error&) {
+        thrown = true;
+    }
+    if (!thrown || Connection::alive != 0) {
+        throw runtime_error("exception from constructor was not propagated cleanly");
+    }
+
+    // 默认构造的类型也可以用
+    ThreadLocalObjectPool<TestObject> plain;
+    TestObject* obj = plain.New();
+    plain.Delete(obj);
+
+    atomic<int> errors(0);
+    const int num_threads = 8;
+    const int rounds = 20000;
+    auto start = chrono::high_resolution_clock::now();
+    vector<thread> threads;
+    for (int t = 0; t < num_threads; ++t) {
+        threads.emplace_back(ConnectionWorker, ref(pool), t, rounds, ref(errors));
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    auto end = chrono::high_resolution_clock::now();
+    if (errors != 0 || Connection::alive != 0) {
+        throw runtime_error("ThreadLocalObjectPool corrupted objects");
+    }
+
+    // 对比 new/delete
+    auto start2 = chrono::high_resolution_clock::now();
+    threads.clear();
+    for (int t = 0; t < num_threads; ++t) {
+        threads.emplace_back([t, rounds]() {
+            vector<Connection*> conns;
+            for (int r = 0; r < rounds; ++r) {
+                for (int i = 0; i < 8; ++i) {
+                    conns.push_back(new Connection(t * 1000 + i, "peer", 64));
+                }
+                for (auto c : conns) {
+                    delete c;
+                }
+                conns.clear();
+            }
+        });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    auto end2 = chrono::high_resolution_clock::now();
+
+    cout << num_threads << " threads x " << rounds << " rounds x 8 connections: ThreadLocalObjectPool "
+         << chrono::duration_cast<chrono::milliseconds>(end - start).count() << "ms, new/delete "
+         << chrono::duration_cast<chrono::milliseconds>(end2 - start2).count() << "ms" << endl;
+
+    // 池析构后槽位还回来：先后建很多个池，每个都还有本地栈；
+    // 槽位上一个池留在本线程magazine里的对象不能被新池拿到
+    const int generations = 4 * lockfree::ObjectPool<Connection>::kMaxMagazinePools;
+    for (int g = 0; g < generations; ++g) {
+        ThreadLocalObjectPool<Connection> p;
+        if (!p.ThreadCached()) {
+            throw runtime_error("magazine slot not reused after pool destruction");
+        }
+        Connection* c = p.New(g, "gen", 16);
+        if (c->fd != g || c->buffer.size() != 16) {
+            throw runtime_error("ThreadLocalObjectPool reused pool state incorrect");
+        }
+        p.Delete(c);
+    }
+    cout << generations << " pools created and destroyed in turn, all thread cached" << endl;
+    cout << "✓ ThreadLocalObjectPool test passed!" << endl << endl;
+}
+
+// 测试11: magazine从很长的共享链表补货、只Delete的线程退出
+void TestMagazineRefill() {
+    cout << "=== Test 11: Magazine refill from a long free list ===" << endl;
+
+    // 一个线程New N个再全部Delete，4个线程同时把它们取回来：
+    // 每次补货只取一批，代价和共享链表长度无关；取的过程中链表不会被摘空，不应该再切新的大块
+    {
+        const size_t N = 160000;
+        const int drainers = 4;
+        lockfree::ObjectPool<TestObject> pool(true);
+        thread filler([&]() {
+            vector<TestObject*> objs(N);
+            for (size_t i = 0; i < N; ++i) {
+                objs[i] = pool.New();
+            }
+            for (size_t i = 0; i < N; ++i) {
+                pool.Delete(objs[i]);
+            }
+        });
+        filler.join();
+        size_t chunks = pool.ChunkCount();
+
+        auto start = chrono::high_resolution_clock::now();
+        vector<thread> threads;
+        for (int t = 0; t < drainers; ++t) {
+            threads.emplace_back([&]() {
+                for (size_t i = 0; i < N / drainers; ++i) {
+                    pool.New();
+                }
+            });
+        }
+        for (auto& t : threads) {
+            t.join();
+        }
+        auto end = chrono::high_resolution_clock::now();
+        // 每个线程最后一次补货可能多拿一批
+        if (pool.ChunkCount() > chunks + 1) {
+            throw runtime_error("draining the free list carved new chunks");
+        }
+        cout << drainers << " threads drained " << N << " objects: "
+             << chrono::duration_cast<chrono::milliseconds>(end - start).count() << "ms, chunks "
+             << chunks << " -> " << pool.ChunkCount() << endl;
+    }
+
+    // 消费者只Delete不New，退出时magazine里的对象也要还回共享链表
+    {
+        lockfree::ObjectPool<TestObject> pool(true);
+        const size_t n = 2 * lockfree::ObjectPool<TestObject>::MagazineSize() - 1; // 不够触发一次flush
+        vector<TestObject*> objs;
+        thread producer([&]() {
+            for (size_t i = 0; i < n; ++i) {
+                objs.push_back(pool.New());
+            }
+        });
+        producer.join();
+        thread consumer([&]() {
+            for (TestObject* obj : objs) {
+                pool.Delete(obj);
+            }
+        });
+        consumer.join();
+        set<TestObject*> freed(objs.begin(), objs.end());
+        size_t reused = 0;
+        thread reader([&]() {
+            for (size_t i = 0; i < n; ++i) {
+                reused += freed.count(pool.New());
+            }
+        });
+        reader.join();
+        if (reused != n) {
+            throw runtime_error("objects deleted by a consumer thread were lost at thread exit");
+        }
+    }
+
+    cout << "✓ Magazine refill test passed!" << endl << endl;
+}
+
 int main() {
     cout << "========================================" << endl;
     cout << "  Lock-Free ObjectPool Unit Tests" << endl;
@@ -327,8 +922,14 @@ int main() {
         TestMultiThreadSimple();
         TestMultiThreadComplex();
         TestHighConcurrency();
+        TestHighConcurrencyThroughput();
+        TestHeadWidthThroughput();
         TestLargeObject();
         TestMixedReadWrite();
+        TestResetAndBulkRelease();
+        TestBatchOperations();
+        TestThreadLocalObjectPool();
+        TestMagazineRefill();
         
         cout << "========================================" << endl;
         cout << "  ✓ All tests passed successfully!" << endl;
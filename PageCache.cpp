@@ -1,91 +1,106 @@
 #include "PageCache.h"
+#include "Numa.h"
+#include "Probes.h"
 
-PageCache PageCache::_sInst;
+template <class Policy>
+PageCache<Policy> *PageCache<Policy>::_sInst = new PageCache<Policy>(true); // 不析构，进程退出时其他静态对象可能还在用
 
-Span *PageCache::NewSpan(size_t k)
+template <class Policy>
+PageCache<Policy>::~PageCache()
+{
+    // span对象在_spanPool里，随_spanPool一起释放
+    for (void *ptr : _systemChunks)
+    {
+        SystemFree(ptr, PAGE_NUM - 1, Policy::kPageShift);
+    }
+}
+
+/**
+ * 不变式：pc管理的每个span（空闲的或分给cc的），它的每一页在_pageMap中都映射到它自己。
+ * 这样切分时只需要改切出去那部分的映射，合并时只需要改被吞掉的span的映射，
+ * 不会留下指向已经Delete的span的旧映射。
+ */
+template <class Policy>
+Span *PageCache<Policy>::NewSpan(size_t k)
 {
     assert(k > 0 && k < PAGE_NUM); // 申请页数有范围
 
-    // (1) k号桶中有span
+    // (1) k号桶中有span, 它的每一页已经映射到自己
     if (!_spanLists[k].Empty())
     {
         Span *span = _spanLists[k].PopFront();
-
-        // 记录pageId和span的映射关系
-        for (PageId i = 0; i < span->_n; ++i)
-        {
-            // _idSpanMap[span->_pageId + i] = span;
-            _pageMap.set(span->_pageId + i, span);
-        }
+        span->isUse = true;
         return span;
     }
 
-    // (2) k号桶没有span，但后面的桶有span
+    // (2) k号桶没有span，但后面的桶或者大span集合里有span
+    Span *nSpan = nullptr;
     for (size_t i = k + 1; i < PAGE_NUM; ++i)
     {
-        // i 桶有span， 对该span进行切分
         if (!_spanLists[i].Empty())
         {
-            // 获取桶中span， 起名nSpan
-            Span *nSpan = _spanLists[i].PopFront();
-
-            /* 将nSpan切分成一个k页的span和一个n-k页的span */
-
-            // Span的空间需要新建， 而不是用当前内存池中的空间
-            // _spanPool._poolMtx.lock();
-            Span *kSpan = _spanPool.New();
-            // _spanPool._poolMtx.unlock();
-            // Span *kSpan = new Span;  
-
-            // 分一个k页的span叫kSpan
-            kSpan->_pageId = nSpan->_pageId;
-            kSpan->_n = k;
-
-            // nSpan调整大小
-            nSpan->_pageId += k;
-            nSpan->_n -= k;
-
-            // 将n-k页的span挂到n-k号桶中
-            _spanLists[nSpan->_n].PushFront(nSpan);
-
-            // 边缘页映射，方便合并
-            // _idSpanMap[nSpan->_pageId] = nSpan;                 // 第一页
-            _pageMap.set(nSpan->_pageId, nSpan);
-            // _idSpanMap[nSpan->_pageId + nSpan->_n - 1] = nSpan; // 最后一页
-            _pageMap.set(nSpan->_pageId + nSpan->_n - 1, nSpan);
-
-            // 返回kSpan
-            // _idSpanMap[kSpan->_pageId] = kSpan; // 记录pageId和span的映射关系
-            _pageMap.set(kSpan->_pageId, kSpan);
-
-            for (PageId i = 0; i < kSpan->_n; ++i)
-            {
-                // _idSpanMap[kSpan->_pageId + i] = kSpan;
-                _pageMap.set(kSpan->_pageId + i, kSpan);
-            }
-            return kSpan;
+            nSpan = _spanLists[i].PopFront();
+            break;
         }
     }
+    if (nSpan == nullptr && !_largeSpans.empty())
+    {
+        // 集合按页数排序，第一个就是最小的大span
+        nSpan = *_largeSpans.begin();
+        _largeSpans.erase(_largeSpans.begin());
+    }
+
+    if (nSpan != nullptr)
+    {
+        /* 将nSpan切分成一个k页的span和一个n-k页的span */
+
+        // Span的空间需要新建， 而不是用当前内存池中的空间
+        Span *kSpan = _spanPool.New();
+
+        // 分一个k页的span叫kSpan
+        kSpan->_pageId = nSpan->_pageId;
+        kSpan->_n = k;
+        kSpan->isUse = true;
+
+        // nSpan调整大小，剩下的页仍然映射到nSpan
+        nSpan->_pageId += k;
+        nSpan->_n -= k;
+        InsertFreeSpan(nSpan);
+
+        // kSpan的每一页改为映射到kSpan
+        MapSpanPages(kSpan, kSpan->_pageId, kSpan->_n);
+        return kSpan;
+    }
 
-    // (3) k号桶没有span，后面的桶也没有span
+    // (3) 没有足够大的空闲span
 
     /* 走到这里说明没有128页的span， 需要向系统申请128页的span */
-    void *ptr = SystemAlloc(PAGE_NUM - 1); // PAGE_NUM为129
+    void *ptr = SystemAlloc(PAGE_NUM - 1, Policy::kPageShift); // 按策略的页大小对齐
+    MEMPOOL_PROBE2(pc_system_alloc, PAGE_NUM - 1, ptr);
+    _systemPages += PAGE_NUM - 1;
+    _systemChunks.push_back(ptr);
+    if (_numaNode >= 0)
+    {
+        // 还没写过，物理页在第一次写时按策略分配在_numaNode上，失败就按默认策略
+        NumaBindPreferred(ptr, (PAGE_NUM - 1) << Policy::kPageShift, _numaNode);
+    }
 
     Span *bigSpan = _spanPool.New();
 
     // 只需要修改bigSpan的_pageId和_n
-    bigSpan->_pageId = (PageId)ptr >> PAGE_SHIFT;
+    bigSpan->_pageId = (PageId)ptr >> Policy::kPageShift;
     bigSpan->_n = PAGE_NUM - 1;
+    MapSpanPages(bigSpan, bigSpan->_pageId, bigSpan->_n);
 
     // 将bigSpan挂到128号桶中
-    _spanLists[PAGE_NUM - 1].PushFront(bigSpan);
+    InsertFreeSpan(bigSpan);
     return NewSpan(k);
 }
 
-Span *PageCache::MapObjectToSpan(void *obj)
+template <class Policy>
+Span *PageCache<Policy>::MapObjectToSpan(void *obj)
 {
-    PageId id = ((PageId)obj) >> PAGE_SHIFT;
+    PageId id = ((PageId)obj) >> Policy::kPageShift;
 
     // std::unique_lock<std::mutex> lock(_pageMtx);
     // auto it = _idSpanMap.find(id);
@@ -98,76 +113,213 @@ Span *PageCache::MapObjectToSpan(void *obj)
     return nullptr;
 }
 
-void PageCache::ReleaseSpanToPageCache(Span *span)
+template <class Policy>
+void PageCache<Policy>::SetSpanSizeClass(Span *span, size_t index)
 {
-    // 向左合并
-    while (true)
+    assert(index < Policy::kFreeListNum && index < 255);
+    for (PageId i = 0; i < span->_n; ++i)
     {
-        PageId leftId = span->_pageId - 1;  // 左边相邻页id
-        auto ret = _pageMap.get(leftId); // 相邻页对应span在划分时会加入到_idSpanMap中
-
-        // 没有相邻页停止合并
-        if (ret == nullptr)
-        {
-            break;
-        }
+        _classMap.set(span->_pageId + i, (uint8_t)(index + 1));
+    }
+}
 
-        Span *leftSpan = (Span*)ret; // 相邻span指针
-        // leftSpan在cc中停止合并
-        if (leftSpan->isUse)
-            break;
+template <class Policy>
+void PageCache<Policy>::ClearSpanSizeClass(Span *span)
+{
+    for (PageId i = 0; i < span->_n; ++i)
+    {
+        _classMap.set(span->_pageId + i, 0);
+    }
+}
 
-        // 合并后超过128页停止合并
-        if (leftSpan->_n + span->_n > PAGE_NUM - 1)
-        {
-            break;
-        }
+template <class Policy>
+void PageCache<Policy>::MarkSpanSampled(Span *span)
+{
+    for (PageId i = 0; i < span->_n; ++i)
+    {
+        _classMap.set(span->_pageId + i, (uint8_t)kSampledSizeClass);
+    }
+}
 
-        span->_pageId = leftSpan->_pageId;
-        span->_n += leftSpan->_n;
+template <class Policy>
+void PageCache<Policy>::ReleaseSpanToPageCache(Span *span)
+{
+    // 回到pc后不再被cc使用，邻居可以和它合并
+    span->isUse = false;
+    size_t pages = span->_n;
+    size_t merges = 0;
 
-        _spanLists[leftSpan->_n].Erase(leftSpan);
+    // 向左合并
+    while (true)
+    {
+        PageId leftId = span->_pageId - 1; // 左边相邻页id
+        Span *leftSpan = (Span *)_pageMap.get(leftId);
 
-        // 删除相邻页的映射 原文没有的一点
-        // _idSpanMap.erase(leftSpan->_pageId);
-        // _idSpanMap.erase(leftSpan->_pageId + leftSpan->_n - 1);
+        // 没有相邻页或者leftSpan在cc中，停止合并
+        if (leftSpan == nullptr || leftSpan->isUse)
+            break;
 
-        // delete leftSpan; // 删除相邻span对象 leftSpan是NewSpan中创建出来的数据，需要删除，并不会删掉其pageId和n代表的页空间
-        _spanPool.Delete(leftSpan);
+        RemoveFreeSpan(leftSpan);
+        span = MergeSpans(leftSpan, span);
+        ++merges;
     }
 
     // 向右合并
     while (true)
     {
         PageId rightId = span->_pageId + span->_n; // 右边相邻页，注意span可能有多个page
-        auto it = _pageMap.get(rightId);
+        Span *rightSpan = (Span *)_pageMap.get(rightId);
 
-        if (it == nullptr)
+        if (rightSpan == nullptr || rightSpan->isUse)
             break;
 
-        Span *rightSpan = (Span*)it;
-        if (rightSpan->isUse)
-            break;
+        RemoveFreeSpan(rightSpan);
+        span = MergeSpans(span, rightSpan);
+        ++merges;
+    }
 
-        if (rightSpan->_n + span->_n > PAGE_NUM - 1)
-            break;
+    MEMPOOL_PROBE3(pc_coalesce, pages, span->_n, merges);
+
+    // 把合并后的span挂到对应桶中，超过128页的放进大span集合
+    InsertFreeSpan(span);
+}
 
-        span->_n += rightSpan->_n;
+template <class Policy>
+Span *PageCache<Policy>::MergeSpans(Span *left, Span *right)
+{
+    assert(left->_pageId + left->_n == right->_pageId);
+    assert(!left->isUse && !right->isUse);
+
+    // 页数多的span保留下来，只需要改页数少的那部分映射，避免反复合并时一直重写大span
+    Span *keep = left->_n >= right->_n ? left : right;
+    Span *drop = keep == left ? right : left;
 
-        _spanLists[rightSpan->_n].Erase(rightSpan);
+    MapSpanPages(keep, drop->_pageId, drop->_n);
 
-        // _idSpanMap.erase(rightSpan->_pageId);
-        // _idSpanMap.erase(rightSpan->_pageId + rightSpan->_n - 1);
+    keep->_pageId = left->_pageId;
+    keep->_n = left->_n + right->_n;
+
+    // drop是NewSpan中创建出来的数据，需要删除，并不会删掉其pageId和n代表的页空间
+    _spanPool.Delete(drop);
+    return keep;
+}
 
-        // delete rightSpan;
-        _spanPool.Delete(rightSpan);
+template <class Policy>
+void PageCache<Policy>::MapSpanPages(Span *span, PageId start, size_t n)
+{
+    for (PageId i = 0; i < n; ++i)
+    {
+        _pageMap.set(start + i, span);
     }
+}
 
-    // 把合并后的span挂到对应桶中
-    _spanLists[span->_n].PushFront(span);
+template <class Policy>
+void PageCache<Policy>::InsertFreeSpan(Span *span)
+{
+    if (span->_n < PAGE_NUM)
+    {
+        _spanLists[span->_n].PushFront(span);
+    }
+    else
+    {
+        _largeSpans.insert(span);
+    }
+}
 
-    // _idSpanMap[span->_pageId] = span;
-    // _idSpanMap[span->_pageId + span->_n - 1] = span;
-    _pageMap.set(span->_pageId, span);
-    _pageMap.set(span->_pageId + span->_n - 1, span);
+template <class Policy>
+void PageCache<Policy>::RemoveFreeSpan(Span *span)
+{
+    if (span->_n < PAGE_NUM)
+    {
+        _spanLists[span->_n].Erase(span);
+    }
+    else
+    {
+        _largeSpans.erase(span);
+    }
 }
+
+template <class Policy>
+void PageCache<Policy>::GetStats(PageCacheStats &stats)
+{
+    stats = PageCacheStats();
+    stats.systemPages = _systemPages;
+    for (size_t i = 1; i < PAGE_NUM; ++i)
+    {
+        for (Span *it = _spanLists[i].Begin(); it != _spanLists[i].End(); it = it->_next)
+        {
+            stats.freePages += it->_n;
+            stats.freeSpans++;
+        }
+    }
+    for (Span *span : _largeSpans)
+    {
+        stats.freePages += span->_n;
+        stats.freeSpans++;
+        stats.largeFreeSpans++;
+    }
+}
+
+template <class Policy>
+void PageCache<Policy>::GetFreeSpanLengths(std::vector<size_t> &lengths, size_t &uncoalesced)
+{
+    lengths.assign(PAGE_NUM + 1, 0);
+    uncoalesced = 0;
+    auto visit = [&](Span *span)
+    {
+        Span *left = (Span *)_pageMap.get(span->_pageId - 1);
+        Span *right = (Span *)_pageMap.get(span->_pageId + span->_n);
+        if ((left != nullptr && !left->isUse) || (right != nullptr && !right->isUse))
+            uncoalesced++;
+    };
+    for (size_t i = 1; i < PAGE_NUM; ++i)
+    {
+        for (Span *it = _spanLists[i].Begin(); it != _spanLists[i].End(); it = it->_next)
+        {
+            lengths[i]++;
+            visit(it);
+        }
+    }
+    for (Span *span : _largeSpans)
+    {
+        lengths[PAGE_NUM]++;
+        visit(span);
+    }
+}
+
+template <class Policy>
+bool PageCache<Policy>::Validate()
+{
+    std::vector<Span *> spans(_largeSpans.begin(), _largeSpans.end());
+    for (size_t i = 1; i < PAGE_NUM; ++i)
+    {
+        for (Span *it = _spanLists[i].Begin(); it != _spanLists[i].End(); it = it->_next)
+        {
+            if (it->_n != i)
+                return false;
+            spans.push_back(it);
+        }
+    }
+
+    for (Span *span : spans)
+    {
+        if (span->isUse)
+            return false;
+        for (PageId i = 0; i < span->_n; ++i)
+        {
+            if (_pageMap.get(span->_pageId + i) != span)
+                return false;
+        }
+        Span *left = (Span *)_pageMap.get(span->_pageId - 1);
+        Span *right = (Span *)_pageMap.get(span->_pageId + span->_n);
+        if ((left != nullptr && !left->isUse) || (right != nullptr && !right->isUse))
+            return false; // 相邻的空闲span没有合并
+    }
+    return true;
+}
+
+// 显式实例化所有策略
+template class PageCache<PagePolicy4K>;
+template class PageCache<PagePolicy8K>;
+template class PageCache<PagePolicy4KNoStats>;
+template class PageCache<PagePolicy4KLockStats>;
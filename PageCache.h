@@ -1,39 +1,126 @@
 #pragma once
+#include <set>
 #include "Common.h"
+#include "Policy.h"
 #include "RadixTree.h"
 
+// pc的页统计，GetStats填写
+struct PageCacheStats
+{
+    size_t systemPages = 0;    // 向系统申请的总页数
+    size_t freePages = 0;      // pc中空闲的页数
+    size_t freeSpans = 0;      // pc中空闲span个数
+    size_t largeFreeSpans = 0; // 其中超过kMaxPages页、挂在有序集合里的span个数
+};
+
+// MapObjectToSizeClass对被堆采样单独分配的页返回这个值，不和任何桶下标+1冲突
+static const size_t kSampledSizeClass = 255;
+
+template <class Policy>
 class PageCache
 {
+    static_assert(Policy::kFreeListNum < kSampledSizeClass, "size class byte map reserves 255 for sampled pages");
+
 public:
+    static const size_t PAGE_NUM = Policy::kMaxPages + 1; // 页数 多开一个桶避免-1
+
+    // 进程默认的pc，永不析构
     static PageCache *GetInstance()
     {
-        return &_sInst;
+        return _sInst;
     }
-    std::mutex _pageMtx;
+
+    // 独立的pc（见Heap.h），析构时把向系统申请的内存全部还回去
+    // spanMagazine: span池是否开每线程magazine，只有进程默认的pc开。堆可以很多，同时开magazine的池
+    // 最多lockfree::ObjectPool::kMaxMagazinePools个，而span池本来就只在_pageMtx下使用，堆的pc不占槽位
+    explicit PageCache(bool spanMagazine = false) : _spanPool(spanMagazine) {}
+    ~PageCache();
+    typename Policy::Lock _pageMtx;
+
+    // 之后向系统申请的内存优先放在node节点上（mbind MPOL_PREFERRED），-1表示不绑定
+    void SetNumaNode(int node) { _numaNode = node; }
+    int NumaNode() const { return _numaNode; }
 
     // pc申请k页span接口
     Span *NewSpan(size_t k);
 
     // 根据ptr找到对应的span
     Span *MapObjectToSpan(void *obj);
-    // 将span还给PC
+
+    // 记录span中每一页的size class（桶下标），调用者需持有_pageMtx
+    void SetSpanSizeClass(Span *span, size_t index);
+
+    // 把span每一页的size class清成0（不是cc切出来的小块），调用者需持有_pageMtx
+    void ClearSpanSizeClass(Span *span);
+
+    // 把span每一页标成kSampledSizeClass（HeapProfiler采中的对象），调用者需持有_pageMtx
+    void MarkSpanSampled(Span *span);
+
+    // 根据ptr找到所在页的size class，返回桶下标+1，0表示该页没有被切成小块，无锁
+    size_t MapObjectToSizeClass(void *obj) const
+    {
+        return _classMap.get(((PageId)obj) >> Policy::kPageShift);
+    }
+    // 将span还给PC，和左右空闲span合并
     void ReleaseSpanToPageCache(Span *span);
 
+    // 统计pc中的空闲页，调用者需持有_pageMtx
+    void GetStats(PageCacheStats &stats);
+
+    // 空闲span按页数的分布：lengths[k]是k页的空闲span个数（k <= kMaxPages），
+    // lengths[PAGE_NUM]是更大的span个数；uncoalesced是和左右空闲span相邻、本该合并的span个数
+    // 调用者需持有_pageMtx
+    void GetFreeSpanLengths(std::vector<size_t> &lengths, size_t &uncoalesced);
+
+    // 检查空闲span的不变式：每一页都映射到自己，且左右邻居不是空闲span（已充分合并）
+    // 调用者需持有_pageMtx, 用于测试
+    bool Validate();
+
+    // 页号->span基数树和size class字节表占用的元数据字节数
+    size_t PageMapBytes() const
+    {
+        return _pageMap.MemoryUsage() + _classMap.MemoryUsage();
+    }
+
 private:
-    PageCache() {}
     PageCache(const PageCache &) = delete;
     PageCache &operator=(const PageCache &) = delete;
 
+    // 空闲span挂到对应桶，超过PAGE_NUM - 1页的放进有序集合
+    void InsertFreeSpan(Span *span);
+    void RemoveFreeSpan(Span *span);
+
+    // 把span的[start, start + n)页映射到span
+    void MapSpanPages(Span *span, PageId start, size_t n);
+
+    // 合并两个相邻的空闲span，页数多的span保留，返回合并后的span
+    Span *MergeSpans(Span *left, Span *right);
+
+    // 超过PAGE_NUM - 1页的空闲span，按(页数, 页号)排序，NewSpan从中找最合适的
+    struct SpanLengthLess
+    {
+        bool operator()(const Span *a, const Span *b) const
+        {
+            return a->_n < b->_n || (a->_n == b->_n && a->_pageId < b->_pageId);
+        }
+    };
+
 private:
-    static PageCache _sInst;
-    SpanList _spanLists[PAGE_NUM]; // 每个桶是一个spanList, 存的是idx个页大小的span
-    lockfree::ObjectPool<Span> _spanPool;
+    static PageCache *_sInst;
+    SpanList<> _spanLists[PAGE_NUM]; // 每个桶是一个spanList, 存的是idx个页大小的span
+    std::set<Span *, SpanLengthLess> _largeSpans; // 合并后超过PAGE_NUM - 1页的空闲span
+    size_t _systemPages = 0; // 向系统申请的总页数
+    std::vector<void *> _systemChunks; // 向系统申请的大块，每块PAGE_NUM - 1页，析构时归还
+    int _numaNode = -1; // 向系统申请的内存绑定的节点
+    lockfree::ObjectPool<Span> _spanPool; // 只有进程默认的pc开每线程magazine
     // std::unordered_map<PageId, Span*> _idSpanMap; // 记录pageId和span的映射关系，避免每次都要遍历spanList
     // 在NewSpan中分配出去的时候记录pageId和span的映射关系
 #if defined(__LP64__) || defined(_WIN64) 
-    TCMalloc_PageMap3<64 - PAGE_SHIFT> _pageMap; // 记录pageId和span的映射关系
+    AtomicPageMap3<48 - Policy::kPageShift> _pageMap; // 记录pageId和span的映射关系, 用户态地址48位
+    AtomicPageMap3<48 - Policy::kPageShift, uint8_t> _classMap; // 每页一个字节的size class，释放时不用访问span
 #elif defined(__i386__) || defined(_WIN32) || defined(__x86_64__)
-    TCMalloc_PageMap2<32 - PAGE_SHIFT> _pageMap; // 记录pageId和span的映射关系
+    TCMalloc_PageMap2<32 - Policy::kPageShift> _pageMap; // 记录pageId和span的映射关系
+    AtomicPageMap3<32 - Policy::kPageShift, uint8_t, 8, 8> _classMap; // 每页一个字节的size class
 #else 
 #error "Unsupported architecture"
 #endif
@@ -0,0 +1,81 @@
+#pragma once
+#include "Common.h"
+
+/**
+ * 分配策略
+ * tc/cc/pc 和 SizeClass 都是以策略为参数的模板，策略决定：
+ *   kPageShift     页大小，右移kPageShift位得到页号
+ *   kMaxBytes      tc单次申请最大字节数
+ *   kMaxPages      pc中桶管理的最大span页数，也是一次向系统申请的页数
+ *   kFreeListNum   哈希桶中自由链表个数，等于SizeClassTable::kClassNum
+ *   SizeClassTable size class对齐规则
+ *   Lock           cc桶锁和pc锁的类型，InstrumentedLock<>统计竞争（LockStats.h）
+ *   kCollectStats  tc是否维护每个size class的分配/释放计数（MallocStats.h）
+ *
+ * 新增策略需要在 ThreadCache.cpp / CentralCache.cpp / PageCache.cpp 末尾显式实例化
+ */
+
+// 默认的size class表，控制内部碎片在10%左右
+// | size 范围 | 对齐数 | hash桶下标 |
+// | [1,128] | 8B | [0,16) |
+// | [128+1,1024] | 16B | [16,72) |
+// | [1024+1,8*1024] | 128B | [72,128) |
+// | [8*1024+1,64*1024] | 1024B | [128,184) |
+// | [64*1024+1,256*1024] | 8KB | [184,208) |
+struct DefaultSizeClassTable
+{
+    static const size_t kGroupNum = 5;
+    static const size_t kClassNum = 208;
+    static const size_t kMaxSize = 256 * 1024;
+
+    static const SizeClassGroup *Groups()
+    {
+        static const SizeClassGroup groups[kGroupNum] = {
+            {128, 3},
+            {1024, 4},
+            {8 * 1024, 7},
+            {64 * 1024, 10},
+            {256 * 1024, 13},
+        };
+        return groups;
+    }
+};
+
+// 4KB页，和大多数系统页一致，span粒度细、一次向系统申请512KB，适合内存受限的服务
+struct PagePolicy4K
+{
+    static const size_t kPageShift = 12;
+    static const size_t kMaxBytes = 256 * 1024;
+    static const size_t kMaxPages = 128;
+    static const size_t kFreeListNum = DefaultSizeClassTable::kClassNum;
+    typedef DefaultSizeClassTable SizeClassTable;
+    typedef std::mutex Lock;
+    static const bool kCollectStats = true;
+};
+
+// 8KB页（tcmalloc默认），同样的span页数能装更多小块，锁换成自旋锁，吞吐优先
+struct PagePolicy8K
+{
+    static const size_t kPageShift = 13;
+    static const size_t kMaxBytes = 256 * 1024;
+    static const size_t kMaxPages = 128;
+    static const size_t kFreeListNum = DefaultSizeClassTable::kClassNum;
+    typedef DefaultSizeClassTable SizeClassTable;
+    typedef SpinLock Lock;
+    static const bool kCollectStats = true;
+};
+
+// 和PagePolicy4K一样但不做tc计数，用于测量统计的开销
+struct PagePolicy4KNoStats : PagePolicy4K
+{
+    static const bool kCollectStats = false;
+};
+
+// 和PagePolicy4K一样，但cc桶锁和pc锁统计加锁次数、竞争次数和等待时间，用于找热点桶
+struct PagePolicy4KLockStats : PagePolicy4K
+{
+    typedef InstrumentedLock<std::mutex> Lock;
+};
+
+// ConcurrentAlloc/ConcurrentFree不指定策略时使用
+typedef PagePolicy4K DefaultPolicy;
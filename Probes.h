@@ -0,0 +1,53 @@
+#pragma once
+
+/**
+ * 慢路径上的USDT静态探针，provider是mempool
+ * 定义了MEMPOOL_USDT（CMake选项，默认打开）并且有<sys/sdt.h>（systemtap-sdt-dev，build-perf.sh会装）时，
+ * 每个探针编译成一条nop和一条ELF note，没有attach时不做任何事；perf/bpftrace attach后在nop处打断点。
+ * 否则宏为空，参数只求值不使用。快路径（自由链表非空的申请和释放）上没有探针。
+ *
+ *   探针              参数
+ *   tc_fetch          class, 块大小, 想要的块数, 实际拿到的块数      tc自由链表为空，从cc取一批
+ *   tc_list_too_long  class, 块大小, 还给cc的块数                    tc自由链表太长，还一批给cc
+ *   cc_get_span       class, 块大小, 页数                            cc没有可用的span，向pc要一个
+ *   cc_release_span   class, 块大小, 页数                            span的块全部还回来，交还给pc
+ *   pc_system_alloc   页数, 地址                                     pc没有足够大的空闲span，向系统申请
+ *   pc_coalesce       合并前页数, 合并后页数, 合并的次数             pc回收span并和空闲邻居合并
+ *
+ * 例子见 probes/ 下的脚本。
+ */
+
+#if defined(MEMPOOL_USDT) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define MEMPOOL_HAVE_USDT 1
+#endif
+#endif
+
+#ifdef MEMPOOL_HAVE_USDT
+#define MEMPOOL_PROBE2(name, a1, a2) DTRACE_PROBE2(mempool, name, a1, a2)
+#define MEMPOOL_PROBE3(name, a1, a2, a3) DTRACE_PROBE3(mempool, name, a1, a2, a3)
+#define MEMPOOL_PROBE4(name, a1, a2, a3, a4) DTRACE_PROBE4(mempool, name, a1, a2, a3, a4)
+#else
+#define MEMPOOL_PROBE2(name, a1, a2) \
+    do                               \
+    {                                \
+        (void)(a1);                  \
+        (void)(a2);                  \
+    } while (0)
+#define MEMPOOL_PROBE3(name, a1, a2, a3) \
+    do                                   \
+    {                                    \
+        (void)(a1);                      \
+        (void)(a2);                      \
+        (void)(a3);                      \
+    } while (0)
+#define MEMPOOL_PROBE4(name, a1, a2, a3, a4) \
+    do                                       \
+    {                                        \
+        (void)(a1);                          \
+        (void)(a2);                          \
+        (void)(a3);                          \
+        (void)(a4);                          \
+    } while (0)
+#endif
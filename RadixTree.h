@@ -1,7 +1,11 @@
+#pragma once
 // single level
 
 #include <cstdint>
 #include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <atomic>
 #include <assert.h>
 #include "ObjectPool.h"
 #include "Common.h"
@@ -125,6 +129,16 @@ public:
 		// Allocate enough to keep track of all possible pages
 		Ensure(0, 1 << BITS);
 	}
+
+	// 基数树元数据占用的字节数
+	size_t MemoryUsage() const {
+		size_t bytes = sizeof(root_);
+		for (int i = 0; i < ROOT_LENGTH; ++i) {
+			if (root_[i] != NULL)
+				bytes += sizeof(Leaf);
+		}
+		return bytes;
+	}
 };
 
 
@@ -200,4 +214,156 @@ public:
 		}
 		root_[i1]->values[i2]->values[i3] = v;
 	}
+
+	// 基数树元数据占用的字节数
+	size_t MemoryUsage() const {
+		size_t bytes = sizeof(root_);
+		for (int i = 0; i < ROOT_LENGTH; ++i) {
+			if (root_[i] == NULL)
+				continue;
+			bytes += sizeof(Middle);
+			for (int j = 0; j < MIDDLE_LENGTH; ++j) {
+				if (root_[i]->values[j] != NULL)
+					bytes += sizeof(Leaf);
+			}
+		}
+		return bytes;
+	}
+};
+
+
+/**
+ * 三层基数树（无锁读）
+ * TCMalloc_PageMap3 的叶子是 2^20 个指针（8MB），中间层也是 8MB，只要映射一页就要开 16MB 并 memset，
+ * 而且 set 写的是普通指针，ConcurrentFree 在别的线程里读，没有任何同步。
+ *
+ * 这里按真实的地址空间来切分：x86-64 用户态地址是 48 位，页号只有 48 - PAGE_SHIFT 位，
+ * 三层各取 12 位左右，每个叶子 2^12 个指针 = 32KB，覆盖 16MB 地址空间。
+ *
+ * 写（set）由调用者串行化（pc 中持有 _pageMtx），新节点先清零再用 release 发布；
+ * 读（get）全程 acquire 加载，不加锁，读到的节点一定是初始化完成的。
+ * 树存在期间节点从不释放，所以读者不会访问到被回收的节点；析构时（独立堆销毁）节点还给节点池。
+ */
+template <int BITS, class V = void*, int LEAF_BITS = 12, int MIDDLE_BITS = 12>
+class AtomicPageMap3 {
+private:
+	static const int ROOT_BITS = BITS - LEAF_BITS - MIDDLE_BITS;
+	static const int ROOT_LENGTH = 1 << ROOT_BITS;
+	static const int MIDDLE_LENGTH = 1 << MIDDLE_BITS;
+	static const int LEAF_LENGTH = 1 << LEAF_BITS;
+
+	static_assert(ROOT_BITS > 0, "BITS too small for AtomicPageMap3");
+
+	struct Leaf {
+		std::atomic<V> values[LEAF_LENGTH];
+	};
+
+	struct Middle {
+		std::atomic<Leaf*> leafs[MIDDLE_LENGTH];
+	};
+
+	std::atomic<Middle*> root_[ROOT_LENGTH];
+	std::atomic<size_t> _nodeBytes; // 已分配的中间层和叶子字节数
+
+public:
+	typedef uintptr_t Number;
+
+	explicit AtomicPageMap3() : _nodeBytes(0) {
+		for (int i = 0; i < ROOT_LENGTH; ++i) {
+			root_[i].store(nullptr, std::memory_order_relaxed);
+		}
+	}
+
+	// 调用者保证没有读者
+	~AtomicPageMap3() {
+		for (int i = 0; i < ROOT_LENGTH; ++i) {
+			Middle* middle = root_[i].load(std::memory_order_relaxed);
+			if (middle == nullptr) {
+				continue;
+			}
+			for (int j = 0; j < MIDDLE_LENGTH; ++j) {
+				Leaf* leaf = middle->leafs[j].load(std::memory_order_relaxed);
+				if (leaf != nullptr) {
+					LeafPool().Delete(leaf);
+				}
+			}
+			MiddlePool().Delete(middle);
+		}
+	}
+
+	V get(Number k) const {
+		if ((k >> BITS) > 0) {
+			return V();
+		}
+		const Number i1 = k >> (LEAF_BITS + MIDDLE_BITS);
+		const Number i2 = (k >> LEAF_BITS) & (MIDDLE_LENGTH - 1);
+		const Number i3 = k & (LEAF_LENGTH - 1);
+
+		Middle* middle = root_[i1].load(std::memory_order_acquire);
+		if (middle == nullptr) {
+			return V();
+		}
+		Leaf* leaf = middle->leafs[i2].load(std::memory_order_acquire);
+		if (leaf == nullptr) {
+			return V();
+		}
+		return leaf->values[i3].load(std::memory_order_acquire);
+	}
+
+	// 调用者保证写者互斥
+	void set(Number k, V v) {
+		if ((k >> BITS) > 0) {
+			fprintf(stderr, "AtomicPageMap3::set: %lu out of range\n", (unsigned long)k);
+			abort();
+		}
+		const Number i3 = k & (LEAF_LENGTH - 1);
+		EnsureLeaf(k)->values[i3].store(v, std::memory_order_release);
+	}
+
+	// 确保[start, start + n)的节点都已分配
+	void Ensure(Number start, size_t n) {
+		for (Number key = start; key < start + n;) {
+			EnsureLeaf(key);
+			key = ((key >> LEAF_BITS) + 1) << LEAF_BITS;
+		}
+	}
+
+	// 基数树元数据占用的字节数（根 + 已分配节点）
+	size_t MemoryUsage() const {
+		return sizeof(root_) + _nodeBytes.load(std::memory_order_relaxed);
+	}
+
+private:
+	// 节点池不析构：进程退出时默认pc的基数树还可能被其他静态对象的析构用到
+	static lockfree::ObjectPool<Middle>& MiddlePool() {
+		static lockfree::ObjectPool<Middle>* pool = new lockfree::ObjectPool<Middle>(true);
+		return *pool;
+	}
+
+	static lockfree::ObjectPool<Leaf>& LeafPool() {
+		static lockfree::ObjectPool<Leaf>* pool = new lockfree::ObjectPool<Leaf>(true);
+		return *pool;
+	}
+
+	Leaf* EnsureLeaf(Number k) {
+		const Number i1 = k >> (LEAF_BITS + MIDDLE_BITS);
+		const Number i2 = (k >> LEAF_BITS) & (MIDDLE_LENGTH - 1);
+
+		Middle* middle = root_[i1].load(std::memory_order_relaxed);
+		if (middle == nullptr) {
+			middle = MiddlePool().New();
+			memset((void*)middle, 0, sizeof(*middle));
+			_nodeBytes.fetch_add(sizeof(Middle), std::memory_order_relaxed);
+			root_[i1].store(middle, std::memory_order_release); // 初始化完成后再发布
+		}
+
+		Leaf* leaf = middle->leafs[i2].load(std::memory_order_relaxed);
+		if (leaf == nullptr) {
+			leaf = LeafPool().New();
+			memset((void*)leaf, 0, sizeof(*leaf));
+			_nodeBytes.fetch_add(sizeof(Leaf), std::memory_order_relaxed);
+			middle->leafs[i2].store(leaf, std::memory_order_release);
+		}
+		return leaf;
+	}
 };
@@ -0,0 +1,158 @@
+#pragma once
+#include <new>
+#include <utility>
+#include "Common.h"
+#include "Policy.h"
+#include "PageCache.h"
+
+/**
+ * 单调（bump）分配的内存区域
+ * 从PageCache<Policy>申请span，在span里顺序切分，不支持单个释放；
+ * 一批同生共死的临时对象用完后Release()一次把所有span还给pc，不用逐个ConcurrentFree。
+ * GetMark()记录检查点，Rewind(mark)丢掉检查点之后分配的所有内存，Scope是它的RAII形式，可以嵌套。
+ *
+ * 不是线程安全的，一个Region只给一个线程用；New出来的对象不会调用析构函数。
+ */
+template <class Policy = DefaultPolicy>
+class Region
+{
+public:
+    static const size_t kAlign = 16;        // 默认对齐
+    static const size_t kMinSpanPages = 16; // 第一个span的页数，之后翻倍，最多Policy::kMaxPages页
+
+    // 检查点：当时正在切的span和切到的位置
+    struct Mark
+    {
+        Span *span;
+        char *cur;
+    };
+
+    // 作用域结束时回到进入时的检查点
+    class Scope
+    {
+    public:
+        explicit Scope(Region &region) : _region(region), _mark(region.GetMark()) {}
+        ~Scope() { _region.Rewind(_mark); }
+        Scope(const Scope &) = delete;
+        Scope &operator=(const Scope &) = delete;
+
+    private:
+        Region &_region;
+        Mark _mark;
+    };
+
+    Region() {}
+    Region(const Region &) = delete;
+    Region &operator=(const Region &) = delete;
+
+    ~Region()
+    {
+        Release();
+    }
+
+    // 申请size字节，align必须是2的幂
+    void *Allocate(size_t size, size_t align = kAlign)
+    {
+        char *p = (char *)(((uintptr_t)_cur + align - 1) & ~(uintptr_t)(align - 1));
+        if (_cur == nullptr || p + size > _end)
+        {
+            NewSpan(size + align);
+            p = (char *)(((uintptr_t)_cur + align - 1) & ~(uintptr_t)(align - 1));
+        }
+        _cur = p + size;
+        return p;
+    }
+
+    // 申请并构造一个T，析构函数不会被调用
+    template <class T, class... Args>
+    T *New(Args &&...args)
+    {
+        return new (Allocate(sizeof(T), alignof(T) > kAlign ? alignof(T) : kAlign)) T(std::forward<Args>(args)...);
+    }
+
+    Mark GetMark()
+    {
+        Mark mark = {_spans.Empty() ? nullptr : _spans.Begin(), _cur};
+        return mark;
+    }
+
+    // 丢掉mark之后分配的内存：之后申请的span还给pc，回到mark时的位置
+    // 嵌套的检查点要按后进先出的顺序Rewind
+    void Rewind(const Mark &mark)
+    {
+        if (_spans.Empty() || _spans.Begin() == mark.span)
+        {
+            _cur = mark.cur;
+            return;
+        }
+
+        PageCache<Policy> *pc = PageCache<Policy>::GetInstance();
+        std::lock_guard<typename Policy::Lock> lock(pc->_pageMtx);
+        // 新span在链表头部，一直还到mark时的span
+        while (!_spans.Empty() && _spans.Begin() != mark.span)
+        {
+            Span *span = _spans.PopFront();
+            _bytes -= span->_n << Policy::kPageShift;
+            pc->ReleaseSpanToPageCache(span);
+        }
+        if (mark.span == nullptr)
+        {
+            _cur = _end = nullptr;
+        }
+        else
+        {
+            _cur = mark.cur;
+            _end = SpanEnd(mark.span);
+        }
+    }
+
+    // 所有span一次还给pc
+    void Release()
+    {
+        Mark empty = {nullptr, nullptr};
+        Rewind(empty);
+        _nextPages = kMinSpanPages;
+    }
+
+    // 持有的span字节数
+    size_t Bytes() const { return _bytes; }
+
+private:
+    static char *SpanEnd(Span *span)
+    {
+        return (char *)((span->_pageId + span->_n) << Policy::kPageShift);
+    }
+
+    // 申请一个至少bytes字节的新span，切换到新span上
+    void NewSpan(size_t bytes)
+    {
+        size_t k = (bytes + (1 << Policy::kPageShift) - 1) >> Policy::kPageShift;
+        if (k > Policy::kMaxPages)
+        {
+            throw std::bad_alloc(); // 超过pc桶最大页数的申请不走Region
+        }
+        if (k < _nextPages)
+            k = _nextPages;
+        if (_nextPages < Policy::kMaxPages)
+            _nextPages = _nextPages * 2 > Policy::kMaxPages ? Policy::kMaxPages : _nextPages * 2;
+
+        PageCache<Policy> *pc = PageCache<Policy>::GetInstance();
+        Span *span;
+        {
+            std::lock_guard<typename Policy::Lock> lock(pc->_pageMtx);
+            span = pc->NewSpan(k);
+            pc->ClearSpanSizeClass(span); // span可能之前被cc切过，清掉旧的size class
+        }
+        _spans.PushFront(span);
+        _bytes += span->_n << Policy::kPageShift;
+        _cur = (char *)(span->_pageId << Policy::kPageShift);
+        _end = SpanEnd(span);
+    }
+
+private:
+    SpanList<> _spans;                 // 持有的span，最新的在头部
+    char *_cur = nullptr;              // 当前span中下一个可用地址
+    char *_end = nullptr;              // 当前span的结尾
+    size_t _bytes = 0;                 // 持有的span字节数
+    size_t _nextPages = kMinSpanPages; // 下一个span的页数
+};
@@ -0,0 +1,238 @@
+#pragma once
+#include <new>
+#include "Common.h"
+#include "Policy.h"
+#include "PageCache.h"
+
+// 一个SlabCache的统计，GetStats填写
+struct SlabCacheStats
+{
+    size_t slabs = 0;          // 当前持有的slab（span）个数
+    size_t slabPages = 0;      // slab一共占用的页数
+    size_t objectsPerSlab = 0; // 每个slab能放的对象数
+    size_t inUse = 0;          // 已经分出去的对象数
+    size_t retained = 0;       // 构造好、在cache里等着复用的对象数
+    size_t allocs = 0;         // 累计Alloc次数
+    size_t frees = 0;          // 累计Free次数
+    size_t constructs = 0;     // 累计构造函数调用次数
+    size_t destructs = 0;      // 累计析构函数调用次数
+};
+
+/**
+ * kmem_cache风格的对象缓存
+ * 对象只在slab创建时构造一次，Free时不析构，保持构造好的状态留在slab里，下次Alloc直接复用，
+ * 省掉持有锁、缓冲区、预分配vector这类重对象每次复用的构造/析构开销。
+ * Free时可选调用reset回调，把对象恢复到可复用的状态（清空缓冲区等）。
+ * 只有Shrink释放空slab或者SlabCache析构时才会调用析构函数。
+ *
+ * slab是从PageCache<Policy>直接申请的span，开头是slab头和空闲下标栈，后面是对象数组。
+ * 空闲对象不能像自由链表那样把next写在对象里（会破坏构造好的对象），所以用下标栈记录。
+ * slab的页不是cc切出来的小块，不能交给ConcurrentFree释放。
+ */
+template <class T, class Policy = DefaultPolicy>
+class SlabCache
+{
+public:
+    typedef void (*ResetFunc)(T *);
+
+    // reset: Free时对对象调用，可以为空
+    explicit SlabCache(ResetFunc reset = nullptr)
+        : _reset(reset)
+    {
+        // 一个slab至少放kMinObjects个对象，且不小于kSlabBytes，不超过pc桶的最大页数
+        size_t bytes = sizeof(SlabHeader) + kMinObjects * (sizeof(T) + sizeof(uint32_t)) + alignof(T);
+        if (bytes < kSlabBytes)
+            bytes = kSlabBytes;
+        _slabPages = (bytes + (1 << Policy::kPageShift) - 1) >> Policy::kPageShift;
+        if (_slabPages > Policy::kMaxPages)
+            _slabPages = Policy::kMaxPages;
+
+        // 每个对象占sizeof(T)字节加一个下标栈槽位
+        size_t slabBytes = _slabPages << Policy::kPageShift;
+        _objectsPerSlab = (slabBytes - sizeof(SlabHeader) - alignof(T)) / (sizeof(T) + sizeof(uint32_t));
+        assert(_objectsPerSlab > 0);
+        _objectOffset = RoundUpTo(sizeof(SlabHeader) + _objectsPerSlab * sizeof(uint32_t), alignof(T));
+    }
+
+    SlabCache(const SlabCache &) = delete;
+    SlabCache &operator=(const SlabCache &) = delete;
+
+    // 析构所有对象，slab还给pc；调用者保证分出去的对象都已经Free
+    ~SlabCache()
+    {
+        ReleaseSlabs(_partial, true);
+        ReleaseSlabs(_full, true);
+    }
+
+    // 取一个构造好的对象
+    T *Alloc()
+    {
+        std::lock_guard<typename Policy::Lock> lock(_mtx);
+        if (_partial.Empty())
+        {
+            _partial.PushFront(NewSlab());
+        }
+
+        Span *slab = _partial.Begin();
+        SlabHeader *header = Header(slab);
+        uint32_t idx = header->freeIdx[--header->nfree];
+        slab->use_count++;
+        if (header->nfree == 0)
+        {
+            _partial.Erase(slab);
+            _full.PushFront(slab);
+        }
+
+        _inUse++;
+        _allocs++;
+        return Object(slab, idx);
+    }
+
+    // 还回一个对象，不析构，对象保持构造好的状态
+    void Free(T *obj)
+    {
+        if (obj == nullptr)
+            return;
+
+        // reset在锁外执行，可能比较慢
+        if (_reset != nullptr)
+            _reset(obj);
+
+        // 页号->span基数树无锁
+        Span *slab = PageCache<Policy>::GetInstance()->MapObjectToSpan(obj);
+        std::lock_guard<typename Policy::Lock> lock(_mtx);
+        SlabHeader *header = Header(slab);
+        assert(header->cache == this);
+        uint32_t idx = (uint32_t)(((char *)obj - ((char *)header + _objectOffset)) / sizeof(T));
+        header->freeIdx[header->nfree++] = idx;
+        slab->use_count--;
+        if (header->nfree == 1) // 之前是满的
+        {
+            _full.Erase(slab);
+            _partial.PushFront(slab);
+        }
+
+        _inUse--;
+        _frees++;
+    }
+
+    // 析构空slab中的对象并把slab还给pc，返回释放的页数
+    size_t Shrink()
+    {
+        std::lock_guard<typename Policy::Lock> lock(_mtx);
+        return ReleaseSlabs(_partial, false);
+    }
+
+    void GetStats(SlabCacheStats &stats)
+    {
+        std::lock_guard<typename Policy::Lock> lock(_mtx);
+        stats = SlabCacheStats();
+        stats.slabs = _slabs;
+        stats.slabPages = _slabs * _slabPages;
+        stats.objectsPerSlab = _objectsPerSlab;
+        stats.inUse = _inUse;
+        stats.retained = _slabs * _objectsPerSlab - _inUse;
+        stats.allocs = _allocs;
+        stats.frees = _frees;
+        stats.constructs = _constructs;
+        stats.destructs = _destructs;
+    }
+
+private:
+    static const size_t kMinObjects = 8;        // 每个slab最少的对象数
+    static const size_t kSlabBytes = 64 * 1024; // slab的目标字节数
+
+    struct SlabHeader
+    {
+        SlabCache *cache;  // 所属cache，用于检查误用
+        size_t nfree;      // 空闲下标栈的元素个数
+        uint32_t freeIdx[1]; // 空闲对象下标栈，实际长度_objectsPerSlab
+    };
+
+    static size_t RoundUpTo(size_t n, size_t align)
+    {
+        return (n + align - 1) / align * align;
+    }
+
+    SlabHeader *Header(Span *slab) const
+    {
+        return (SlabHeader *)(slab->_pageId << Policy::kPageShift);
+    }
+
+    T *Object(Span *slab, size_t idx) const
+    {
+        return (T *)((char *)Header(slab) + _objectOffset) + idx;
+    }
+
+    // 从pc申请一个slab并构造所有对象，调用者持有_mtx
+    Span *NewSlab()
+    {
+        PageCache<Policy> *pc = PageCache<Policy>::GetInstance();
+        pc->_pageMtx.lock();
+        Span *slab = pc->NewSpan(_slabPages);
+        slab->_objSize = sizeof(T);
+        pc->ClearSpanSizeClass(slab); // span可能之前被cc切过，清掉旧的size class
+        pc->_pageMtx.unlock();
+
+        slab->use_count = 0;
+        SlabHeader *header = Header(slab);
+        header->cache = this;
+        header->nfree = _objectsPerSlab;
+        // 下标倒序入栈，先分出低地址的对象
+        for (size_t i = 0; i < _objectsPerSlab; ++i)
+        {
+            header->freeIdx[i] = (uint32_t)(_objectsPerSlab - 1 - i);
+            new (Object(slab, i)) T;
+        }
+
+        _slabs++;
+        _constructs += _objectsPerSlab;
+        return slab;
+    }
+
+    // 析构list中slab的所有对象并还给pc，all为false时只处理没有对象在用的slab
+    size_t ReleaseSlabs(SpanList<> &list, bool all)
+    {
+        size_t pages = 0;
+        Span *slab = list.Begin();
+        while (slab != list.End())
+        {
+            Span *next = slab->_next;
+            if (all || slab->use_count == 0)
+            {
+                list.Erase(slab);
+                for (size_t i = 0; i < _objectsPerSlab; ++i)
+                {
+                    Object(slab, i)->~T();
+                }
+                _destructs += _objectsPerSlab;
+                _slabs--;
+                pages += slab->_n;
+
+                PageCache<Policy> *pc = PageCache<Policy>::GetInstance();
+                pc->_pageMtx.lock();
+                pc->ReleaseSpanToPageCache(slab);
+                pc->_pageMtx.unlock();
+            }
+            slab = next;
+        }
+        return pages;
+    }
+
+private:
+    typename Policy::Lock _mtx;
+    ResetFunc _reset;
+    size_t _slabPages;      // 每个slab的页数
+    size_t _objectsPerSlab; // 每个slab的对象数
+    size_t _objectOffset;   // 对象数组相对slab起始地址的偏移
+
+    SpanList<> _partial; // 还有空闲对象的slab
+    SpanList<> _full;    // 对象全部分出去的slab
+
+    size_t _slabs = 0;
+    size_t _inUse = 0;
+    size_t _allocs = 0;
+    size_t _frees = 0;
+    size_t _constructs = 0;
+    size_t _destructs = 0;
+};
@@ -1,12 +1,25 @@
 #include "ThreadCache.h"
 #include "CentralCache.h"
+#include "Probes.h"
 
-void *ThreadCache::Allocate(size_t size)
+template <class Policy>
+ThreadCache<Policy>::ThreadCache(CentralCache<Policy> *centralCache)
+    : _centralCache(centralCache != nullptr ? centralCache : CentralCache<Policy>::GetInstance())
 {
-    assert(size <= MAX_BYTES);
+    _centralCache->RegisterThreadCache(this); // MallocStats汇总时遍历
+}
+
+template <class Policy>
+void *ThreadCache<Policy>::Allocate(size_t size)
+{
+    assert(size <= Policy::kMaxBytes);
 
-    size_t alignSize = SizeClass::RoundUp(size);
-    size_t index = SizeClass::Index(alignSize);
+    size_t alignSize = SizeClass<Policy>::RoundUp(size);
+    size_t index = SizeClass<Policy>::Index(alignSize);
+    if(Policy::kCollectStats){
+        Bump(_counters[index].allocs);
+        Bump(_counters[index].requested, size);
+    }
 
     if(!_freeLists[index].Empty()){
         return _freeLists[index].Pop(); // 直接从自由链表获取空间
@@ -15,12 +28,16 @@ void *ThreadCache::Allocate(size_t size)
     }
 }
 
-void ThreadCache::Deallocate(void *ptr, size_t alignSize)
+template <class Policy>
+void ThreadCache<Policy>::Deallocate(void *ptr, size_t alignSize)
 {
     assert(ptr);    // 回收空间不能为空
-    assert(alignSize <= MAX_BYTES); // 回收空间不能超过256KB, alignSize 已经对齐过
+    assert(alignSize <= Policy::kMaxBytes); // 回收空间不能超过kMaxBytes, alignSize 已经对齐过
 
-    size_t index = SizeClass::Index(alignSize); // 找到对应的桶
+    size_t index = SizeClass<Policy>::Index(alignSize); // 找到对应的桶
+    if(Policy::kCollectStats){
+        Bump(_counters[index].frees);
+    }
     _freeLists[index].Push(ptr); // 将空间返回给自由链表
 
     if(_freeLists[index].Size() >= _freeLists[index].MaxSize()){
@@ -28,14 +45,16 @@ void ThreadCache::Deallocate(void *ptr, size_t alignSize)
     }
 }
 
-void* ThreadCache::FetchFromCentralCache(size_t index, size_t alignSize)
+template <class Policy>
+void* ThreadCache<Policy>::FetchFromCentralCache(size_t index, size_t alignSize)
 {
     // 实现SizeClass::NumMoveSize(size)后，再实现
     // 获取需要从cc获取的块数
-    size_t batchNum = std::min(_freeLists[index].MaxSize(), SizeClass::NumMoveSize(alignSize));
+    size_t batchNum = std::min(_freeLists[index].MaxSize(), SizeClass<Policy>::NumMoveSize(alignSize));
 
     // 反馈调节算法，如果当前块数达到上限，则下次多给一块
-    if(batchNum == _freeLists[index].MaxSize()){
+    size_t maxFreeList = AllocTunables::Get().maxFreeListSize.load(std::memory_order_relaxed);
+    if(batchNum == _freeLists[index].MaxSize() && (maxFreeList == 0 || batchNum < maxFreeList)){
         _freeLists[index].MaxSize() += 1;
     }
 
@@ -43,9 +62,13 @@ void* ThreadCache::FetchFromCentralCache(size_t index, size_t alignSize)
     void* start = nullptr;
     void* end = nullptr;
 
-    size_t actualNum = CentralCache::GetInstance()->FetchRangeObj(start, end, batchNum, alignSize);
+    size_t actualNum = _centralCache->FetchRangeObj(start, end, batchNum, alignSize);
     // 根据actualNum决定后续操作
     assert(actualNum >= 1);
+    MEMPOOL_PROBE4(tc_fetch, index, alignSize, batchNum, actualNum);
+    if(Policy::kCollectStats){
+        Bump(_counters[index].fetched, actualNum);
+    }
 
     if(actualNum == 1){ // 如果只取到一块，则直接返回
         assert(start == end);
@@ -58,13 +81,25 @@ void* ThreadCache::FetchFromCentralCache(size_t index, size_t alignSize)
     return start;
 }
 
-void ThreadCache::ListTooLong(FreeList& list, size_t alignSize)
+template <class Policy>
+void ThreadCache<Policy>::ListTooLong(FreeList& list, size_t alignSize)
 {
     void* start = nullptr;
     void* end = nullptr;
 
-    list.PopRange(start, end, list.MaxSize());
+    size_t n = list.MaxSize();
+    list.PopRange(start, end, n);
+    MEMPOOL_PROBE3(tc_list_too_long, SizeClass<Policy>::Index(alignSize), alignSize, n);
+    if(Policy::kCollectStats){
+        Bump(_counters[SizeClass<Policy>::Index(alignSize)].returned, n);
+    }
 
-    CentralCache::GetInstance()->ReleaseListToSpans(start, alignSize); // 不需要传end， 因为popRange保证后面是空，所以只需要判断nex是不是k |
+    _centralCache->ReleaseListToSpans(start, alignSize); // 不需要传end， 因为popRange保证后面是空，所以只需要判断nex是不是k |
 
 }
+
+// 显式实例化所有策略
+template class ThreadCache<PagePolicy4K>;
+template class ThreadCache<PagePolicy8K>;
+template class ThreadCache<PagePolicy4KNoStats>;
+template class ThreadCache<PagePolicy4KLockStats>;
@@ -1,12 +1,29 @@
 #pragma once
 
 #include "Common.h"
+#include "Policy.h"
 
 
+template <class Policy>
+class CentralCache;
 
+// tc中一个size class的计数，只有所属线程写，MallocStats在别的线程用relaxed读
+struct ThreadClassCounters
+{
+    std::atomic<size_t> allocs{0};   // Allocate次数
+    std::atomic<size_t> requested{0}; // Allocate申请的字节数之和（对齐前），估计内部碎片
+    std::atomic<size_t> frees{0};    // Deallocate次数
+    std::atomic<size_t> fetched{0};  // 从cc取来的块数
+    std::atomic<size_t> returned{0}; // 还给cc的块数
+};
+
+template <class Policy>
 class ThreadCache
 {
 public:
+    // centralCache为空时使用进程默认的cc
+    explicit ThreadCache(CentralCache<Policy> *centralCache = nullptr);
+
     // 线程分配size大小的空间
     void *Allocate(size_t size);             
     // 线程回收ptr指向的size大小的空间
@@ -17,11 +34,36 @@ public:
 
     // 向cc归还空间List桶中的空间
     void ListTooLong(FreeList& list, size_t alignSize);
-private:
-    FreeList _freeLists[FREE_LIST_NUM ]; // 每个桶表示一个自由链表
-};
 
+    // 堆采样倒计时，减去这次申请的字节数，返回true表示用完了，交给HeapProfiler
+    bool SampleCountdown(size_t size)
+    {
+        _bytesUntilSample -= (ptrdiff_t)size;
+        return _bytesUntilSample < 0;
+    }
 
-// TLS的全局对象指针，每个线程独立
-static __thread ThreadCache *pTLSThreadCache = nullptr; //注意需要是static， 否则会有链接错误
+    void SetBytesUntilSample(ptrdiff_t bytes) { _bytesUntilSample = bytes; }
+
+    // index号桶的计数，可以在别的线程调用
+    const ThreadClassCounters &Counters(size_t index) const
+    {
+        return _counters[index];
+    }
+
+    // TLS的对象指针，每个线程、每种策略独立
+    static __thread ThreadCache *pTLSThreadCache;
+private:
+    // 只有所属线程写，普通的load + store，不用带lock前缀的原子加
+    static void Bump(std::atomic<size_t> &counter, size_t n = 1)
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    ptrdiff_t _bytesUntilSample = 0;           // 距离下一次堆采样的字节数，初始为0让第一次分配去读采样间隔
+    CentralCache<Policy> *_centralCache;       // 从这个cc取块、还块
+    FreeList _freeLists[Policy::kFreeListNum]; // 每个桶表示一个自由链表
+    ThreadClassCounters _counters[Policy::kCollectStats ? Policy::kFreeListNum : 1];
+};
 
+template <class Policy>
+__thread ThreadCache<Policy> *ThreadCache<Policy>::pTLSThreadCache = nullptr;
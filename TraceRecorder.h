@@ -0,0 +1,295 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <mutex>
+#include <vector>
+#include <unordered_map>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/**
+ * 分配轨迹记录
+ * 编译时定义MEMPOOL_TRACE（CMake选项MEMPOOL_TRACE）后，ConcurrentAlloc/ConcurrentFree在StartAllocTrace之后
+ * 把每次调用记成一条{时间戳, 地址, 大小, 线程, 操作}写进内存映射的文件；没有定义时钩子完全不存在。
+ *
+ * 文件 = TraceHeader + capacity条TraceRecord。每个线程一次用原子加预留kBlockRecords条，
+ * 之后在自己的块里顺序写，不和其他线程竞争；预留了没写完的记录全是0（op为0），读取时跳过。
+ * 文件按capacity一次ftruncate，是稀疏文件，只有写过的部分占磁盘。
+ * 超过capacity的记录丢弃并计数。StopAllocTrace后映射不unmap，避免还在写的线程访问已经释放的内存。
+ *
+ * 地址在一次申请和它的释放之间是唯一的，trace_replay按时间戳把地址换成对象编号再回放。
+ */
+
+enum TraceOp : uint8_t
+{
+    kTraceNone = 0, // 预留了但没有写
+    kTraceAlloc = 1,
+    kTraceFree = 2,
+};
+
+struct TraceRecord
+{
+    uint64_t timestampNs; // 从StartAllocTrace开始的纳秒数
+    uint64_t address;
+    uint32_t size;        // 申请的字节数，释放时为0
+    uint16_t thread;      // 线程编号，按第一次记录的先后从0开始
+    uint8_t op;           // TraceOp
+    uint8_t reserved;
+};
+static_assert(sizeof(TraceRecord) == 24, "trace record layout");
+
+struct TraceHeader
+{
+    static const uint32_t kVersion = 1;
+
+    char magic[8];          // "MPTRACE\0"
+    uint32_t version;
+    uint32_t recordSize;    // sizeof(TraceRecord)
+    uint64_t capacity;      // 文件中的记录条数
+    uint64_t reserved;      // 预留出去的记录条数（StopAllocTrace时写入）
+    uint64_t dropped;       // 超过capacity丢弃的记录条数
+    uint32_t threads;       // 出现过的线程数
+    uint32_t pad;
+};
+
+class AllocTrace
+{
+public:
+    static const size_t kBlockRecords = 4096; // 每个线程一次预留的记录条数
+
+#ifdef MEMPOOL_TRACE
+    static const bool kCompiledIn = true;
+#else
+    static const bool kCompiledIn = false;
+#endif
+
+    static AllocTrace &Get()
+    {
+        static AllocTrace *inst = new AllocTrace; // 不析构
+        return *inst;
+    }
+
+    // 开始记录到path，最多capacity条；已经在记录时返回false
+    bool Start(const char *path, size_t capacity)
+    {
+        std::lock_guard<std::mutex> lock(_mtx);
+        if (_active.load(std::memory_order_relaxed))
+            return false;
+        capacity = (capacity + kBlockRecords - 1) / kBlockRecords * kBlockRecords;
+        size_t bytes = sizeof(TraceHeader) + capacity * sizeof(TraceRecord);
+
+        int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
+            return false;
+        if (ftruncate(fd, (off_t)bytes) != 0)
+        {
+            close(fd);
+            return false;
+        }
+        void *map = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (map == MAP_FAILED)
+            return false;
+
+        _header = (TraceHeader *)map;
+        memcpy(_header->magic, "MPTRACE", 8);
+        _header->version = TraceHeader::kVersion;
+        _header->recordSize = sizeof(TraceRecord);
+        _header->capacity = capacity;
+        _records = (TraceRecord *)((char *)map + sizeof(TraceHeader));
+        _bytes = bytes;
+        _capacity = capacity;
+        _next.store(0, std::memory_order_relaxed);
+        _dropped.store(0, std::memory_order_relaxed);
+        _threads.store(0, std::memory_order_relaxed);
+        _start = std::chrono::steady_clock::now();
+        _generation.fetch_add(1, std::memory_order_relaxed);
+        _active.store(true, std::memory_order_release);
+        return true;
+    }
+
+    // 停止记录，写入文件头并刷盘，返回记录的条数上限（包含没写完的预留）
+    size_t Stop()
+    {
+        std::lock_guard<std::mutex> lock(_mtx);
+        if (!_active.load(std::memory_order_relaxed))
+            return 0;
+        _active.store(false, std::memory_order_release);
+        size_t reserved = std::min(_next.load(std::memory_order_relaxed), _capacity);
+        _header->reserved = reserved;
+        _header->dropped = _dropped.load(std::memory_order_relaxed);
+        _header->threads = _threads.load(std::memory_order_relaxed);
+        msync(_header, _bytes, MS_SYNC);
+        return reserved;
+    }
+
+    bool Active() const
+    {
+        return _active.load(std::memory_order_relaxed);
+    }
+
+    void Record(TraceOp op, void *ptr, size_t size)
+    {
+        if (!_active.load(std::memory_order_acquire))
+            return;
+        static __thread TLSState tls = {0, 0, nullptr, nullptr}; // inline成员函数里的静态变量全程序只有一份
+        size_t generation = _generation.load(std::memory_order_relaxed);
+        if (tls.generation != generation)
+        {
+            tls.generation = generation;
+            tls.thread = (uint16_t)_threads.fetch_add(1, std::memory_order_relaxed);
+            tls.cur = tls.end = nullptr;
+        }
+        if (tls.cur == tls.end)
+        {
+            size_t first = _next.fetch_add(kBlockRecords, std::memory_order_relaxed);
+            if (first + kBlockRecords > _capacity)
+            {
+                _dropped.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+            tls.cur = _records + first;
+            tls.end = tls.cur + kBlockRecords;
+        }
+        TraceRecord *r = tls.cur++;
+        r->timestampNs = (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - _start).count();
+        r->address = (uint64_t)(uintptr_t)ptr;
+        r->size = (uint32_t)size;
+        r->thread = tls.thread;
+        r->reserved = 0;
+        r->op = op; // 最后写op，没写完的记录读出来op为0
+    }
+
+private:
+    AllocTrace() {}
+
+    struct TLSState
+    {
+        size_t generation; // 对应哪一次Start，0表示没有
+        uint16_t thread;
+        TraceRecord *cur;
+        TraceRecord *end;
+    };
+
+    std::mutex _mtx; // 保护Start/Stop
+    std::atomic<bool> _active{false};
+    std::atomic<size_t> _generation{0};
+    std::atomic<size_t> _next{0};    // 下一条要预留的记录
+    std::atomic<size_t> _dropped{0};
+    std::atomic<size_t> _threads{0};
+    TraceHeader *_header = nullptr;
+    TraceRecord *_records = nullptr;
+    size_t _bytes = 0;
+    size_t _capacity = 0;
+    std::chrono::steady_clock::time_point _start;
+};
+
+// 开始记录ConcurrentAlloc/ConcurrentFree，需要编译时定义MEMPOOL_TRACE，否则返回false
+inline bool StartAllocTrace(const char *path, size_t capacity = 16 * 1024 * 1024)
+{
+    return AllocTrace::kCompiledIn && AllocTrace::Get().Start(path, capacity);
+}
+
+inline size_t StopAllocTrace()
+{
+    return AllocTrace::Get().Stop();
+}
+
+// 读入轨迹文件中写完的记录，格式不对返回false
+inline bool LoadAllocTrace(const char *path, TraceHeader &header, std::vector<TraceRecord> &records)
+{
+    records.clear();
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    bool ok = fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(TraceHeader);
+    void *map = ok ? mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (map == MAP_FAILED)
+        return false;
+
+    memcpy(&header, map, sizeof(header));
+    ok = memcmp(header.magic, "MPTRACE", 8) == 0 && header.version == TraceHeader::kVersion &&
+         header.recordSize == sizeof(TraceRecord) && header.reserved <= header.capacity &&
+         sizeof(TraceHeader) + header.capacity * sizeof(TraceRecord) <= (size_t)st.st_size;
+    if (ok)
+    {
+        const TraceRecord *r = (const TraceRecord *)((const char *)map + sizeof(TraceHeader));
+        for (size_t i = 0; i < header.reserved; ++i)
+        {
+            if (r[i].op == kTraceAlloc || r[i].op == kTraceFree)
+                records.push_back(r[i]);
+        }
+    }
+    munmap(map, st.st_size);
+    return ok;
+}
+
+// 回放用的一次操作，地址已经换成对象编号
+struct ReplayOp
+{
+    uint32_t object;
+    uint32_t size; // 释放时为0
+    uint8_t op;    // TraceOp
+};
+
+struct ReplayPlan
+{
+    std::vector<std::vector<ReplayOp> > threads; // 按原来的线程分组，组内保持原来的顺序
+    std::vector<uint32_t> objectSizes;          // 对象编号 -> 申请的字节数
+    std::vector<uint32_t> leaked;               // 轨迹结束时还没释放的对象，回放结束后统一释放
+    size_t unmatchedFrees = 0;                  // 释放的对象在开始记录之前申请，回放时跳过
+    size_t peakLiveBytes = 0;                   // 按时间顺序算的最大存活申请字节数
+};
+
+// 按时间戳排序后把地址换成对象编号：同一个地址在释放后再次申请是新的对象
+inline void BuildReplayPlan(std::vector<TraceRecord> &records, ReplayPlan &plan)
+{
+    plan = ReplayPlan();
+    std::stable_sort(records.begin(), records.end(), [](const TraceRecord &a, const TraceRecord &b)
+                     { return a.timestampNs < b.timestampNs; });
+    std::unordered_map<uint64_t, uint32_t> live; // 地址 -> 对象编号
+    size_t liveBytes = 0;
+    for (const TraceRecord &r : records)
+    {
+        if (r.thread >= plan.threads.size())
+            plan.threads.resize(r.thread + 1);
+        ReplayOp op = {0, 0, r.op};
+        if (r.op == kTraceAlloc)
+        {
+            op.object = (uint32_t)plan.objectSizes.size();
+            op.size = r.size;
+            plan.objectSizes.push_back(r.size);
+            auto it = live.find(r.address);
+            if (it != live.end()) // 释放记录被丢弃了，旧对象当作泄漏
+            {
+                plan.leaked.push_back(it->second);
+                liveBytes -= plan.objectSizes[it->second];
+            }
+            live[r.address] = op.object;
+            liveBytes += r.size;
+            plan.peakLiveBytes = std::max(plan.peakLiveBytes, liveBytes);
+        }
+        else
+        {
+            auto it = live.find(r.address);
+            if (it == live.end())
+            {
+                plan.unmatchedFrees++;
+                continue;
+            }
+            op.object = it->second;
+            liveBytes -= plan.objectSizes[it->second];
+            live.erase(it);
+        }
+        plan.threads[r.thread].push_back(op);
+    }
+    for (auto &kv : live)
+        plan.leaked.push_back(kv.second);
+}
@@ -1,5 +1,17 @@
 #include "ConcurrentAlloc.h"
+#include "SlabCache.h"
+#include "Region.h"
+#include "Heap.h"
+#include "NumaAlloc.h"
+#include "MallocStats.h"
+#include "LockStats.h"
+#include "Fragmentation.h"
 #include <thread>
+#include <random>
+#include <algorithm>
+#include <cstring>
+#include <chrono>
+#include <sys/wait.h>
 
 void Alloc1(){
     // 两个线程调用ConcurrentAlloc，
@@ -96,9 +108,933 @@ void ConcurrentAllocTest2(){
     cout << "end ConcurrentAllocTest2" << endl;
 }
 
+// 把堆切碎再全部释放，检查能否合并回完整的大块
+// 需要在其他测试之前运行，这时pc中还没有被cc占用的span
+template <class Policy>
+void PageCacheCoalesceTest(){
+    cout << "start PageCacheCoalesceTest<" << (1 << Policy::kPageShift) << ">" << endl;
+    typedef PageCache<Policy> PC;
+    const size_t PAGE_NUM = PC::PAGE_NUM;
+    PC* pc = PC::GetInstance();
+    std::mt19937 rng(2024);
+    std::vector<Span*> spans;
+
+    std::unique_lock<typename Policy::Lock> lock(pc->_pageMtx);
+
+    // 申请随机页数的span，直到用掉至少32个128页的大块
+    size_t pages = 0;
+    while(pages < 32 * (PAGE_NUM - 1)){
+        size_t k = rng() % (PAGE_NUM - 1) + 1;
+        spans.push_back(pc->NewSpan(k));
+        pages += k;
+    }
+
+    // 随机释放一半，再申请一些小span，制造碎片
+    for(int round = 0; round < 4; ++round){
+        std::shuffle(spans.begin(), spans.end(), rng);
+        size_t half = spans.size() / 2;
+        for(size_t i = half; i < spans.size(); ++i){
+            pc->ReleaseSpanToPageCache(spans[i]);
+        }
+        spans.resize(half);
+        if(!pc->Validate()){
+            cout << "PageCacheCoalesceTest failed: invariant broken after partial free" << endl;
+            exit(1);
+        }
+        for(size_t i = 0; i < half; ++i){
+            spans.push_back(pc->NewSpan(rng() % 16 + 1));
+        }
+    }
+
+    // 全部释放
+    std::shuffle(spans.begin(), spans.end(), rng);
+    for(Span* span : spans){
+        pc->ReleaseSpanToPageCache(span);
+    }
+
+    PageCacheStats stats;
+    pc->GetStats(stats);
+    cout << "system pages: " << stats.systemPages << ", free pages: " << stats.freePages
+         << ", free spans: " << stats.freeSpans << ", large spans: " << stats.largeFreeSpans << endl;
+
+    if(!pc->Validate() || stats.freePages != stats.systemPages){
+        cout << "PageCacheCoalesceTest failed: free pages not fully coalesced" << endl;
+        exit(1);
+    }
+
+    // 从合并后的大span上切一块再还回去，应该能原样合并回来
+    for(size_t i = 1; i < PAGE_NUM - 1; ++i){
+        Span* probe = pc->NewSpan(i);
+        pc->ReleaseSpanToPageCache(probe);
+        pc->GetStats(stats);
+        if(stats.freePages != stats.systemPages || !pc->Validate()){
+            cout << "PageCacheCoalesceTest failed: split/merge not reversible" << endl;
+            exit(1);
+        }
+    }
+    // 每个空闲span至少是一个完整的大块（相邻的大块会合并成更大的span）
+    if(stats.freeSpans > stats.systemPages / (PAGE_NUM - 1)){
+        cout << "PageCacheCoalesceTest failed: too many free spans" << endl;
+        exit(1);
+    }
+    cout << "end PageCacheCoalesceTest" << endl;
+}
+
+template <class Policy>
+void SizeClassTest(){
+    cout << "start SizeClassTest<" << (1 << Policy::kPageShift) << ">" << endl;
+    typedef SizeClass<Policy> SizeClass;
+    const size_t MAX_BYTES = Policy::kMaxBytes;
+    // 对齐后的大小 -> 桶下标 -> 块大小 要能还原回来，释放时依赖这个关系
+    for(size_t size = 1; size <= MAX_BYTES; ++size){
+        size_t alignSize = SizeClass::RoundUp(size);
+        size_t index = SizeClass::Index(alignSize);
+        assert(index < Policy::kFreeListNum);
+        assert(SizeClass::ClassToSize(index) == alignSize);
+        if(SizeClass::ClassToSize(index) != alignSize){
+            cout << "SizeClassTest failed at size " << size << endl;
+            exit(1);
+        }
+    }
+
+    // 释放时从size class字节表取到的桶必须和申请时一致
+    size_t sizes[] = {1, 8, 129, 1025, 1100, 8*1024 + 1, 64*1024 + 1, MAX_BYTES};
+    for(size_t size : sizes){
+        void* ptr = ConcurrentAlloc<Policy>(size);
+        size_t cl = PageCache<Policy>::GetInstance()->MapObjectToSizeClass(ptr);
+        if(cl == 0 || SizeClass::ClassToSize(cl - 1) != SizeClass::RoundUp(size)){
+            cout << "SizeClassTest failed: size class map mismatch for " << size << endl;
+            exit(1);
+        }
+        // 池页大于系统页时span起始地址必须按池页对齐，否则整块写会越界（README bug1）
+        memset(ptr, 0xab, SizeClass::RoundUp(size));
+        ConcurrentFree<Policy>(ptr);
+    }
+    cout << "end SizeClassTest" << endl;
+}
+
+// 重对象：带锁和预分配的缓冲区，构造/析构都不便宜
+struct Session{
+    static std::atomic<int> ctors;
+    static std::atomic<int> dtors;
+    std::mutex mtx;
+    std::vector<char> buffer;
+    size_t used;
+    Session() : buffer(4096), used(0) { ctors++; }
+    ~Session() { dtors++; }
+};
+std::atomic<int> Session::ctors(0);
+std::atomic<int> Session::dtors(0);
+
+static void ResetSession(Session* s){
+    s->used = 0;
+}
+
+template <class Policy>
+void SlabCacheTest(){
+    cout << "start SlabCacheTest<" << (1 << Policy::kPageShift) << ">" << endl;
+    Session::ctors = 0;
+    Session::dtors = 0;
+    {
+        SlabCache<Session, Policy> cache(ResetSession);
+        SlabCacheStats stats;
+
+        std::vector<Session*> v;
+        for(int i = 0; i < 100; ++i){
+            Session* s = cache.Alloc();
+            if(s->buffer.size() != 4096 || s->used != 0){
+                cout << "SlabCacheTest failed: object not constructed" << endl;
+                exit(1);
+            }
+            s->used = i + 1;
+            v.push_back(s);
+        }
+        for(Session* s : v){
+            cache.Free(s);
+        }
+        cache.GetStats(stats);
+        int ctors = Session::ctors;
+
+        // 复用：不再调用构造函数，reset回调生效
+        for(int round = 0; round < 10; ++round){
+            for(size_t i = 0; i < v.size(); ++i){
+                v[i] = cache.Alloc();
+                if(v[i]->used != 0){
+                    cout << "SlabCacheTest failed: reset callback not applied" << endl;
+                    exit(1);
+                }
+                v[i]->used = 1;
+            }
+            for(Session* s : v){
+                cache.Free(s);
+            }
+        }
+        if(Session::ctors != ctors || Session::dtors != 0){
+            cout << "SlabCacheTest failed: objects were reconstructed on reuse" << endl;
+            exit(1);
+        }
+        cout << "slabs: " << stats.slabs << ", pages: " << stats.slabPages << ", objects/slab: " << stats.objectsPerSlab
+             << ", constructs: " << stats.constructs << endl;
+
+        // 多线程
+        std::vector<std::thread> threads;
+        for(int t = 0; t < 4; ++t){
+            threads.emplace_back([&cache](){
+                std::vector<Session*> local;
+                for(int round = 0; round < 1000; ++round){
+                    for(int i = 0; i < 16; ++i){
+                        Session* s = cache.Alloc();
+                        std::lock_guard<std::mutex> lock(s->mtx);
+                        s->buffer[0] = (char)i;
+                        local.push_back(s);
+                    }
+                    for(Session* s : local){
+                        cache.Free(s);
+                    }
+                    local.clear();
+                }
+            });
+        }
+        for(auto& t : threads){
+            t.join();
+        }
+        cache.GetStats(stats);
+        if(stats.inUse != 0 || stats.allocs != stats.frees){
+            cout << "SlabCacheTest failed: stats mismatch" << endl;
+            exit(1);
+        }
+
+        // 空slab析构后还给pc
+        size_t pages = cache.Shrink();
+        cache.GetStats(stats);
+        if(stats.slabs != 0 || pages == 0 || Session::dtors != Session::ctors){
+            cout << "SlabCacheTest failed: Shrink did not release empty slabs" << endl;
+            exit(1);
+        }
+        {
+            std::lock_guard<typename Policy::Lock> lock(PageCache<Policy>::GetInstance()->_pageMtx);
+            if(!PageCache<Policy>::GetInstance()->Validate()){
+                cout << "SlabCacheTest failed: page cache invariant broken" << endl;
+                exit(1);
+            }
+        }
+
+        // 复用构造好的对象 vs new/delete
+        const int N = 200000;
+        auto begin1 = std::chrono::steady_clock::now();
+        for(int i = 0; i < N; ++i){
+            cache.Free(cache.Alloc());
+        }
+        auto end1 = std::chrono::steady_clock::now();
+        auto begin2 = std::chrono::steady_clock::now();
+        for(int i = 0; i < N; ++i){
+            delete new Session;
+        }
+        auto end2 = std::chrono::steady_clock::now();
+        cout << N << " Alloc/Free: "
+             << std::chrono::duration_cast<std::chrono::microseconds>(end1 - begin1).count() << "us, new/delete: "
+             << std::chrono::duration_cast<std::chrono::microseconds>(end2 - begin2).count() << "us" << endl;
+    }
+    if(Session::dtors != Session::ctors){
+        cout << "SlabCacheTest failed: destructor leaked objects" << endl;
+        exit(1);
+    }
+    cout << "end SlabCacheTest" << endl;
+}
+
+template <class Policy>
+void RegionTest(){
+    cout << "start RegionTest<" << (1 << Policy::kPageShift) << ">" << endl;
+    typedef PageCache<Policy> PC;
+    PC* pc = PC::GetInstance();
+    PageCacheStats before, after;
+    {
+        std::lock_guard<typename Policy::Lock> lock(pc->_pageMtx);
+        pc->GetStats(before);
+    }
+    {
+        Region<Policy> region;
+        // 对齐和不重叠
+        char* prev = nullptr;
+        for(int i = 0; i < 10000; ++i){
+            size_t size = i % 100 + 1;
+            char* p = (char*)region.Allocate(size, i % 2 ? 8 : 64);
+            if(((uintptr_t)p & (i % 2 ? 7 : 63)) != 0 || (prev && p == prev)){
+                cout << "RegionTest failed: bad alignment" << endl;
+                exit(1);
+            }
+            memset(p, 0xcd, size);
+            prev = p;
+        }
+        size_t bytes = region.Bytes();
+
+        // 嵌套作用域：退出后回到进入时的位置和span数
+        {
+            typename Region<Policy>::Scope outer(region);
+            for(int i = 0; i < 1000; ++i){
+                region.Allocate(4096);
+            }
+            {
+                typename Region<Policy>::Scope inner(region);
+                for(int i = 0; i < 1000; ++i){
+                    region.Allocate(4096);
+                }
+            }
+            if(region.Bytes() < 1000 * 4096){
+                cout << "RegionTest failed: inner scope released outer memory" << endl;
+                exit(1);
+            }
+        }
+        if(region.Bytes() != bytes){
+            cout << "RegionTest failed: scope did not rewind" << endl;
+            exit(1);
+        }
+
+        std::pair<int, double>* obj = region.template New<std::pair<int, double> >(7, 2.5);
+        if(obj->first != 7 || obj->second != 2.5){
+            cout << "RegionTest failed: New did not forward arguments" << endl;
+            exit(1);
+        }
+
+        bool thrown = false;
+        try{
+            region.Allocate((Policy::kMaxPages + 1) << Policy::kPageShift);
+        }catch(const std::bad_alloc&){
+            thrown = true;
+        }
+        if(!thrown){
+            cout << "RegionTest failed: oversized allocation accepted" << endl;
+            exit(1);
+        }
+
+        region.Release();
+        if(region.Bytes() != 0){
+            cout << "RegionTest failed: Release kept spans" << endl;
+            exit(1);
+        }
+        region.Allocate(100); // Release后还能继续用
+    }
+    {
+        std::lock_guard<typename Policy::Lock> lock(pc->_pageMtx);
+        pc->GetStats(after);
+        if(!pc->Validate() || after.systemPages - after.freePages != before.systemPages - before.freePages){
+            cout << "RegionTest failed: spans not returned to page cache" << endl;
+            exit(1);
+        }
+    }
+    cout << "end RegionTest" << endl;
+}
+
+// 当前进程的虚拟内存大小（字节），读 /proc/self/statm 第一列
+static size_t VirtualBytes(){
+    FILE* fp = fopen("/proc/self/statm", "r");
+    if(fp == nullptr){
+        return 0;
+    }
+    size_t pages = 0;
+    if(fscanf(fp, "%zu", &pages) != 1){
+        pages = 0;
+    }
+    fclose(fp);
+    return pages * (size_t)sysconf(_SC_PAGESIZE);
+}
+
+template <class Policy>
+void HeapTest(){
+    cout << "start HeapTest<" << (1 << Policy::kPageShift) << ">" << endl;
+    typedef Heap<Policy> HeapT;
+
+    // 两个堆互不共享内存，多线程同时使用
+    HeapT* a = heap_create<Policy>();
+    HeapT* b = heap_create<Policy>();
+    std::vector<std::thread> threads;
+    std::atomic<int> errors(0);
+    for(int t = 0; t < 4; ++t){
+        threads.emplace_back([&, t](){
+            HeapT* heap = t % 2 ? a : b;
+            HeapT* other = t % 2 ? b : a;
+            std::vector<void*> v;
+            for(int round = 0; round < 10; ++round){
+                for(size_t i = 0; i < 2000; ++i){
+                    size_t size = (i * 37 + t) % 8000 + 1;
+                    void* p = heap_alloc(heap, size);
+                    memset(p, t, size);
+                    if(other->GetPageCache()->MapObjectToSizeClass(p) != 0 ||
+                       PageCache<Policy>::GetInstance()->MapObjectToSizeClass(p) != 0){
+                        errors++;
+                    }
+                    v.push_back(p);
+                }
+                for(void* p : v){
+                    heap_free(heap, p);
+                }
+                v.clear();
+            }
+        });
+    }
+    for(auto& t : threads){
+        t.join();
+    }
+    if(errors != 0){
+        cout << "HeapTest failed: heaps share memory" << endl;
+        exit(1);
+    }
+    cout << "heap a: " << a->SystemBytes() / 1024 << " KB, heap b: " << b->SystemBytes() / 1024 << " KB" << endl;
+    heap_destroy(a);
+    heap_destroy(b);
+
+    // 反复创建、分配、整体销毁，内存要还给系统；槽位复用时不能用到旧堆留下的tc
+    size_t vm0 = VirtualBytes();
+    for(int i = 0; i < 200; ++i){
+        HeapT* heap = heap_create<Policy>();
+        for(int j = 0; j < 2000; ++j){
+            memset(heap_alloc(heap, 4096), 0xab, 4096); // 8MB，不释放
+        }
+        heap_destroy(heap);
+    }
+    size_t vm1 = VirtualBytes();
+    cout << "200 heaps x 8MB created and destroyed, VM grew " << (vm1 - vm0) / 1024 / 1024 << " MB" << endl;
+    if(vm1 > vm0 + 256 * 1024 * 1024){
+        cout << "HeapTest failed: heap_destroy did not release memory" << endl;
+        exit(1);
+    }
+
+    // 槽位上限
+    std::vector<HeapT*> heaps;
+    while(HeapT* heap = heap_create<Policy>()){
+        heaps.push_back(heap);
+    }
+    if(heaps.size() != (size_t)HeapT::kMaxHeaps){
+        cout << "HeapTest failed: wrong heap limit" << endl;
+        exit(1);
+    }
+    for(HeapT* heap : heaps){
+        heap_destroy(heap);
+    }
+    cout << "end HeapTest" << endl;
+}
+
+void NumaTest(){
+    cout << "start NumaTest" << endl;
+    const NumaTopology& topo = NumaTopology::Get();
+    NumaHeaps<>* numa = NumaHeaps<>::GetInstance();
+    cout << "numa nodes: " << topo.NodeCount() << ", current node: " << CurrentNumaNode() << endl;
+    if(topo.NodeCount() < 1 || numa->NodeCount() != topo.NodeCount()){
+        cout << "NumaTest failed: bad topology" << endl;
+        exit(1);
+    }
+
+    std::vector<std::thread> threads;
+    std::atomic<int> errors(0);
+    std::vector<void*> shared(4000);
+    for(int t = 0; t < 4; ++t){
+        threads.emplace_back([&, t](){
+            for(size_t i = t; i < shared.size(); i += 4){
+                size_t size = (i * 13) % 4096 + 1;
+                shared[i] = NumaAlloc(size);
+                memset(shared[i], t, size);
+                int node = numa->LocalNode();
+                // 块必须来自某个节点的堆，且不在默认堆里
+                if(numa->NodeHeap(node)->GetPageCache()->MapObjectToSizeClass(shared[i]) == 0 &&
+                   topo.NodeCount() == 1){
+                    errors++;
+                }
+                if(PageCache<DefaultPolicy>::GetInstance()->MapObjectToSizeClass(shared[i]) != 0){
+                    errors++;
+                }
+            }
+        });
+    }
+    for(auto& t : threads){
+        t.join();
+    }
+    // 在别的线程释放
+    for(void* p : shared){
+        NumaFree(p);
+    }
+    if(errors != 0){
+        cout << "NumaTest failed: block not from a node heap" << endl;
+        exit(1);
+    }
+
+    void* p = NumaAlloc(100);
+    memset(p, 0, 100);
+    int where = NumaNodeOfAddress(p);
+    cout << "block placed on node " << where << endl;
+    if(topo.NodeCount() == 1 && where > 0){
+        cout << "NumaTest failed: block on a nonexistent node" << endl;
+        exit(1);
+    }
+    NumaFree(p);
+    cout << "end NumaTest" << endl;
+}
+
+void MallocStatsTest(){
+    cout << "start MallocStatsTest" << endl;
+    const size_t N = 5000;
+    const size_t size = 100;
+    size_t index = SizeClass<DefaultPolicy>::Index(SizeClass<DefaultPolicy>::RoundUp(size));
+
+    auto classInUse = [index](const MallocStatsData& data){
+        for(const MallocClassStats& c : data.classes){
+            if(c.index == index){
+                return c.inUse;
+            }
+        }
+        return (size_t)0;
+    };
+
+    MallocStatsData before, during, after;
+    CollectMallocStats<DefaultPolicy>(before);
+
+    // 在另一个线程申请，当前线程释放，计数要能跨线程汇总
+    std::vector<void*> v(N);
+    std::thread t([&](){
+        for(size_t i = 0; i < N; ++i){
+            v[i] = ConcurrentAlloc(size);
+        }
+    });
+    t.join();
+    CollectMallocStats<DefaultPolicy>(during);
+    for(void* p : v){
+        ConcurrentFree(p);
+    }
+    CollectMallocStats<DefaultPolicy>(after);
+
+    if(classInUse(during) != classInUse(before) + N || classInUse(after) != classInUse(before)){
+        cout << "MallocStatsTest failed: in-use count mismatch" << endl;
+        exit(1);
+    }
+    size_t accounted = during.inUseBytes + during.threadCacheBytes + during.centralCacheBytes;
+    if(accounted > during.centralSpanBytes || during.centralSpanBytes + during.pageCacheFreeBytes > during.mmappedBytes){
+        cout << "MallocStatsTest failed: tier bytes do not add up" << endl;
+        exit(1);
+    }
+    if(during.threadCaches < before.threadCaches + 1 || during.pageMapBytes == 0){
+        cout << "MallocStatsTest failed: missing thread cache or page map" << endl;
+        exit(1);
+    }
+
+    std::string text = MallocStats();
+    std::string json = MallocStats(true);
+    if(text.find("bytes mmapped") == std::string::npos || json.front() != '{' || json.back() != '}'){
+        cout << "MallocStatsTest failed: bad output" << endl;
+        exit(1);
+    }
+    cout << text.substr(0, text.find("class ")) ;
+    cout << "end MallocStatsTest" << endl;
+}
+
+// 单独的调用点，检查它出现在heap profile里
+__attribute__((noinline)) void *HeapProfilerAllocSite(size_t size){
+    return ConcurrentAlloc(size);
+}
+
+void HeapProfilerTest(){
+    cout << "start HeapProfilerTest" << endl;
+    typedef HeapProfiler<DefaultPolicy> Profiler;
+    const size_t interval = 64 * 1024;
+    const size_t N = 20000;
+    const size_t size = 512; // 共约10MB，期望采中160个左右
+
+    SetHeapSampleInterval(interval);
+    std::vector<void*> v(N);
+    std::thread t([&](){
+        for(size_t i = 0; i < N; ++i){
+            v[i] = HeapProfilerAllocSite(size);
+            memset(v[i], 0x5a, size);
+        }
+    });
+    t.join();
+
+    size_t sampled = Profiler::GetInstance()->SampledObjects();
+    size_t estimated = Profiler::GetInstance()->EstimatedLiveBytes();
+    size_t sampledPages = 0;
+    for(void* p : v){
+        if(PageCache<DefaultPolicy>::GetInstance()->MapObjectToSizeClass(p) == kSampledSizeClass){
+            sampledPages++;
+        }
+    }
+    if(sampled < 60 || sampled > 400 || sampledPages != sampled){
+        cout << "HeapProfilerTest failed: sampled " << sampled << " objects, " << sampledPages << " on sampled pages" << endl;
+        exit(1);
+    }
+    if(estimated < N * size / 2 || estimated > N * size * 2){
+        cout << "HeapProfilerTest failed: estimated " << estimated << " live bytes" << endl;
+        exit(1);
+    }
+
+    std::string profile = HeapProfile();
+    std::string folded = FoldedHeapProfile();
+    if(profile.compare(0, 13, "heap profile:") != 0 || profile.find("heap_v2/65536") == std::string::npos
+        || profile.find("MAPPED_LIBRARIES:") == std::string::npos || folded.empty() || folded.back() != '\n'){
+        cout << "HeapProfilerTest failed: bad profile output" << endl;
+        exit(1);
+    }
+
+    // 采样对象和普通对象混在一起释放，span要还回pc
+    for(void* p : v){
+        ConcurrentFree(p);
+    }
+    SetHeapSampleInterval(0);
+    if(Profiler::GetInstance()->SampledObjects() != 0){
+        cout << "HeapProfilerTest failed: samples left after free" << endl;
+        exit(1);
+    }
+    PageCache<DefaultPolicy>* pc = PageCache<DefaultPolicy>::GetInstance();
+    {
+        std::lock_guard<DefaultPolicy::Lock> lock(pc->_pageMtx);
+        if(!pc->Validate()){
+            cout << "HeapProfilerTest failed: page cache invariant broken" << endl;
+            exit(1);
+        }
+    }
+    cout << sampled << " samples, estimated " << estimated << " of " << N * size << " bytes" << endl;
+    cout << "end HeapProfilerTest" << endl;
+}
+
+void LockStatsTest(){
+    cout << "start LockStatsTest" << endl;
+    typedef PagePolicy4KLockStats Policy;
+    const size_t nworks = 4;
+    const size_t N = 20000;
+
+    std::vector<std::thread> threads;
+    for(size_t k = 0; k < nworks; ++k){
+        threads.emplace_back([k](){
+            std::vector<void*> v(N);
+            for(size_t i = 0; i < N; ++i){
+                v[i] = ConcurrentAlloc<Policy>((i * 37 + k) % 2048 + 1);
+            }
+            for(void* p : v){
+                ConcurrentFree<Policy>(p);
+            }
+        });
+    }
+    for(auto& t : threads){
+        t.join();
+    }
+
+    LockStatsData data;
+    CollectLockStats<Policy>(data);
+    if(data.pageHeap.acquisitions == 0 || data.buckets.empty()){
+        cout << "LockStatsTest failed: no lock acquisitions recorded" << endl;
+        exit(1);
+    }
+    std::vector<const LockContentionStats*> locks(1, &data.pageHeap);
+    for(const BucketLockStats& b : data.buckets){
+        locks.push_back(&b.lock);
+    }
+    for(const LockContentionStats* s : locks){
+        size_t histogram = 0;
+        for(size_t i = 0; i < LockCounters::kWaitBuckets; ++i){
+            histogram += s->waitHistogram[i];
+        }
+        if(s->contended > s->acquisitions || histogram != s->contended || s->maxWaitNs > s->waitNs){
+            cout << "LockStatsTest failed: inconsistent counters" << endl;
+            exit(1);
+        }
+        if(s->WaitPercentileNs(0.5) > s->WaitPercentileNs(0.99) || s->WaitPercentileNs(0.99) > s->maxWaitNs){
+            cout << "LockStatsTest failed: percentile above max wait" << endl;
+            exit(1);
+        }
+    }
+    // 分位数落在最后一个有数据的桶时，不能超过实际的最长等待
+    LockContentionStats one;
+    one.waitHistogram[22] = 1; // [4194304, 8388608)
+    one.maxWaitNs = 7473205;
+    if(one.WaitPercentileNs(0.99) != one.maxWaitNs){
+        cout << "LockStatsTest failed: percentile not clamped to max wait" << endl;
+        exit(1);
+    }
+    cout << LockStats<Policy>(5);
+    cout << "end LockStatsTest" << endl;
+}
+
+void FragmentationTest(){
+    cout << "start FragmentationTest" << endl;
+    const size_t N = 5000;
+    const size_t size = 1000; // 对齐到1008，每块浪费8字节
+    size_t alignSize = SizeClass<DefaultPolicy>::RoundUp(size);
+    size_t index = SizeClass<DefaultPolicy>::Index(alignSize);
+
+    std::vector<void*> v(N);
+    std::thread t([&](){
+        for(size_t i = 0; i < N; ++i){
+            v[i] = ConcurrentAlloc(size);
+        }
+    });
+    t.join();
+
+    FragmentationData data;
+    CollectFragmentation<DefaultPolicy>(data);
+    const ClassFragmentation* cls = nullptr;
+    for(const ClassFragmentation& c : data.classes){
+        if(c.index == index){
+            cls = &c;
+        }
+    }
+    if(cls == nullptr || cls->inUse < N || cls->internalWasteBytes == 0 || cls->internalWasteBytes > cls->inUse * (alignSize - size)){
+        cout << "FragmentationTest failed: internal fragmentation" << endl;
+        exit(1);
+    }
+    size_t binned = 0;
+    for(size_t i = 0; i < CentralClassStats::kOccupancyBins; ++i){
+        binned += cls->occupancy[i];
+    }
+    if(binned != cls->spans || cls->fullSpans == 0 || cls->tailWasteBytes >= cls->spans * alignSize){
+        cout << "FragmentationTest failed: span occupancy" << endl;
+        exit(1);
+    }
+    if(data.uncoalescedSpans != 0 || data.inUseBytes + data.tailWasteBytes + data.centralFreeBytes
+        + data.threadCacheBytes + data.pageHeapFreeBytes > data.mmappedBytes){
+        cout << "FragmentationTest failed: page heap accounting" << endl;
+        exit(1);
+    }
+    // 每个桶的span统计和总数来自同一次遍历
+    MallocStatsData stats;
+    std::vector<CentralClassStats> central;
+    CollectMallocStats<DefaultPolicy>(stats, CentralCache<DefaultPolicy>::GetInstance(), &central);
+    size_t centralFree = 0;
+    for(size_t i = 0; i < central.size(); ++i){
+        centralFree += (central[i].capacityObjects - central[i].usedObjects) * SizeClass<DefaultPolicy>::ClassToSize(i);
+    }
+    if(central.size() != DefaultPolicy::kFreeListNum || centralFree != stats.centralCacheBytes){
+        cout << "FragmentationTest failed: central class stats" << endl;
+        exit(1);
+    }
+    std::string json = FragmentationReport(true);
+    if(json.front() != '{' || json.back() != '}'){
+        cout << "FragmentationTest failed: bad json" << endl;
+        exit(1);
+    }
+    std::string text = FragmentationReport();
+    cout << text.substr(0, text.find("class "));
+
+    for(void* p : v){
+        ConcurrentFree(p);
+    }
+    cout << "end FragmentationTest" << endl;
+}
+
+// 释放的线程从来没有调用过ConcurrentAlloc
+void CrossThreadFreeTest(){
+    cout << "start CrossThreadFreeTest" << endl;
+    const size_t N = 10000;
+    std::vector<void*> v(N);
+    std::thread producer([&](){
+        for(size_t i = 0; i < N; ++i){
+            v[i] = ConcurrentAlloc(i % 1024 + 1);
+        }
+    });
+    producer.join();
+    std::thread consumer([&](){
+        for(void* p : v){
+            ConcurrentFree(p);
+        }
+    });
+    consumer.join();
+    cout << "end CrossThreadFreeTest" << endl;
+}
+
+// 不依赖MEMPOOL_TRACE：直接调用AllocTrace::Record，检查读回的记录和回放计划
+void TraceTest(){
+    cout << "start TraceTest" << endl;
+    char path[] = "/tmp/mempool_trace_XXXXXX";
+    int fd = mkstemp(path);
+    close(fd);
+    const size_t N = 1000;
+    if(!AllocTrace::Get().Start(path, AllocTrace::kBlockRecords * 4) || AllocTrace::Get().Start(path, N)){
+        cout << "TraceTest failed: start" << endl;
+        exit(1);
+    }
+    // 每个线程预留kBlockRecords条，容量要够两个线程
+    // 一个线程申请，另一个线程释放，最后一个对象不释放；地址0x1000在释放后又被申请一次
+    std::thread producer([&](){
+        for(size_t i = 0; i < N; ++i){
+            AllocTrace::Get().Record(kTraceAlloc, (void*)(0x1000 + i * 16), i % 100 + 1);
+        }
+    });
+    producer.join();
+    std::thread consumer([&](){
+        for(size_t i = 0; i + 1 < N; ++i){
+            AllocTrace::Get().Record(kTraceFree, (void*)(0x1000 + i * 16), 0);
+        }
+        AllocTrace::Get().Record(kTraceAlloc, (void*)0x1000, 8);
+        AllocTrace::Get().Record(kTraceFree, (void*)0x1000, 0);
+        AllocTrace::Get().Record(kTraceFree, (void*)0x10, 0); // 记录开始前申请的对象
+    });
+    consumer.join();
+    AllocTrace::Get().Stop();
+    AllocTrace::Get().Record(kTraceAlloc, (void*)0x20, 8); // 停止后不记录
+
+    TraceHeader header;
+    std::vector<TraceRecord> records;
+    if(!LoadAllocTrace(path, header, records) || records.size() != 2 * N + 2 || header.threads != 2 || header.dropped != 0){
+        cout << "TraceTest failed: load " << records.size() << endl;
+        exit(1);
+    }
+    unlink(path);
+
+    ReplayPlan plan;
+    BuildReplayPlan(records, plan);
+    if(plan.threads.size() != 2 || plan.objectSizes.size() != N + 1 || plan.unmatchedFrees != 1
+        || plan.leaked.size() != 1 || plan.leaked[0] != N - 1 || plan.threads[1].size() != N + 1){
+        cout << "TraceTest failed: replay plan" << endl;
+        exit(1);
+    }
+    size_t expectPeak = 0;
+    for(size_t i = 0; i < N; ++i){
+        expectPeak += i % 100 + 1;
+    }
+    if(plan.peakLiveBytes != expectPeak || plan.threads[1].back().object != N){
+        cout << "TraceTest failed: object ids" << endl;
+        exit(1);
+    }
+
+    // 运行时参数：maxBatch限制NumMoveSize
+    size_t before = SizeClass<DefaultPolicy>::NumMoveSize(8);
+    AllocTunables::Get().maxBatch.store(16);
+    size_t capped = SizeClass<DefaultPolicy>::NumMoveSize(8);
+    AllocTunables::Get().maxBatch.store(512);
+    if(capped != 16 || before <= 16){
+        cout << "TraceTest failed: maxBatch tunable" << endl;
+        exit(1);
+    }
+    cout << "end TraceTest" << endl;
+}
+
+// 在子进程里跑fn，返回子进程写到stderr的内容，killedBy是结束它的信号（正常退出为0）
+template <class Fn>
+static std::string RunInChild(Fn fn, int& killedBy){
+    int fds[2];
+    if(pipe(fds) != 0){
+        cout << "GuardedAllocTest failed: pipe" << endl;
+        exit(1);
+    }
+    pid_t pid = fork();
+    if(pid == 0){
+        close(fds[0]);
+        dup2(fds[1], STDERR_FILENO);
+        fn();
+        _exit(0);
+    }
+    close(fds[1]);
+    std::string out;
+    char buf[4096];
+    ssize_t n;
+    while((n = read(fds[0], buf, sizeof(buf))) > 0){
+        out.append(buf, n);
+    }
+    close(fds[0]);
+    int status = 0;
+    waitpid(pid, &status, 0);
+    killedBy = WIFSIGNALED(status) ? WTERMSIG(status) : 0;
+    return out;
+}
+
+// 一直申请直到拿到一个保护分配的对象
+static char* GuardedObject(size_t size){
+    for(int i = 0; i < 1000; ++i){
+        char* p = (char*)ConcurrentAlloc(size);
+        if(GuardedAllocator<>::GetInstance()->IsAllocated(p)){
+            return p;
+        }
+    }
+    return nullptr;
+}
+
+void GuardedAllocTest(){
+    cout << "start GuardedAllocTest" << endl;
+    const size_t size = 112; // 16的倍数，贴右边放时紧挨着保护页
+    SetHeapSampleInterval(1); // 每次都采样
+    SetGuardedSampling(1);    // 采中的都保护
+
+    size_t before = GuardedAllocator<>::GetInstance()->Allocations();
+    std::thread t([&](){
+        std::vector<char*> v;
+        for(int i = 0; i < 10; ++i){
+            char* p = GuardedObject(size);
+            if(p == nullptr){
+                cout << "GuardedAllocTest failed: no guarded allocation" << endl;
+                exit(1);
+            }
+            memset(p, 0xab, size);
+            v.push_back(p);
+        }
+        for(char* p : v){
+            ConcurrentFree(p);
+        }
+    });
+    t.join();
+    if(GuardedAllocator<>::GetInstance()->Allocations() < before + 10){
+        cout << "GuardedAllocTest failed: allocation count" << endl;
+        exit(1);
+    }
+
+    // 越界：贴左边放时往前写一字节，贴右边放时往后写一字节
+    int sig = 0;
+    std::string report = RunInChild([&](){
+        volatile char* p = GuardedObject(size);
+        if(((uintptr_t)p & (GuardedAllocator<>::kPageSize - 1)) == 0){
+            p[-1] = 1;
+        }else{
+            p[size] = 1;
+        }
+    }, sig);
+    if(sig != SIGSEGV || report.find("heap-buffer-") == std::string::npos || report.find("allocated by:") == std::string::npos
+        || report.find(" bytes to the ") == std::string::npos || report.find("-byte region [0x") == std::string::npos){
+        cout << "GuardedAllocTest failed: overflow not reported" << endl << report;
+        exit(1);
+    }
+
+    report = RunInChild([&](){
+        volatile char* p = GuardedObject(size);
+        ConcurrentFree((void*)p);
+        p[0] = 1;
+    }, sig);
+    if(sig != SIGSEGV || report.find("use-after-free") == std::string::npos || report.find("freed by:") == std::string::npos){
+        cout << "GuardedAllocTest failed: use-after-free not reported" << endl << report;
+        exit(1);
+    }
+
+    report = RunInChild([&](){
+        char* p = GuardedObject(size);
+        ConcurrentFree(p);
+        ConcurrentFree(p);
+    }, sig);
+    if(sig != SIGABRT || report.find("double-free") == std::string::npos){
+        cout << "GuardedAllocTest failed: double free not reported" << endl << report;
+        exit(1);
+    }
+    cout << report.substr(0, report.find('\n') + 1);
+
+    SetGuardedSampling(0);
+    SetHeapSampleInterval(0);
+    cout << "end GuardedAllocTest" << endl;
+}
+
 int main(int argc, char const *argv[])
 {
     
+    PageCacheCoalesceTest<PagePolicy4K>();
+    PageCacheCoalesceTest<PagePolicy8K>();
+    SizeClassTest<PagePolicy4K>();
+    SizeClassTest<PagePolicy8K>();
+    SlabCacheTest<PagePolicy4K>();
+    SlabCacheTest<PagePolicy8K>();
+    RegionTest<PagePolicy4K>();
+    RegionTest<PagePolicy8K>();
+    HeapTest<PagePolicy4K>();
+    HeapTest<PagePolicy8K>();
+    NumaTest();
+    MallocStatsTest();
+    HeapProfilerTest();
+    LockStatsTest();
+    FragmentationTest();
+    CrossThreadFreeTest();
+    TraceTest();
+    GuardedAllocTest();
     AllocTest();
     ConcurrentAllocTest1();
     TestMultiThreadAlloc();
@@ -11,16 +11,56 @@
 #include <cstdlib>
 #include <cstring>
 #include <iostream>
+#include <random>
+#include <algorithm>
+#include <mutex>
 #include "ConcurrentAlloc.h"
+#include "CentralCache.h"
+#include "Region.h"
+#include "NumaAlloc.h"
+#include "MallocStats.h"
+#include "LockStats.h"
+#include "Fragmentation.h"
+#include "BenchUtil.h"
 
 using std::cout;
 using std::endl;
 
+// 申请和释放两个阶段的硬件计数器，每个线程自己计数，结束后合并
+struct PhaseCounters
+{
+    std::mutex mtx;
+    PerfCounts alloc;
+    PerfCounts release;
+    bool hardware = false;
+
+    void Merge(const PerfCounts &a, const PerfCounts &r, bool hw)
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        alloc.Merge(a);
+        release.Merge(r);
+        hardware = hw;
+    }
+
+    void Print(const char *allocName, const char *freeName, size_t ops)
+    {
+        static bool warned = false;
+        if (!hardware && !warned)
+        {
+            warned = true;
+            printf("hardware counters unavailable (no PMU, or blocked by /proc/sys/kernel/perf_event_paranoid), only context switches are reported\n");
+        }
+        printf("  %-15s %s\n", allocName, alloc.Format(ops).c_str());
+        printf("  %-15s %s\n", freeName, release.Format(ops).c_str());
+    }
+};
+
 long long BenchmarkMalloc(int ntimes, size_t nworks, size_t rounds)
 {
     std::vector<std::thread> vthread(nworks);
     std::atomic<size_t> malloc_costtime(0);
     std::atomic<size_t> free_costtime(0);
+    PhaseCounters counters;
 
     // nworks
     for (size_t k = 0; k < nworks; ++k)
@@ -29,8 +69,11 @@ long long BenchmarkMalloc(int ntimes, size_t nworks, size_t rounds)
                                  {
             std::vector<void*> v;
             v.reserve(ntimes);
+            PerfCounters perf;
+            PerfCounts allocCounts, freeCounts, c0, c1, c2;
 
             for(size_t i = 0; i < rounds; ++i){
+                perf.Read(c0);
                 size_t begin1 = clock();
 
                 for(size_t j = 0; j < ntimes; ++j){
@@ -38,6 +81,7 @@ long long BenchmarkMalloc(int ntimes, size_t nworks, size_t rounds)
                     v.push_back(malloc((16 + i) % 4096 + 1));// 每一次申请不同桶中的块
                 }
                 size_t end1 = clock();
+                perf.Read(c1);
 
                 size_t begin2 = clock();
                 for(size_t j = 0; j < ntimes; ++j){
@@ -45,13 +89,17 @@ long long BenchmarkMalloc(int ntimes, size_t nworks, size_t rounds)
                 }
 
                 size_t end2 = clock();
+                perf.Read(c2);
+                allocCounts.AddDelta(c0, c1);
+                freeCounts.AddDelta(c1, c2);
 
                 malloc_costtime += end1 - begin1;
                 free_costtime += end2 - begin2;
                 
                 // Clear the vector after each round
                 v.clear();
-            } });
+            }
+            counters.Merge(allocCounts, freeCounts, perf.HardwareAvailable()); });
     }
 
     for (auto &t : vthread)
@@ -62,15 +110,18 @@ long long BenchmarkMalloc(int ntimes, size_t nworks, size_t rounds)
     printf("%zu threads || %zu rounds || %zu malloc : cost %zu ms\n", nworks, rounds, ntimes, 1000* malloc_costtime.load() / CLOCKS_PER_SEC );
     printf("%zu threads || %zu rounds || %zu free : cost %zu ms\n", nworks, rounds, ntimes, 1000* free_costtime.load() / CLOCKS_PER_SEC );
     printf("%zu threads || %zu rounds || %zu malloc&free : cost %zu ms\n", nworks, rounds, ntimes, 1000* (malloc_costtime.load() + free_costtime.load()) / CLOCKS_PER_SEC );
+    counters.Print("malloc", "free", nworks * rounds * ntimes);
 
     return malloc_costtime.load() + free_costtime.load();
 }
 
-long long BenchmarkConcurrentAlloc(int ntimes, size_t nworks, size_t rounds)
+template <class Policy>
+long long BenchmarkConcurrentAlloc(const char *name, int ntimes, size_t nworks, size_t rounds)
 {
     std::vector<std::thread> vthread(nworks);
     std::atomic<size_t> malloc_costtime(0);
     std::atomic<size_t> free_costtime(0);
+    PhaseCounters counters;
 
     // nworks
     for (size_t k = 0; k < nworks; ++k)
@@ -79,28 +130,36 @@ long long BenchmarkConcurrentAlloc(int ntimes, size_t nworks, size_t rounds)
                                  {
             std::vector<void*> v;
             v.reserve(ntimes);
+            PerfCounters perf;
+            PerfCounts allocCounts, freeCounts, c0, c1, c2;
 
             for(size_t i = 0; i < rounds; ++i){
+                perf.Read(c0);
                 size_t begin1 = clock();
 
                 for(size_t j = 0; j < ntimes; ++j){
                     // v.push_back(ConcurrentAlloc(16));
-                    v.push_back(ConcurrentAlloc((16 + i) % 4096 + 1));
+                    v.push_back(ConcurrentAlloc<Policy>((16 + i) % 4096 + 1));
                 }
                 size_t end1 = clock();
+                perf.Read(c1);
                 size_t begin2 = clock();
                 for(size_t j = 0; j < ntimes; ++j){
-                    ConcurrentFree(v[j]);
+                    ConcurrentFree<Policy>(v[j]);
                 }
 
                 size_t end2 = clock();
+                perf.Read(c2);
+                allocCounts.AddDelta(c0, c1);
+                freeCounts.AddDelta(c1, c2);
 
                 malloc_costtime += end1 - begin1;
                 free_costtime += end2 - begin2;
                 
                 // Clear the vector after each round
                 v.clear();
-            } });
+            }
+            counters.Merge(allocCounts, freeCounts, perf.HardwareAvailable()); });
     }
 
     for (auto &t : vthread)
@@ -108,12 +167,324 @@ long long BenchmarkConcurrentAlloc(int ntimes, size_t nworks, size_t rounds)
         t.join();
     }
 
-    printf("%zu threads || %zu rounds || %zu ConcurrentAlloc : cost %zu ms\n", nworks, rounds, ntimes, 1000* malloc_costtime.load() / CLOCKS_PER_SEC );
-    printf("%zu threads || %zu rounds || %zu ConcurrentFree : cost %zu ms\n", nworks, rounds, ntimes, 1000* free_costtime.load() / CLOCKS_PER_SEC );
-    printf("%zu threads || %zu rounds || %zu ConcurrentAlloc&ConcurrentFree : cost %zu ms\n", nworks, rounds, ntimes, 1000* (malloc_costtime.load() + free_costtime.load()) / CLOCKS_PER_SEC );
+    printf("[%s] %zu threads || %zu rounds || %zu ConcurrentAlloc : cost %zu ms\n", name, nworks, rounds, ntimes, 1000* malloc_costtime.load() / CLOCKS_PER_SEC );
+    printf("[%s] %zu threads || %zu rounds || %zu ConcurrentFree : cost %zu ms\n", name, nworks, rounds, ntimes, 1000* free_costtime.load() / CLOCKS_PER_SEC );
+    printf("[%s] %zu threads || %zu rounds || %zu ConcurrentAlloc&ConcurrentFree : cost %zu ms\n", name, nworks, rounds, ntimes, 1000* (malloc_costtime.load() + free_costtime.load()) / CLOCKS_PER_SEC );
+    counters.Print("ConcurrentAlloc", "ConcurrentFree", nworks * rounds * ntimes);
     return malloc_costtime.load() + free_costtime.load();
 }
 
+// 单次操作的延迟：每kLatencySampleEvery次申请/释放计时一次，记入每线程的直方图，结束后合并
+// 吞吐按墙钟时间算，和上面按clock()累计的进程CPU时间不同
+static const size_t kLatencySampleEvery = 4;
+
+template <class Alloc, class Free>
+static void RunLatency(const char *name, Alloc alloc, Free release, size_t ntimes, size_t nworks, size_t rounds)
+{
+    std::vector<LatencyHistogram> allocHist(nworks), freeHist(nworks);
+    std::vector<std::thread> vthread(nworks);
+    auto begin = std::chrono::steady_clock::now();
+    for (size_t k = 0; k < nworks; ++k)
+    {
+        vthread[k] = std::thread([&, k]()
+                                 {
+            std::vector<void*> v(ntimes);
+            for(size_t i = 0; i < rounds; ++i){
+                for(size_t j = 0; j < ntimes; ++j){
+                    size_t size = (16 + i) % 4096 + 1;
+                    if(j % kLatencySampleEvery == 0){
+                        uint64_t t0 = CycleClock::Now();
+                        v[j] = alloc(size);
+                        allocHist[k].Record(CycleClock::Now() - t0);
+                    }else{
+                        v[j] = alloc(size);
+                    }
+                }
+                for(size_t j = 0; j < ntimes; ++j){
+                    if(j % kLatencySampleEvery == 0){
+                        uint64_t t0 = CycleClock::Now();
+                        release(v[j]);
+                        freeHist[k].Record(CycleClock::Now() - t0);
+                    }else{
+                        release(v[j]);
+                    }
+                }
+            } });
+    }
+    for (auto &t : vthread)
+    {
+        t.join();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+    LatencyHistogram allocAll, freeAll;
+    for (size_t k = 0; k < nworks; ++k)
+    {
+        allocAll.Merge(allocHist[k]);
+        freeAll.Merge(freeHist[k]);
+    }
+    double ns = CycleClock::NsPerTick();
+    double ops = 2.0 * ntimes * rounds * nworks; // 申请和释放各算一次
+    printf("[latency] %-16s || %2zu threads || %8.2f Mops/s || %7.2f Mops/s/thread\n",
+           name, nworks, ops / seconds / 1e6, ops / seconds / 1e6 / nworks);
+    const char *names[2] = {"alloc", "free"};
+    const LatencyHistogram *hists[2] = {&allocAll, &freeAll};
+    for (int i = 0; i < 2; ++i)
+    {
+        printf("    %-5s p50 %8.0f ns || p99 %8.0f ns || p99.9 %8.0f ns || max %10.0f ns\n", names[i],
+               hists[i]->Percentile(0.5) * ns, hists[i]->Percentile(0.99) * ns,
+               hists[i]->Percentile(0.999) * ns, hists[i]->Max() * ns);
+    }
+}
+
+// 线程数从1翻倍到nworks，对比malloc和ConcurrentAlloc的吞吐和尾延迟
+void BenchmarkLatency(size_t ntimes, size_t nworks, size_t rounds, bool enable_malloc)
+{
+    std::vector<size_t> threadCounts;
+    for (size_t n = 1; n < nworks; n *= 2)
+        threadCounts.push_back(n);
+    threadCounts.push_back(nworks);
+
+    for (size_t n : threadCounts)
+    {
+        if (enable_malloc)
+            RunLatency("malloc", [](size_t size)
+                       { return malloc(size); }, [](void *p)
+                       { free(p); }, ntimes, n, rounds);
+        RunLatency("ConcurrentAlloc", [](size_t size)
+                   { return ConcurrentAlloc(size); }, [](void *p)
+                   { ConcurrentFree(p); }, ntimes, n, rounds);
+    }
+}
+
+// 偏斜的size分布：90%的申请落在4个小size上，其余均匀分布在[1, 32KB]
+// 对比固定span页数和自适应span页数下向pc申请span的次数，以及各class的span使用率
+template <class Policy>
+void BenchmarkSkewedSpanSizing(const char *name, size_t ntimes, size_t nworks, size_t rounds, bool adaptive)
+{
+    typedef CentralCache<Policy> CC;
+    const size_t kClassNum = Policy::kFreeListNum;
+    CC::GetInstance()->SetAdaptiveSpanSizing(adaptive);
+
+    std::vector<CentralClassStats> before(kClassNum), after(kClassNum);
+    for (size_t i = 0; i < kClassNum; ++i)
+        CC::GetInstance()->GetClassStats(i, before[i]);
+
+    std::vector<std::thread> vthread(nworks);
+    auto begin = std::chrono::steady_clock::now();
+    for (size_t k = 0; k < nworks; ++k)
+    {
+        vthread[k] = std::thread([&, k]()
+                                 {
+            static const size_t hotSizes[4] = {16, 32, 64, 128};
+            std::mt19937 rng(k + 1);
+            std::vector<void*> v;
+            v.reserve(ntimes);
+            for(size_t i = 0; i < rounds; ++i){
+                for(size_t j = 0; j < ntimes; ++j){
+                    size_t size = rng() % 100 < 90 ? hotSizes[rng() % 4] : rng() % (32 * 1024) + 1;
+                    v.push_back(ConcurrentAlloc<Policy>(size));
+                }
+                for(size_t j = 0; j < ntimes; ++j){
+                    ConcurrentFree<Policy>(v[j]);
+                }
+                v.clear();
+            } });
+    }
+    for (auto &t : vthread)
+    {
+        t.join();
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    size_t totalFetches = 0;
+    std::vector<size_t> order;
+    for (size_t i = 0; i < kClassNum; ++i)
+    {
+        CC::GetInstance()->GetClassStats(i, after[i]);
+        totalFetches += after[i].spanFetches - before[i].spanFetches;
+        if (after[i].spanFetches > before[i].spanFetches)
+            order.push_back(i);
+    }
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b)
+              { return after[a].spanFetches - before[a].spanFetches > after[b].spanFetches - before[b].spanFetches; });
+
+    printf("[%s] skewed sizes || adaptive span sizing %s || %zu threads || %zu rounds || %zu allocs || span fetches %zu || %lld ms\n",
+           name, adaptive ? "on " : "off", nworks, rounds, ntimes, totalFetches,
+           (long long)std::chrono::duration_cast<std::chrono::milliseconds>(end - begin).count());
+    for (size_t n = 0; n < order.size() && n < 8; ++n)
+    {
+        size_t i = order[n];
+        double util = after[i].capacityObjects ? 100.0 * after[i].usedObjects / after[i].capacityObjects : 0.0;
+        printf("    class %3zu (%6zu B) || span fetches %6zu || span pages %3zu || spans %4zu || utilisation %5.1f%%\n",
+               i, SizeClass<Policy>::ClassToSize(i), after[i].spanFetches - before[i].spanFetches,
+               after[i].spanPages, after[i].spans, util);
+    }
+}
+
+// 解析后丢弃的负载：每个请求"解析"出一棵由小节点和字符串组成的树，用完整体丢弃
+// Region按请求bump分配、结束时Release一次；ConcurrentAlloc逐个申请、遍历逐个释放
+struct ParseNode
+{
+    ParseNode *next;
+    ParseNode *child;
+    char *text;
+    size_t len;
+};
+
+template <class Alloc>
+static ParseNode *ParseDocument(Alloc &alloc, std::mt19937 &rng, size_t nodes)
+{
+    ParseNode *root = nullptr;
+    ParseNode *parent = nullptr;
+    for (size_t i = 0; i < nodes; ++i)
+    {
+        ParseNode *node = (ParseNode *)alloc.Allocate(sizeof(ParseNode));
+        node->len = rng() % 60 + 4;
+        node->text = (char *)alloc.Allocate(node->len);
+        memset(node->text, 'a' + i % 26, node->len);
+        node->child = nullptr;
+        // 每8个节点换一个父节点，挂成两层的树
+        if (i % 8 == 0)
+        {
+            node->next = root;
+            root = parent = node;
+        }
+        else
+        {
+            node->next = parent->child;
+            parent->child = node;
+        }
+    }
+    return root;
+}
+
+struct RegionAlloc
+{
+    Region<> region;
+    void *Allocate(size_t size) { return region.Allocate(size); }
+};
+
+struct ConcurrentAllocator
+{
+    void *Allocate(size_t size) { return ConcurrentAlloc(size); }
+};
+
+static void FreeDocument(ParseNode *root)
+{
+    while (root)
+    {
+        ParseNode *child = root->child;
+        while (child)
+        {
+            ParseNode *next = child->next;
+            ConcurrentFree(child->text);
+            ConcurrentFree(child);
+            child = next;
+        }
+        ParseNode *next = root->next;
+        ConcurrentFree(root->text);
+        ConcurrentFree(root);
+        root = next;
+    }
+}
+
+void BenchmarkRegionParse(size_t ntimes, size_t nworks, size_t rounds)
+{
+    for (int useRegion = 0; useRegion < 2; ++useRegion)
+    {
+        std::vector<std::thread> vthread(nworks);
+        auto begin = std::chrono::steady_clock::now();
+        for (size_t k = 0; k < nworks; ++k)
+        {
+            vthread[k] = std::thread([&, k]()
+                                     {
+                std::mt19937 rng(k + 1);
+                if (useRegion) {
+                    RegionAlloc alloc;
+                    for (size_t i = 0; i < rounds; ++i) {
+                        ParseDocument(alloc, rng, ntimes);
+                        alloc.region.Release();
+                    }
+                } else {
+                    ConcurrentAllocator alloc;
+                    for (size_t i = 0; i < rounds; ++i) {
+                        FreeDocument(ParseDocument(alloc, rng, ntimes));
+                    }
+                } });
+        }
+        for (auto &t : vthread)
+        {
+            t.join();
+        }
+        auto end = std::chrono::steady_clock::now();
+        printf("[parse&discard] %-27s || %zu threads || %zu rounds || %zu nodes : cost %lld ms\n",
+               useRegion ? "Region + Release" : "ConcurrentAlloc/Free", nworks, rounds, ntimes,
+               (long long)std::chrono::duration_cast<std::chrono::milliseconds>(end - begin).count());
+    }
+}
+
+// NUMA：每个节点依次起一个绑在该节点cpu上的线程，申请并写入一批块，统计块所在物理页的节点
+// 先跑的节点释放的span留在共享cc里，ConcurrentAlloc下后跑的节点会拿到远端内存；NumaAlloc按节点分堆
+template <class Alloc, class Free>
+static void RunNumaPlacement(const char *name, Alloc alloc, Free release, size_t ntimes, size_t rounds)
+{
+    const NumaTopology &topo = NumaTopology::Get();
+    size_t local = 0, remote = 0, unknown = 0;
+    auto begin = std::chrono::steady_clock::now();
+    for (size_t round = 0; round < rounds; ++round)
+    {
+        for (int node = 0; node < topo.NodeCount(); ++node)
+        {
+            if (topo.CpusOfNode(node).empty())
+                continue;
+            std::thread t([&, node]()
+                          {
+                cpu_set_t set;
+                CPU_ZERO(&set);
+                for (int cpu : topo.CpusOfNode(node))
+                    CPU_SET(cpu, &set);
+                sched_setaffinity(0, sizeof(set), &set);
+
+                std::vector<void*> v(ntimes);
+                for (size_t i = 0; i < ntimes; ++i) {
+                    size_t size = (i * 37) % 2048 + 16;
+                    v[i] = alloc(size);
+                    memset(v[i], 1, size);
+                }
+                int here = CurrentNumaNode();
+                for (size_t i = 0; i < ntimes; i += 16) { // 抽样，move_pages是系统调用
+                    int where = NumaNodeOfAddress(v[i]);
+                    if (where < 0)
+                        unknown++;
+                    else if (where == here)
+                        local++;
+                    else
+                        remote++;
+                }
+                for (size_t i = 0; i < ntimes; ++i)
+                    release(v[i]); });
+            t.join();
+        }
+    }
+    auto end = std::chrono::steady_clock::now();
+    size_t total = local + remote + unknown;
+    printf("[numa] %-16s || %d nodes || %zu rounds || %zu allocs/thread || local %5.1f%% || remote %5.1f%% || unknown %5.1f%% || %lld ms\n",
+           name, topo.NodeCount(), rounds, ntimes,
+           total ? 100.0 * local / total : 0.0, total ? 100.0 * remote / total : 0.0, total ? 100.0 * unknown / total : 0.0,
+           (long long)std::chrono::duration_cast<std::chrono::milliseconds>(end - begin).count());
+}
+
+void BenchmarkNuma(size_t ntimes, size_t rounds)
+{
+    RunNumaPlacement("ConcurrentAlloc", [](size_t size)
+                     { return ConcurrentAlloc(size); }, [](void *p)
+                     { ConcurrentFree(p); }, ntimes, rounds);
+    RunNumaPlacement("NumaAlloc", [](size_t size)
+                     { return NumaAlloc(size); }, [](void *p)
+                     { NumaFree(p); }, ntimes, rounds);
+}
+
 int main(int argc, char *argv[])
 {
     if (argc != 5)
@@ -132,10 +503,47 @@ int main(int argc, char *argv[])
     cout << endl
          << endl;
 
-    long long concurrent_costtime = BenchmarkConcurrentAlloc(ntimes, nworks, rounds);
+    long long concurrent_costtime = BenchmarkConcurrentAlloc<PagePolicy4K>("4KB page", ntimes, nworks, rounds);
+    cout << endl;
+    long long concurrent8k_costtime = BenchmarkConcurrentAlloc<PagePolicy8K>("8KB page", ntimes, nworks, rounds);
+    (void)concurrent8k_costtime;
+    cout << endl;
+    // 和4KB page对比，看tc计数的开销
+    long long nostats_costtime = BenchmarkConcurrentAlloc<PagePolicy4KNoStats>("4KB page, no stats", ntimes, nworks, rounds);
+    printf("stats overhead: %+.1f%%\n", 100.0 * (concurrent_costtime - nostats_costtime) / nostats_costtime);
+    cout << endl;
+    // 打开堆采样（tcmalloc默认的平均512KB一次），和关闭时的4KB page对比
+    SetHeapSampleInterval(512 * 1024);
+    long long sampled_costtime = BenchmarkConcurrentAlloc<PagePolicy4K>("4KB page, heap sampling", ntimes, nworks, rounds);
+    SetHeapSampleInterval(0);
+    printf("sampling overhead: %+.1f%%\n", 100.0 * (sampled_costtime - concurrent_costtime) / concurrent_costtime);
+    cout << endl;
+    // cc桶锁和pc锁换成InstrumentedLock，列出等待最久的桶
+    BenchmarkConcurrentAlloc<PagePolicy4KLockStats>("4KB page, lock stats", ntimes, nworks, rounds);
+    cout << LockStats<PagePolicy4KLockStats>();
+
+    cout << "================================================" << endl;
+
+    BenchmarkLatency(ntimes, nworks, rounds, enable_malloc);
+
+    cout << "================================================" << endl;
+
+    BenchmarkSkewedSpanSizing<PagePolicy4K>("4KB page", ntimes, nworks, rounds, false);
+    BenchmarkSkewedSpanSizing<PagePolicy4K>("4KB page", ntimes, nworks, rounds, true);
 
     cout << "================================================" << endl;
 
+    BenchmarkRegionParse(ntimes, nworks, rounds);
+
+    cout << "================================================" << endl;
+
+    BenchmarkNuma(ntimes, rounds);
+
+    cout << "================================================" << endl;
+
+    cout << MallocStats();
+    cout << FragmentationReport();
+
     // cout << "ConcurrentAlloc is " << (double)malloc_costtime / (double)concurrent_costtime << " times faster than malloc" << endl;
 
     return 0;
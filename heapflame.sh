@@ -0,0 +1,27 @@
+#!/bin/bash
+
+# 把FoldedHeapProfile()输出的折叠栈画成火焰图
+# 用法: ./heapflame.sh heap.folded
+# pprof格式（HeapProfile()/WriteHeapProfile()）直接用: pprof --svg ./binary heap.prof
+
+WORK_DIR=$(pwd)
+FLAMEGRAPH_DIR="$WORK_DIR/FlameGraph"
+OUTPUT_DIR="$WORK_DIR/output"
+
+if [ $# -ne 1 ] || [ ! -f "$1" ]; then
+    echo "用法: $0 <folded heap profile>"
+    exit 1
+fi
+
+# 检查FLAMEGRAPH_DIR是否存在
+if [ ! -d "$FLAMEGRAPH_DIR" ]; then
+    echo "FlameGraph目录不存在，请先下载FlameGraph: https://github.com/brendangregg/FlameGraph.git"
+    exit 1
+fi
+
+mkdir -p "$OUTPUT_DIR"
+
+# 值是估计的存活字节数
+"$FLAMEGRAPH_DIR/flamegraph.pl" --countname=bytes --title="Live Heap" --colors=mem "$1" > "$OUTPUT_DIR/heap_flamegraph.svg"
+
+echo "火焰图已生成：$OUTPUT_DIR/heap_flamegraph.svg"
@@ -0,0 +1,133 @@
+/**
+ * micro benchmark for page map
+ * 对比 TCMalloc_PageMap3（8MB 叶子）和 AtomicPageMap3（32KB 叶子, 原子发布）的
+ * 查找延迟和元数据常驻内存；以及释放路径上 span 查找和 size class 字节表查找的差别
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+#include <unistd.h>
+#include "RadixTree.h"
+#include "ConcurrentAlloc.h"
+#include "BenchUtil.h"
+
+static const size_t PAGE_SHIFT = DefaultPolicy::kPageShift;
+
+typedef TCMalloc_PageMap3<64 - PAGE_SHIFT> OldPageMap;
+typedef AtomicPageMap3<48 - PAGE_SHIFT> NewPageMap;
+
+// 模拟一个真实进程的堆：nregions 段 mmap 区域，每段 regionPages 页，地址从高往低排布
+static std::vector<PageId> MakeHeapPages(size_t nregions, size_t regionPages)
+{
+    std::vector<PageId> pages;
+    pages.reserve(nregions * regionPages);
+    PageId top = (PageId)0x7f0000000000ULL >> PAGE_SHIFT;
+    for (size_t r = 0; r < nregions; ++r)
+    {
+        PageId base = top - (r + 1) * (regionPages + 256); // 区域之间留一点空洞
+        for (size_t i = 0; i < regionPages; ++i)
+            pages.push_back(base + i);
+    }
+    return pages;
+}
+
+template <class Map>
+void BenchmarkPageMap(const char *name, const std::vector<PageId> &pages, const std::vector<PageId> &lookups)
+{
+    size_t rss0 = CurrentRSS();
+    Map *map = new Map;
+
+    auto begin1 = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < pages.size(); ++i)
+        map->set(pages[i], (void *)(uintptr_t)(pages[i] << PAGE_SHIFT));
+    auto end1 = std::chrono::steady_clock::now();
+
+    size_t rss1 = CurrentRSS();
+
+    uintptr_t sum = 0;
+    auto begin2 = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < lookups.size(); ++i)
+        sum += (uintptr_t)map->get(lookups[i]);
+    auto end2 = std::chrono::steady_clock::now();
+
+    double setNs = std::chrono::duration<double, std::nano>(end1 - begin1).count() / pages.size();
+    double getNs = std::chrono::duration<double, std::nano>(end2 - begin2).count() / lookups.size();
+
+    printf("%-16s || set %6.2f ns/op || get %6.2f ns/op || metadata %8zu KB || RSS +%8zu KB (checksum %zx)\n",
+           name, setNs, getNs, map->MemoryUsage() / 1024, (rss1 - rss0) / 1024, (size_t)((sum >> PAGE_SHIFT) & 0xfff));
+    // 节点池不归还内存，这里不释放 map，避免下一个测试的 RSS 被污染
+}
+
+// 写一块比LLC大的缓冲区，把span和基数树叶子挤出cache
+static void EvictCaches()
+{
+    static std::vector<char> buffer(64 << 20);
+    for (size_t i = 0; i < buffer.size(); i += 64)
+        buffer[i]++;
+}
+
+// 冷span上的释放: 先申请nobjs块并打乱顺序，再分别测量
+// (1) MapObjectToSpan(ptr)->_objSize (2) size class字节表 (3) 完整的ConcurrentFree
+void BenchmarkColdFree(size_t nobjs, size_t size)
+{
+    std::vector<void *> v(nobjs);
+    for (size_t i = 0; i < nobjs; ++i)
+        v[i] = ConcurrentAlloc(size);
+    std::shuffle(v.begin(), v.end(), std::mt19937_64(7));
+
+    size_t sum = 0;
+    EvictCaches();
+    auto begin1 = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < nobjs; ++i)
+        sum += PageCache<DefaultPolicy>::GetInstance()->MapObjectToSpan(v[i])->_objSize;
+    auto end1 = std::chrono::steady_clock::now();
+
+    EvictCaches();
+    auto begin2 = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < nobjs; ++i)
+        sum += SizeClass<DefaultPolicy>::ClassToSize(PageCache<DefaultPolicy>::GetInstance()->MapObjectToSizeClass(v[i]) - 1);
+    auto end2 = std::chrono::steady_clock::now();
+
+    EvictCaches();
+    auto begin3 = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < nobjs; ++i)
+        ConcurrentFree(v[i]);
+    auto end3 = std::chrono::steady_clock::now();
+
+    double spanNs = std::chrono::duration<double, std::nano>(end1 - begin1).count() / nobjs;
+    double classNs = std::chrono::duration<double, std::nano>(end2 - begin2).count() / nobjs;
+    double freeNs = std::chrono::duration<double, std::nano>(end3 - begin3).count() / nobjs;
+
+    printf("%zu objects of %zu B (cold, shuffled) || span->_objSize %6.2f ns/op || size class map %6.2f ns/op || ConcurrentFree %6.2f ns/op (%.1f Mops/s) (checksum %zu)\n",
+           nobjs, size, spanNs, classNs, freeNs, 1000.0 / freeNs, sum / nobjs);
+}
+
+int main(int argc, char *argv[])
+{
+    size_t nregions = argc > 1 ? atoi(argv[1]) : 8;
+    size_t regionMB = argc > 2 ? atoi(argv[2]) : 64;
+    size_t nlookups = argc > 3 ? atoi(argv[3]) : (1 << 22);
+
+    size_t regionPages = (regionMB << 20) >> PAGE_SHIFT;
+    std::vector<PageId> pages = MakeHeapPages(nregions, regionPages);
+
+    std::mt19937_64 rng(42);
+    std::vector<PageId> lookups(nlookups);
+    for (size_t i = 0; i < nlookups; ++i)
+        lookups[i] = pages[rng() % pages.size()];
+
+    printf("================================================\n");
+    printf("%zu regions || %zu MB each || %zu pages || %zu random lookups\n",
+           nregions, regionMB, pages.size(), nlookups);
+    BenchmarkPageMap<OldPageMap>("TCMalloc_PageMap3", pages, lookups);
+    BenchmarkPageMap<NewPageMap>("AtomicPageMap3", pages, lookups);
+    printf("================================================\n");
+    BenchmarkColdFree(1 << 18, 200);
+    BenchmarkColdFree(1 << 16, 3000);
+    printf("================================================\n");
+    return 0;
+}
@@ -0,0 +1,54 @@
+#!/bin/bash
+
+# 用perf统计慢路径探针（Probes.h）：每秒各探针的次数，以及各size class从cc取批量的次数和平均块数
+# 需要用带sys/sdt.h的环境编译（build-perf.sh会装systemtap-sdt-dev）
+# 需要perf和gawk
+# 用法: sudo ./probes/perf-slowpath.sh ./_build/benchmark 10000 4 10 0
+
+if [ $# -lt 1 ] || [ ! -x "$1" ]; then
+    echo "用法: $0 <binary> [args...]"
+    exit 1
+fi
+
+BIN=$(realpath "$1")
+shift
+PROBES="tc_fetch tc_list_too_long cc_get_span cc_release_span pc_system_alloc pc_coalesce"
+
+if ! readelf -n "$BIN" | grep -q "Provider: mempool"; then
+    echo "$BIN 里没有mempool探针，请安装systemtap-sdt-dev后重新编译"
+    exit 1
+fi
+
+# 把二进制里的SDT note加入buildid缓存，再为每个探针建立事件
+perf buildid-cache --add "$BIN"
+for p in $PROBES; do
+    perf probe -q -d "sdt_mempool:$p" 2>/dev/null
+    perf probe -q -x "$BIN" "sdt_mempool:$p" || exit 1
+done
+
+EVENTS=$(for p in $PROBES; do printf "sdt_mempool:%s," "$p"; done)
+EVENTS=${EVENTS%,}
+
+# 每秒速率
+perf stat -I 1000 -e "$EVENTS" -- "$BIN" "$@"
+
+# 各size class的tc_fetch次数和平均批量（arg1是class，arg4是实际拿到的块数）
+perf record -q -o perf-slowpath.data -e sdt_mempool:tc_fetch -- "$BIN" "$@" > /dev/null
+perf script -i perf-slowpath.data -F trace 2>/dev/null | gawk '
+{
+    for (i = 1; i <= NF; ++i) {
+        split($i, kv, "=")
+        if (kv[1] == "arg1") cls = strtonum(kv[2])
+        if (kv[1] == "arg4") got = strtonum(kv[2])
+    }
+    count[cls]++
+    blocks[cls] += got
+}
+END {
+    printf "%6s %10s %10s\n", "class", "fetches", "avg batch"
+    for (c in count) printf "%6d %10d %10.1f\n", c, count[c], blocks[c] / count[c]
+}' | sort -n
+
+for p in $PROBES; do
+    perf probe -q -d "sdt_mempool:$p"
+done
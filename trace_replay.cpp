@@ -0,0 +1,219 @@
+/**
+ * 回放StartAllocTrace记录的分配轨迹，对比glibc malloc和ConcurrentAlloc，或者离线扫ConcurrentAlloc的参数
+ *
+ * 用法: trace_replay trace.bin [-a pool|malloc] [--max-batch N] [--span-growth N] [--max-free-list N]
+ *                               [--fixed-spans] [-o result.json] [-l 标签]
+ *
+ * 原来的每个线程对应一个回放线程，按原来的顺序执行自己的申请和释放，不按时间戳等待（尽快回放）。
+ * 对象可能由别的线程释放：每个对象一个原子槽位，释放前等申请它的线程把指针放进去，
+ * 所以跨线程的先后关系和原来一致。轨迹结束时还没释放的对象在计时之后统一释放。
+ *
+ * 输出回放时间、后台线程每kSampleMs毫秒采样的峰值RSS（相对开始前）、轨迹本身的峰值存活申请字节，
+ * 用ConcurrentAlloc时再输出各层字节数。参数覆盖写进AllocTunables，只影响这个进程。
+ * ConcurrentAlloc只支持不超过kMaxBytes的申请，更大的交给malloc。
+ */
+
+#include <thread>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <atomic>
+#include "ConcurrentAlloc.h"
+#include "MallocStats.h"
+#include "TraceRecorder.h"
+#include "BenchUtil.h"
+
+static const int kSampleMs = 5; // RSS采样间隔
+
+static void *Alloc(bool pool, size_t size)
+{
+    if (pool && size <= DefaultPolicy::kMaxBytes)
+        return ConcurrentAlloc(size);
+    return malloc(size);
+}
+
+static void Free(bool pool, void *ptr, size_t size)
+{
+    if (pool && size <= DefaultPolicy::kMaxBytes)
+        ConcurrentFree(ptr);
+    else
+        free(ptr);
+}
+
+// 一个原来线程的回放
+static void ReplayThread(bool pool, const std::vector<ReplayOp> &ops, const ReplayPlan &plan,
+                         std::vector<std::atomic<void *> > &slots, std::atomic<bool> &go)
+{
+    while (!go.load(std::memory_order_acquire))
+        std::this_thread::yield();
+    for (const ReplayOp &op : ops)
+    {
+        if (op.op == kTraceAlloc)
+        {
+            // 申请0字节时ConcurrentAlloc也会给一块，malloc(0)可能返回空，至少申请1字节保证槽位非空
+            void *ptr = Alloc(pool, op.size ? op.size : 1);
+            ((char *)ptr)[0] = 1;
+            slots[op.object].store(ptr, std::memory_order_release);
+        }
+        else
+        {
+            void *ptr;
+            // 由别的线程申请的对象可能还没申请出来
+            while ((ptr = slots[op.object].load(std::memory_order_acquire)) == nullptr)
+                std::this_thread::yield();
+            slots[op.object].store(nullptr, std::memory_order_relaxed);
+            uint32_t size = plan.objectSizes[op.object];
+            Free(pool, ptr, size ? size : 1);
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    const char *tracePath = nullptr;
+    bool pool = true;
+    bool fixedSpans = false;
+    const char *jsonPath = nullptr;
+    std::string label;
+    AllocTunables &tunables = AllocTunables::Get();
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--fixed-spans") == 0)
+        {
+            fixedSpans = true;
+            continue;
+        }
+        if (argv[i][0] != '-')
+        {
+            tracePath = argv[i];
+            continue;
+        }
+        if (i + 1 >= argc)
+        {
+            tracePath = nullptr;
+            break;
+        }
+        if (strcmp(argv[i], "-a") == 0)
+            pool = strcmp(argv[++i], "malloc") != 0;
+        else if (strcmp(argv[i], "--max-batch") == 0)
+            tunables.maxBatch.store(strtoull(argv[++i], nullptr, 10));
+        else if (strcmp(argv[i], "--span-growth") == 0)
+            tunables.spanGrowth.store(strtoull(argv[++i], nullptr, 10));
+        else if (strcmp(argv[i], "--max-free-list") == 0)
+            tunables.maxFreeListSize.store(strtoull(argv[++i], nullptr, 10));
+        else if (strcmp(argv[i], "-o") == 0)
+            jsonPath = argv[++i];
+        else if (strcmp(argv[i], "-l") == 0)
+            label = argv[++i];
+        else
+        {
+            printf("unknown option %s\n", argv[i]);
+            return 1;
+        }
+    }
+    if (tracePath == nullptr)
+    {
+        printf("Usage: %s trace.bin [-a pool|malloc] [--max-batch N] [--span-growth N] [--max-free-list N] "
+               "[--fixed-spans] [-o result.json] [-l label]\n", argv[0]);
+        return 1;
+    }
+    if (fixedSpans)
+        CentralCache<DefaultPolicy>::GetInstance()->SetAdaptiveSpanSizing(false);
+
+    TraceHeader header;
+    std::vector<TraceRecord> records;
+    if (!LoadAllocTrace(tracePath, header, records))
+    {
+        printf("cannot load trace %s\n", tracePath);
+        return 1;
+    }
+    ReplayPlan plan;
+    BuildReplayPlan(records, plan);
+    records.clear();
+    records.shrink_to_fit();
+    size_t ops = 0;
+    for (const std::vector<ReplayOp> &t : plan.threads)
+        ops += t.size();
+    printf("trace %s: %zu ops, %zu objects, %zu threads, %zu dropped records, %zu unmatched frees, %zu never freed\n",
+           tracePath, ops, plan.objectSizes.size(), plan.threads.size(), (size_t)header.dropped,
+           plan.unmatchedFrees, plan.leaked.size());
+
+    std::vector<std::atomic<void *> > slots(plan.objectSizes.size());
+    for (std::atomic<void *> &s : slots)
+        s.store(nullptr, std::memory_order_relaxed);
+
+    // 峰值RSS采样
+    size_t baseRSS = CurrentRSS();
+    std::atomic<size_t> peakRSS(baseRSS);
+    std::atomic<bool> done(false);
+    std::thread sampler([&]
+                        {
+        while (!done.load(std::memory_order_relaxed))
+        {
+            size_t rss = CurrentRSS();
+            if (rss > peakRSS.load(std::memory_order_relaxed))
+                peakRSS.store(rss, std::memory_order_relaxed);
+            std::this_thread::sleep_for(std::chrono::milliseconds(kSampleMs));
+        } });
+
+    std::atomic<bool> go(false);
+    std::vector<std::thread> threads;
+    for (const std::vector<ReplayOp> &t : plan.threads)
+        threads.emplace_back(ReplayThread, pool, std::cref(t), std::cref(plan), std::ref(slots), std::ref(go));
+    auto begin = std::chrono::steady_clock::now();
+    go.store(true, std::memory_order_release);
+    for (std::thread &t : threads)
+        t.join();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+    done.store(true, std::memory_order_relaxed);
+    sampler.join();
+    size_t rss = CurrentRSS();
+    if (rss > peakRSS.load(std::memory_order_relaxed))
+        peakRSS.store(rss, std::memory_order_relaxed);
+    size_t peakDelta = peakRSS.load() - baseRSS;
+
+    MallocStatsData stats;
+    if (pool)
+        CollectMallocStats<DefaultPolicy>(stats);
+    for (uint32_t object : plan.leaked)
+    {
+        void *ptr = slots[object].load(std::memory_order_relaxed);
+        if (ptr != nullptr)
+            Free(pool, ptr, plan.objectSizes[object] ? plan.objectSizes[object] : 1);
+    }
+
+    const char *allocator = pool ? "ConcurrentAlloc" : "malloc";
+    printf("[%-15s] %8.3f s || %8.2f M ops/s || peak RSS +%.1f MB || peak live requested %.1f MB\n",
+           allocator, seconds, ops / seconds / 1e6, peakDelta / 1048576.0, plan.peakLiveBytes / 1048576.0);
+    if (pool)
+    {
+        printf("  max_batch=%zu span_growth=%zu max_free_list=%zu adaptive_spans=%d || mmapped %.1f MB, "
+               "page heap free %.1f MB, central free %.1f MB, thread caches %.1f MB\n",
+               tunables.maxBatch.load(), tunables.spanGrowth.load(), tunables.maxFreeListSize.load(), !fixedSpans,
+               stats.mmappedBytes / 1048576.0, stats.pageCacheFreeBytes / 1048576.0,
+               stats.centralCacheBytes / 1048576.0, stats.threadCacheBytes / 1048576.0);
+    }
+
+    if (jsonPath != nullptr)
+    {
+        FILE *fp = fopen(jsonPath, "w");
+        if (fp == nullptr)
+        {
+            printf("cannot open %s\n", jsonPath);
+            return 1;
+        }
+        fprintf(fp, "{\"label\":\"%s\",\"trace\":\"%s\",\"allocator\":\"%s\",\"ops\":%zu,\"threads\":%zu,"
+                    "\"seconds\":%.6f,\"peak_rss_bytes\":%zu,\"peak_live_requested_bytes\":%zu,"
+                    "\"max_batch\":%zu,\"span_growth\":%zu,\"max_free_list\":%zu,\"adaptive_spans\":%s,"
+                    "\"mmapped_bytes\":%zu}\n",
+                label.c_str(), tracePath, allocator, ops, plan.threads.size(), seconds, peakDelta,
+                plan.peakLiveBytes, tunables.maxBatch.load(), tunables.spanGrowth.load(),
+                tunables.maxFreeListSize.load(), fixedSpans ? "false" : "true", pool ? stats.mmappedBytes : 0);
+        fclose(fp);
+    }
+    return 0;
+}
@@ -0,0 +1,712 @@
+/**
+ * 接近真实服务的负载，对比glibc malloc和ConcurrentAlloc，结果可以输出成JSON跟踪版本间的回归
+ *
+ *   larson             Larson风格：每个线程随机替换一个槽位里的对象，每轮结束后槽位数组轮换给下一个线程，
+ *                      上一个线程申请的对象由别的线程释放
+ *   producer_consumer  生产者申请并写入，通过有界队列交给消费者读取后释放
+ *   powerlaw           幂律分布的size，从16B到8MB，保留最近的64个对象
+ *   mixed_lifetime     5%的对象一直存活到结束，其余在32个对象的窗口里很快释放
+ *   containers         std::map<int, std::string>频繁插入删除，容器和字符串都用被测分配器
+ *
+ * 用法: workload_benchmark [-m] [-t 1,2,4] [-w larson,powerlaw] [-n 申请次数/线程] [-o results.json] [-l 标签] [-r trace.bin]
+ *
+ * -m 内存占用模式：每个(负载, 分配器, 线程数)在fork出的子进程里跑，互不影响常驻内存；
+ *    后台线程每kFootprintSampleMs毫秒采样一次RSS、用户持有的申请字节数和ConcurrentAlloc各层的字节数，
+ *    输出峰值RSS、稳态RSS（后半程的平均）、全部释放后的RSS和申请字节/常驻字节的比例
+ * -r 把ConcurrentAlloc的申请和释放记录到轨迹文件，用trace_replay回放，需要用-DMEMPOOL_TRACE=ON编译
+ * ConcurrentAlloc目前只支持不超过kMaxBytes的申请，更大的交给malloc（只影响powerlaw）
+ */
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+#include <deque>
+#include <map>
+#include <string>
+#include <chrono>
+#include <random>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <atomic>
+#include <algorithm>
+#include <sys/wait.h>
+#include "ConcurrentAlloc.h"
+#include "MallocStats.h"
+#include "BenchUtil.h"
+
+struct SystemMalloc
+{
+    static const char *Name() { return "malloc"; }
+    static void *Alloc(size_t size) { return malloc(size); }
+    static void Free(void *ptr, size_t) { free(ptr); }
+};
+
+struct PoolMalloc
+{
+    static const char *Name() { return "ConcurrentAlloc"; }
+    static void *Alloc(size_t size)
+    {
+        return size <= DefaultPolicy::kMaxBytes ? ConcurrentAlloc(size) : malloc(size);
+    }
+    static void Free(void *ptr, size_t size)
+    {
+        if (size <= DefaultPolicy::kMaxBytes)
+            ConcurrentFree(ptr);
+        else
+            free(ptr);
+    }
+};
+
+// 内存占用模式下统计用户持有的申请字节数
+static std::atomic<size_t> gRequestedBytes(0);
+
+template <class A>
+struct Tracked
+{
+    static const char *Name() { return A::Name(); }
+    static void *Alloc(size_t size)
+    {
+        gRequestedBytes.fetch_add(size, std::memory_order_relaxed);
+        return A::Alloc(size);
+    }
+    static void Free(void *ptr, size_t size)
+    {
+        A::Free(ptr, size);
+        gRequestedBytes.fetch_sub(size, std::memory_order_relaxed);
+    }
+};
+
+// 让标准容器使用被测分配器
+template <class T, class A>
+struct StlAllocator
+{
+    typedef T value_type;
+    template <class U>
+    struct rebind
+    {
+        typedef StlAllocator<U, A> other;
+    };
+
+    StlAllocator() {}
+    template <class U>
+    StlAllocator(const StlAllocator<U, A> &) {}
+
+    T *allocate(size_t n) { return (T *)A::Alloc(n * sizeof(T)); }
+    void deallocate(T *ptr, size_t n) { A::Free(ptr, n * sizeof(T)); }
+
+    template <class U>
+    bool operator==(const StlAllocator<U, A> &) const { return true; }
+    template <class U>
+    bool operator!=(const StlAllocator<U, A> &) const { return false; }
+};
+
+struct Block
+{
+    void *ptr;
+    size_t size;
+};
+
+// 写一下首尾，保证页真正被用到
+static inline void Touch(const Block &b)
+{
+    ((char *)b.ptr)[0] = 1;
+    ((char *)b.ptr)[b.size - 1] = 1;
+}
+
+// C++11没有std::barrier
+class Barrier
+{
+public:
+    explicit Barrier(size_t n) : _n(n) {}
+
+    void Wait()
+    {
+        std::unique_lock<std::mutex> lock(_mtx);
+        size_t generation = _generation;
+        if (++_arrived == _n)
+        {
+            _arrived = 0;
+            _generation++;
+            _cv.notify_all();
+            return;
+        }
+        _cv.wait(lock, [&]
+                 { return generation != _generation; });
+    }
+
+private:
+    std::mutex _mtx;
+    std::condition_variable _cv;
+    size_t _n;
+    size_t _arrived = 0;
+    size_t _generation = 0;
+};
+
+// 起nthreads个线程执行f(tid)并等待结束
+template <class F>
+static void RunThreads(size_t nthreads, F f)
+{
+    std::vector<std::thread> threads;
+    for (size_t k = 0; k < nthreads; ++k)
+        threads.emplace_back(f, k);
+    for (auto &t : threads)
+        t.join();
+}
+
+// 每个函数返回申请次数（每次申请对应一次释放）
+template <class A>
+static size_t Larson(size_t nthreads, size_t ops)
+{
+    const size_t kSlots = 1000;
+    const size_t kEpochs = 10;
+    std::vector<std::vector<Block> > arrays(nthreads, std::vector<Block>(kSlots));
+    Barrier barrier(nthreads);
+    RunThreads(nthreads, [&](size_t tid)
+               {
+        std::mt19937 rng(tid + 1);
+        for (Block &b : arrays[tid]) {
+            b.size = rng() % 497 + 16;
+            b.ptr = A::Alloc(b.size);
+            Touch(b);
+        }
+        barrier.Wait();
+        for (size_t epoch = 0; epoch < kEpochs; ++epoch) {
+            std::vector<Block> &slots = arrays[(tid + epoch) % nthreads]; // 轮换，释放别的线程申请的对象
+            for (size_t i = 0; i < ops / kEpochs; ++i) {
+                Block &b = slots[rng() % kSlots];
+                A::Free(b.ptr, b.size);
+                b.size = rng() % 497 + 16;
+                b.ptr = A::Alloc(b.size);
+                Touch(b);
+            }
+            barrier.Wait();
+        }
+        for (Block &b : arrays[(tid + kEpochs) % nthreads])
+            A::Free(b.ptr, b.size); });
+    return nthreads * (kSlots + ops / kEpochs * kEpochs);
+}
+
+// 有界队列，生产者和消费者各一个
+class BlockQueue
+{
+public:
+    static const size_t kCapacity = 1024;
+
+    void Push(const Block &b)
+    {
+        std::unique_lock<std::mutex> lock(_mtx);
+        _notFull.wait(lock, [&]
+                      { return _queue.size() < kCapacity; });
+        _queue.push_back(b);
+        _notEmpty.notify_one();
+    }
+
+    Block Pop()
+    {
+        std::unique_lock<std::mutex> lock(_mtx);
+        _notEmpty.wait(lock, [&]
+                       { return !_queue.empty(); });
+        Block b = _queue.front();
+        _queue.pop_front();
+        _notFull.notify_one();
+        return b;
+    }
+
+private:
+    std::mutex _mtx;
+    std::condition_variable _notFull, _notEmpty;
+    std::deque<Block> _queue;
+};
+
+template <class A>
+static size_t ProducerConsumer(size_t nthreads, size_t ops)
+{
+    if (nthreads < 2) // 只有一个线程时批量申请再批量释放
+    {
+        std::vector<Block> batch(BlockQueue::kCapacity);
+        for (size_t i = 0; i < ops; i += batch.size())
+        {
+            for (size_t j = 0; j < batch.size(); ++j)
+            {
+                batch[j].size = (i + j) % 1024 + 16;
+                batch[j].ptr = A::Alloc(batch[j].size);
+                Touch(batch[j]);
+            }
+            for (const Block &b : batch)
+                A::Free(b.ptr, b.size);
+        }
+        return (ops + batch.size() - 1) / batch.size() * batch.size();
+    }
+
+    size_t pairs = nthreads / 2;
+    std::vector<BlockQueue> queues(pairs);
+    RunThreads(pairs * 2, [&](size_t tid)
+               {
+        BlockQueue &queue = queues[tid / 2];
+        if (tid % 2 == 0) {
+            for (size_t i = 0; i < ops; ++i) {
+                Block b;
+                b.size = i % 1024 + 16;
+                b.ptr = A::Alloc(b.size);
+                memset(b.ptr, (int)i, b.size);
+                queue.Push(b);
+            }
+        } else {
+            for (size_t i = 0; i < ops; ++i) {
+                Block b = queue.Pop();
+                volatile char c = ((char *)b.ptr)[b.size / 2];
+                (void)c;
+                A::Free(b.ptr, b.size);
+            }
+        } });
+    return pairs * ops;
+}
+
+template <class A>
+static size_t PowerLaw(size_t nthreads, size_t ops)
+{
+    const size_t kWindow = 64;
+    const size_t kMinSize = 16;
+    const size_t kMaxSize = 8 * 1024 * 1024;
+    const double kAlpha = 0.9; // Pareto分布的形状参数，越小大块越多
+    RunThreads(nthreads, [&](size_t tid)
+               {
+        std::mt19937_64 rng(tid + 1);
+        std::uniform_real_distribution<double> uniform(0.0, 1.0);
+        std::vector<Block> window(kWindow, Block{nullptr, 0});
+        for (size_t i = 0; i < ops; ++i) {
+            Block &b = window[i % kWindow];
+            if (b.ptr)
+                A::Free(b.ptr, b.size);
+            double size = kMinSize / std::pow(1.0 - uniform(rng), 1.0 / kAlpha);
+            b.size = size > kMaxSize ? kMaxSize : (size_t)size;
+            b.ptr = A::Alloc(b.size);
+            Touch(b);
+        }
+        for (Block &b : window)
+            if (b.ptr)
+                A::Free(b.ptr, b.size); });
+    return nthreads * ops;
+}
+
+template <class A>
+static size_t MixedLifetime(size_t nthreads, size_t ops)
+{
+    const size_t kWindow = 32;
+    RunThreads(nthreads, [&](size_t tid)
+               {
+        std::mt19937 rng(tid + 1);
+        std::vector<Block> longLived;
+        std::vector<Block> window(kWindow, Block{nullptr, 0});
+        for (size_t i = 0; i < ops; ++i) {
+            Block b;
+            b.size = rng() % 1009 + 16;
+            b.ptr = A::Alloc(b.size);
+            Touch(b);
+            if (rng() % 100 < 5) {
+                longLived.push_back(b);
+            } else {
+                Block &old = window[i % kWindow];
+                if (old.ptr)
+                    A::Free(old.ptr, old.size);
+                old = b;
+            }
+        }
+        for (Block &b : window)
+            if (b.ptr)
+                A::Free(b.ptr, b.size);
+        for (Block &b : longLived)
+            A::Free(b.ptr, b.size); });
+    return nthreads * ops;
+}
+
+template <class A>
+static size_t Containers(size_t nthreads, size_t ops)
+{
+    typedef std::basic_string<char, std::char_traits<char>, StlAllocator<char, A> > String;
+    typedef std::map<uint32_t, String, std::less<uint32_t>, StlAllocator<std::pair<const uint32_t, String>, A> > Map;
+    const uint32_t kKeys = 8192;
+    RunThreads(nthreads, [&](size_t tid)
+               {
+        std::mt19937 rng(tid + 1);
+        Map map;
+        for (size_t i = 0; i < ops; ++i) {
+            uint32_t key = rng() % kKeys;
+            if (rng() % 3 == 0) {
+                map.erase(key);
+            } else {
+                // 超过短字符串优化的长度，字符串本身也在堆上
+                map[key] = String(rng() % 200 + 16, (char)('a' + i % 26));
+            }
+        } });
+    return nthreads * ops; // 近似：插入时申请节点和字符串，删除时释放
+}
+
+typedef size_t (*WorkloadFn)(size_t, size_t);
+
+struct Workload
+{
+    const char *name;
+    WorkloadFn run[2];     // malloc, ConcurrentAlloc
+    WorkloadFn tracked[2]; // 统计申请字节数的版本，内存占用模式使用
+};
+
+#define WORKLOAD(name, fn)                                   \
+    {                                                        \
+        name, {fn<SystemMalloc>, fn<PoolMalloc>},            \
+        {                                                    \
+            fn<Tracked<SystemMalloc> >, fn<Tracked<PoolMalloc> > \
+        }                                                    \
+    }
+
+static const Workload kWorkloads[] = {
+    WORKLOAD("larson", Larson),
+    WORKLOAD("producer_consumer", ProducerConsumer),
+    WORKLOAD("powerlaw", PowerLaw),
+    WORKLOAD("mixed_lifetime", MixedLifetime),
+    WORKLOAD("containers", Containers),
+};
+
+static const char *const kAllocatorNames[2] = {SystemMalloc::Name(), PoolMalloc::Name()};
+
+struct Result
+{
+    std::string workload;
+    std::string allocator;
+    size_t threads;
+    size_t allocs;
+    double seconds;
+    std::string footprint; // 内存占用模式下的JSON字段，以逗号开头
+};
+
+static const int kFootprintSampleMs = 5;
+
+struct FootprintSample
+{
+    double ms;
+    size_t rss;          // 常驻内存，减去开始时的基线
+    size_t requested;    // 用户持有的申请字节数
+    size_t mmapped;      // ConcurrentAlloc向系统申请的字节数，malloc为0
+    size_t threadCache;  // 下面三项是ConcurrentAlloc各层缓存的空闲字节
+    size_t centralFree;
+    size_t pageHeapFree;
+};
+
+static FootprintSample TakeSample(double ms, size_t baseline, bool pool)
+{
+    FootprintSample s = {ms, 0, gRequestedBytes.load(std::memory_order_relaxed), 0, 0, 0, 0};
+    size_t rss = CurrentRSS();
+    s.rss = rss > baseline ? rss - baseline : 0;
+    if (pool)
+    {
+        MallocStatsData data;
+        CollectMallocStats<DefaultPolicy>(data);
+        s.mmapped = data.mmappedBytes;
+        s.threadCache = data.threadCacheBytes;
+        s.centralFree = data.centralCacheBytes;
+        s.pageHeapFree = data.pageCacheFreeBytes;
+    }
+    return s;
+}
+
+// 子进程中运行，后台线程采样，结果写成一行文字和一行JSON字段
+static std::string RunFootprint(WorkloadFn fn, bool pool, size_t nthreads, size_t ops, size_t &allocs, double &seconds)
+{
+    size_t baseline = CurrentRSS();
+    std::vector<FootprintSample> samples;
+    std::atomic<bool> done(false);
+    auto begin = std::chrono::steady_clock::now();
+    auto elapsedMs = [&]
+    { return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count(); };
+
+    std::thread sampler([&]
+                        {
+        while (!done.load()) {
+            samples.push_back(TakeSample(elapsedMs(), baseline, pool));
+            std::this_thread::sleep_for(std::chrono::milliseconds(kFootprintSampleMs));
+        } });
+    allocs = fn(nthreads, ops);
+    seconds = elapsedMs() / 1000;
+    done.store(true);
+    sampler.join();
+    FootprintSample after = TakeSample(elapsedMs(), baseline, pool); // 全部释放之后
+
+    // ConcurrentAlloc各层缓存的空闲字节，和RSS一样取峰值和后半程平均
+    struct Tier
+    {
+        size_t FootprintSample::*field;
+        size_t peak;
+        double steady;
+    } tiers[] = {{&FootprintSample::threadCache, 0, 0},
+                 {&FootprintSample::centralFree, 0, 0},
+                 {&FootprintSample::pageHeapFree, 0, 0}};
+
+    size_t peakRss = 0, peakRequested = 0, peakMmapped = 0;
+    double steadyRss = 0, steadyRequested = 0;
+    size_t steadyCount = 0;
+    for (const FootprintSample &s : samples)
+    {
+        peakRss = std::max(peakRss, s.rss);
+        peakRequested = std::max(peakRequested, s.requested);
+        peakMmapped = std::max(peakMmapped, s.mmapped);
+        for (Tier &t : tiers)
+            t.peak = std::max(t.peak, s.*t.field);
+        if (s.ms * 2 >= seconds * 1000) // 后半程算稳态
+        {
+            steadyRss += s.rss;
+            steadyRequested += s.requested;
+            for (Tier &t : tiers)
+                t.steady += s.*t.field;
+            steadyCount++;
+        }
+    }
+    if (steadyCount)
+    {
+        steadyRss /= steadyCount;
+        steadyRequested /= steadyCount;
+        for (Tier &t : tiers)
+            t.steady /= steadyCount;
+    }
+    double ratio = steadyRss > 0 ? steadyRequested / steadyRss : 0;
+
+    std::string out;
+    char buf[1024];
+    snprintf(buf, sizeof(buf),
+             "peak RSS %8.2f MB || steady RSS %8.2f MB || after free %8.2f MB || requested/resident %5.2f || mmapped peak %8.2f MB",
+             peakRss / 1048576.0, steadyRss / 1048576.0, after.rss / 1048576.0, ratio, peakMmapped / 1048576.0);
+    out += buf;
+    if (pool)
+    {
+        snprintf(buf, sizeof(buf), " || peak/steady MB: tc %.2f/%.2f, central %.2f/%.2f, page heap %.2f/%.2f",
+                 tiers[0].peak / 1048576.0, tiers[0].steady / 1048576.0, tiers[1].peak / 1048576.0,
+                 tiers[1].steady / 1048576.0, tiers[2].peak / 1048576.0, tiers[2].steady / 1048576.0);
+        out += buf;
+    }
+    out += "\n";
+    snprintf(buf, sizeof(buf),
+             ",\"peak_rss\":%zu,\"steady_rss\":%.0f,\"final_rss\":%zu,\"peak_requested\":%zu,\"steady_requested\":%.0f,"
+             "\"requested_to_resident\":%.4f,\"peak_mmapped\":%zu,\"peak_thread_cache\":%zu,\"steady_thread_cache\":%.0f,"
+             "\"final_thread_cache\":%zu,\"peak_central_free\":%zu,\"steady_central_free\":%.0f,\"final_central_free\":%zu,"
+             "\"peak_page_heap_free\":%zu,\"steady_page_heap_free\":%.0f,\"final_page_heap_free\":%zu,\"samples\":[",
+             peakRss, steadyRss, after.rss, peakRequested, steadyRequested, ratio, peakMmapped,
+             tiers[0].peak, tiers[0].steady, after.threadCache, tiers[1].peak, tiers[1].steady, after.centralFree,
+             tiers[2].peak, tiers[2].steady, after.pageHeapFree);
+    out += buf;
+    // 时间序列：[毫秒, rss, 申请字节, mmapped, tc缓存, cc空闲, pc空闲]，最多200个点
+    size_t step = samples.size() / 200 + 1;
+    for (size_t i = 0; i < samples.size(); i += step)
+    {
+        const FootprintSample &s = samples[i];
+        snprintf(buf, sizeof(buf), "%s[%.1f,%zu,%zu,%zu,%zu,%zu,%zu]", i ? "," : "", s.ms, s.rss, s.requested,
+                 s.mmapped, s.threadCache, s.centralFree, s.pageHeapFree);
+        out += buf;
+    }
+    out += "]";
+    return out;
+}
+
+// fork一个子进程跑RunFootprint，从管道读回结果
+static bool ForkFootprint(WorkloadFn fn, bool pool, size_t nthreads, size_t ops, Result &r, std::string &summary)
+{
+    int fds[2];
+    if (pipe(fds) != 0)
+        return false;
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid < 0)
+        return false;
+    if (pid == 0)
+    {
+        close(fds[0]);
+        size_t allocs = 0;
+        double seconds = 0;
+        std::string out = RunFootprint(fn, pool, nthreads, ops, allocs, seconds);
+        char head[64];
+        snprintf(head, sizeof(head), "%zu %.6f\n", allocs, seconds);
+        out = head + out;
+        const char *p = out.data();
+        size_t left = out.size();
+        while (left > 0)
+        {
+            ssize_t n = write(fds[1], p, left);
+            if (n <= 0)
+                _exit(1);
+            p += n;
+            left -= n;
+        }
+        _exit(0);
+    }
+
+    close(fds[1]);
+    std::string out;
+    char buf[4096];
+    ssize_t n;
+    while ((n = read(fds[0], buf, sizeof(buf))) > 0)
+        out.append(buf, n);
+    close(fds[0]);
+    int status = 0;
+    waitpid(pid, &status, 0);
+    size_t firstLine = out.find('\n');
+    size_t secondLine = firstLine == std::string::npos ? std::string::npos : out.find('\n', firstLine + 1);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0 || secondLine == std::string::npos)
+        return false;
+    if (sscanf(out.c_str(), "%zu %lf", &r.allocs, &r.seconds) != 2)
+        return false;
+    summary = out.substr(firstLine + 1, secondLine - firstLine);
+    r.footprint = out.substr(secondLine + 1);
+    return true;
+}
+
+static std::vector<std::string> Split(const char *arg)
+{
+    std::vector<std::string> out;
+    std::string cur;
+    for (const char *p = arg;; ++p)
+    {
+        if (*p == ',' || *p == '\0')
+        {
+            if (!cur.empty())
+                out.push_back(cur);
+            cur.clear();
+            if (*p == '\0')
+                break;
+        }
+        else
+        {
+            cur += *p;
+        }
+    }
+    return out;
+}
+
+static bool WriteJson(const char *path, const std::string &label, size_t ops, bool footprint, const std::vector<Result> &results)
+{
+    FILE *fp = fopen(path, "w");
+    if (fp == nullptr)
+        return false;
+    fprintf(fp, "{\"benchmark\":\"%s\",\"label\":\"%s\",\"allocs_per_thread\":%zu,\"page_size\":%zu,\"results\":[",
+            footprint ? "footprint" : "workload", label.c_str(), ops, (size_t)1 << DefaultPolicy::kPageShift);
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+        const Result &r = results[i];
+        fprintf(fp, "%s\n  {\"workload\":\"%s\",\"allocator\":\"%s\",\"threads\":%zu,\"allocs\":%zu,\"seconds\":%.6f,\"allocs_per_sec\":%.0f%s}",
+                i ? "," : "", r.workload.c_str(), r.allocator.c_str(), r.threads, r.allocs, r.seconds, r.allocs / r.seconds,
+                r.footprint.c_str());
+    }
+    fprintf(fp, "\n]}\n");
+    return fclose(fp) == 0;
+}
+
+int main(int argc, char *argv[])
+{
+    std::vector<std::string> threadArgs = Split("1,2,4");
+    std::vector<std::string> names;
+    size_t ops = 200000;
+    const char *jsonPath = nullptr;
+    std::string label;
+    bool footprint = false;
+    const char *tracePath = nullptr;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "-m") == 0)
+        {
+            footprint = true;
+            continue;
+        }
+        if (i + 1 >= argc)
+        {
+            printf("Usage: %s [-m] [-t 1,2,4] [-w larson,powerlaw,...] [-n allocs_per_thread] [-o results.json] [-l label] [-r trace.bin]\n", argv[0]);
+            return 1;
+        }
+        if (strcmp(argv[i], "-t") == 0)
+            threadArgs = Split(argv[++i]);
+        else if (strcmp(argv[i], "-w") == 0)
+            names = Split(argv[++i]);
+        else if (strcmp(argv[i], "-n") == 0)
+            ops = strtoull(argv[++i], nullptr, 10);
+        else if (strcmp(argv[i], "-o") == 0)
+            jsonPath = argv[++i];
+        else if (strcmp(argv[i], "-l") == 0)
+            label = argv[++i];
+        else if (strcmp(argv[i], "-r") == 0)
+            tracePath = argv[++i];
+        else
+        {
+            printf("unknown option %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    std::vector<const Workload *> selected;
+    for (const Workload &w : kWorkloads)
+    {
+        bool wanted = names.empty();
+        for (const std::string &n : names)
+            wanted = wanted || n == w.name;
+        if (wanted)
+            selected.push_back(&w);
+    }
+    if (selected.empty())
+    {
+        printf("no workload selected\n");
+        return 1;
+    }
+
+    if (tracePath != nullptr && footprint)
+    {
+        printf("-r cannot be combined with -m: forked runs would share the trace file\n");
+        return 1;
+    }
+    if (tracePath != nullptr && !StartAllocTrace(tracePath))
+    {
+        printf(AllocTrace::kCompiledIn ? "cannot record trace to %s\n" : "trace hooks not compiled in, rebuild with -DMEMPOOL_TRACE=ON (%s)\n", tracePath);
+        return 1;
+    }
+
+    std::vector<Result> results;
+    for (const Workload *w : selected)
+    {
+        for (const std::string &t : threadArgs)
+        {
+            size_t nthreads = strtoull(t.c_str(), nullptr, 10);
+            if (nthreads == 0)
+                continue;
+            for (int pool = 0; pool < 2; ++pool)
+            {
+                Result r = {w->name, kAllocatorNames[pool], nthreads, 0, 0, ""};
+                if (footprint)
+                {
+                    std::string summary;
+                    if (!ForkFootprint(w->tracked[pool], pool != 0, nthreads, ops, r, summary))
+                    {
+                        printf("[%-17s] %-15s || %2zu threads || footprint run failed\n", r.workload.c_str(), r.allocator.c_str(), nthreads);
+                        return 1;
+                    }
+                    printf("[%-17s] %-15s || %2zu threads || %s", r.workload.c_str(), r.allocator.c_str(), nthreads, summary.c_str());
+                }
+                else
+                {
+                    auto begin = std::chrono::steady_clock::now();
+                    r.allocs = w->run[pool](nthreads, ops);
+                    r.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+                    printf("[%-17s] %-15s || %2zu threads || %10zu allocs || %8.3f s || %8.2f M allocs/s\n",
+                           r.workload.c_str(), r.allocator.c_str(), nthreads, r.allocs, r.seconds, r.allocs / r.seconds / 1e6);
+                }
+                results.push_back(r);
+            }
+        }
+    }
+
+    if (tracePath != nullptr)
+        printf("recorded %zu trace records to %s\n", StopAllocTrace(), tracePath);
+
+    if (jsonPath != nullptr && !WriteJson(jsonPath, label, ops, footprint, results))
+    {
+        printf("failed to write %s\n", jsonPath);
+        return 1;
+    }
+    return 0;
+}